@@ -87,6 +87,9 @@ enum uvc_frame_format {
   UVC_FRAME_FORMAT_NV12,
   /** YUV: P010 */
   UVC_FRAME_FORMAT_P010,
+  /** YUV420: I420, a Y plane followed by U and V planes of half the width
+   * and height, whose rows are half the Y plane's step (rounded up) */
+  UVC_FRAME_FORMAT_I420,
   /** Number of formats understood */
   UVC_FRAME_FORMAT_COUNT,
 };
@@ -223,6 +226,10 @@ typedef struct uvc_format_desc {
   /** Available frame specifications for this format */
   struct uvc_frame_desc *frame_descs;
   struct uvc_still_frame_desc *still_frame_desc;
+  /** Color matching descriptor fields, or zero if the format has none */
+  uint8_t bColorPrimaries;
+  uint8_t bTransferCharacteristics;
+  uint8_t bMatrixCoefficients;
 } uvc_format_desc_t;
 
 /** UVC request code (A.8) */
@@ -329,6 +336,25 @@ enum uvc_et_type {
 struct uvc_context;
 typedef struct uvc_context uvc_context_t;
 
+/** File descriptor to watch when handling USB events externally
+ * @ingroup init
+ */
+typedef struct uvc_pollfd {
+  int fd;
+  /** Events to poll for, as in poll(2) */
+  short events;
+} uvc_pollfd_t;
+
+/** Called when a descriptor should be added to an external event loop
+ * @ingroup init
+ */
+typedef void(uvc_pollfd_added_callback_t)(int fd, short events, void *user_ptr);
+
+/** Called when a descriptor should be removed from an external event loop
+ * @ingroup init
+ */
+typedef void(uvc_pollfd_removed_callback_t)(int fd, void *user_ptr);
+
 /** UVC device.
  *
  * Get this from uvc_get_device_list() or uvc_find_device().
@@ -352,6 +378,40 @@ typedef struct uvc_device_handle uvc_device_handle_t;
 struct uvc_stream_handle;
 typedef struct uvc_stream_handle uvc_stream_handle_t;
 
+/** Pool of threads for converting frames in parallel.
+ *
+ * Create one with uvc_convert_pool_create() and use it with
+ * uvc_convert_frame().
+ */
+struct uvc_convert_pool;
+typedef struct uvc_convert_pool uvc_convert_pool_t;
+
+/** Fixed set of preallocated frames.
+ *
+ * Create one with uvc_frame_pool_create(), take frames with
+ * uvc_frame_pool_get() and give them back with uvc_frame_pool_put().
+ */
+struct uvc_frame_pool;
+typedef struct uvc_frame_pool uvc_frame_pool_t;
+
+/** Reusable MJPEG decoding state.
+ *
+ * Create one with uvc_mjpeg_decoder_create() and use it with
+ * uvc_mjpeg_decode(). Only available when libuvc is built with JPEG
+ * support.
+ */
+struct uvc_mjpeg_decoder;
+typedef struct uvc_mjpeg_decoder uvc_mjpeg_decoder_t;
+
+/** Pipeline that decodes MJPEG frames on several threads.
+ *
+ * Create one with uvc_mjpeg_pipeline_create() and feed it with
+ * uvc_mjpeg_pipeline_push() or uvc_mjpeg_pipeline_callback(). Only
+ * available when libuvc is built with JPEG support.
+ */
+struct uvc_mjpeg_pipeline;
+typedef struct uvc_mjpeg_pipeline uvc_mjpeg_pipeline_t;
+
 /** Representation of the interface that brings data into the UVC device */
 typedef struct uvc_input_terminal {
   struct uvc_input_terminal *prev, *next;
@@ -449,6 +509,28 @@ typedef struct uvc_device_descriptor {
   const char *product;
 } uvc_device_descriptor_t;
 
+/** YUV to RGB conversion matrix
+ * @ingroup frame
+ */
+enum uvc_color_matrix {
+  /** ITU-R BT.601 (SDTV), libuvc's traditional choice */
+  UVC_COLOR_MATRIX_BT601 = 0,
+  /** ITU-R BT.709 (HDTV) */
+  UVC_COLOR_MATRIX_BT709,
+  /** ITU-R BT.2020 (UHDTV, non-constant luminance) */
+  UVC_COLOR_MATRIX_BT2020,
+};
+
+/** Range of YUV samples
+ * @ingroup frame
+ */
+enum uvc_color_range {
+  /** Samples use all of 0-255 */
+  UVC_COLOR_RANGE_FULL = 0,
+  /** Luma spans 16-235 and chroma 16-240 */
+  UVC_COLOR_RANGE_LIMITED,
+};
+
 /** An image frame received from the UVC device
  * @ingroup streaming
  */
@@ -463,11 +545,17 @@ typedef struct uvc_frame {
   uint32_t height;
   /** Pixel data format */
   enum uvc_frame_format frame_format;
-  /** Number of bytes per horizontal line (undefined for compressed format) */
+  /** Number of bytes per horizontal line (undefined for compressed format).
+   * Conversions into a buffer you supply keep its step if it is at least
+   * the size of a row, so rows may be padded. */
   size_t step;
   /** Frame number (may skip, but is strictly monotonically increasing) */
   uint32_t sequence;
-  /** Estimate of system time when the device started capturing the image */
+  /** Estimate of system time when the device started capturing the image,
+   * recovered from the device clock. Uses the same clock as
+   * capture_time_finished (CLOCK_MONOTONIC where available), and is zero
+   * until the device has sent enough clock references; see
+   * uvc_stream_get_clock_info(). */
   struct timeval capture_time;
   /** Estimate of system time when the device finished receiving the image */
   struct timespec capture_time_finished;
@@ -485,13 +573,207 @@ typedef struct uvc_frame {
   void *metadata;
   /** Size of metadata buffer */
   size_t metadata_bytes;
+  /** Matrix used when converting the frame from YUV to RGB */
+  enum uvc_color_matrix color_matrix;
+  /** Range of the frame's YUV samples */
+  enum uvc_color_range color_range;
+  /** Number of bytes allocated for data when the library owns it, which may
+   * be more than data_bytes */
+  size_t data_capacity;
+  /** Pool the frame belongs to, or NULL */
+  uvc_frame_pool_t *pool;
 } uvc_frame_t;
 
+/** A rectangle within a frame, in pixels
+ * @ingroup frame
+ */
+typedef struct uvc_roi {
+  /** Left edge */
+  uint32_t x;
+  /** Top edge */
+  uint32_t y;
+  uint32_t width;
+  uint32_t height;
+} uvc_roi_t;
+
 /** A callback function to handle incoming assembled UVC frames
  * @ingroup streaming
  */
 typedef void(uvc_frame_callback_t)(struct uvc_frame *frame, void *user_ptr);
 
+/** Demosaicing algorithm for raw Bayer frames
+ * @ingroup frame
+ */
+enum uvc_demosaic_method {
+  /** Average the nearest samples of each colour (fastest) */
+  UVC_DEMOSAIC_BILINEAR = 0,
+  /** Interpolate green along edges rather than across them, and red and blue
+   * from their difference to green. Sharper, with less colour fringing. */
+  UVC_DEMOSAIC_EDGE_AWARE,
+  /** Turn each 2x2 tile into one pixel, halving the width and height */
+  UVC_DEMOSAIC_SUPERPIXEL,
+};
+
+/** Resampling filter for uvc_convert_scaled()
+ * @ingroup scale
+ */
+enum uvc_scale_filter {
+  /** Average every input pixel under the output pixel */
+  UVC_SCALE_BOX = 0,
+  /** Interpolate between the four nearest input pixels */
+  UVC_SCALE_BILINEAR,
+};
+
+/** Inverse DCT used to decode MJPEG frames
+ * @ingroup frame
+ */
+enum uvc_mjpeg_dct_method {
+  /** Fast integer IDCT, slightly less accurate (default) */
+  UVC_MJPEG_DCT_FAST = 0,
+  /** Accurate integer IDCT */
+  UVC_MJPEG_DCT_INTEGER,
+  /** Floating point IDCT; as accurate as UVC_MJPEG_DCT_INTEGER and usually
+   * slower. Decoding fails if libjpeg was built without it. */
+  UVC_MJPEG_DCT_FLOAT,
+};
+
+/** Flags for uvc_frame_pool_create()
+ * @ingroup frame
+ */
+enum uvc_frame_pool_flags {
+  /** Back the frames with huge pages where the system supports it */
+  UVC_FRAME_POOL_HUGE_PAGES = 1,
+};
+
+/** What a stream does with a completed frame when its frame queue is full
+ * @ingroup streaming
+ */
+enum uvc_queue_policy {
+  /** Discard the oldest queued frame to make room (default) */
+  UVC_QUEUE_DROP_OLDEST = 0,
+  /** Discard the frame that was just completed */
+  UVC_QUEUE_DROP_NEWEST,
+  /** Stall frame assembly until the consumer makes room */
+  UVC_QUEUE_BLOCK,
+};
+
+/** Counters describing the health of a stream
+ * @ingroup streaming
+ *
+ * Counters accumulate from when the stream is opened, except where noted.
+ */
+typedef struct uvc_stream_stats {
+  /** Frames assembled, whether or not they reached a consumer */
+  uint64_t frames_completed;
+  /** Frames cut short because the frame ID bit flipped before an EOF */
+  uint64_t frames_fid_resync;
+  /** Queued frames discarded by UVC_QUEUE_DROP_OLDEST */
+  uint64_t frames_dropped_oldest;
+  /** Completed frames discarded by UVC_QUEUE_DROP_NEWEST, or because every
+   * frame buffer was leased out */
+  uint64_t frames_dropped_newest;
+  /** Number of times frame assembly stalled under UVC_QUEUE_BLOCK */
+  uint64_t queue_blocks;
+  /** Payload bytes received, headers included */
+  uint64_t bytes_received;
+  /** Transfers that completed successfully */
+  uint64_t transfers_completed;
+  /** Transfers that timed out and were resubmitted */
+  uint64_t transfers_timed_out;
+  /** Transfers that stalled and were resubmitted */
+  uint64_t transfers_stalled;
+  /** Transfers that overflowed and were resubmitted */
+  uint64_t transfers_overflowed;
+  /** Transfers that failed or could not be resubmitted, and were retired */
+  uint64_t transfers_failed;
+  /** Isochronous packets discarded because of a USB error */
+  uint64_t packets_bad;
+  /** Payloads discarded because the device set the header's error bit */
+  uint64_t payloads_error_bit;
+  /** Payloads discarded because the header length exceeded the payload */
+  uint64_t payloads_bogus_header;
+  /** Transfer buffers allocated with libusb_dev_mem_alloc() by the last
+   * uvc_stream_start() */
+  uint64_t transfer_bufs_dev_mem;
+  /** Transfer buffers allocated with malloc() by the last uvc_stream_start() */
+  uint64_t transfer_bufs_malloc;
+} uvc_stream_stats_t;
+
+/** Counters describing an MJPEG decode pipeline
+ * @ingroup streaming
+ */
+typedef struct uvc_mjpeg_pipeline_stats {
+  /** Frames decoded and delivered to the callback */
+  uint64_t frames_decoded;
+  /** Frames that failed to decode, and were not delivered */
+  uint64_t frames_failed;
+  /** Waiting frames discarded by UVC_QUEUE_DROP_OLDEST */
+  uint64_t frames_dropped_oldest;
+  /** Pushed frames discarded by UVC_QUEUE_DROP_NEWEST, or by
+   * UVC_QUEUE_DROP_OLDEST when every frame in the pipeline was already being
+   * decoded */
+  uint64_t frames_dropped_newest;
+  /** Number of times a push waited for room under UVC_QUEUE_BLOCK */
+  uint64_t queue_blocks;
+} uvc_mjpeg_pipeline_stats_t;
+
+/** State of a stream's device clock recovery
+ * @ingroup streaming
+ */
+typedef struct uvc_clock_info {
+  /** Number of clock references the current estimate is based on */
+  uint32_t num_samples;
+  /** Device clock frequency reported by the device (dwClockFrequency), in Hz */
+  uint32_t nominal_hz;
+  /** Device clock frequency measured against USB frame timing, in Hz */
+  uint64_t measured_hz;
+  /** Estimated error of frame capture times, in nanoseconds */
+  uint64_t error_ns;
+} uvc_clock_info_t;
+
+/** Scheduling options for a thread created by libuvc
+ * @ingroup init
+ */
+typedef struct uvc_thread_opts {
+  /** CPUs the thread may run on, bit N standing for CPU N; 0 leaves the
+   * affinity alone. Only supported on Linux. */
+  uint64_t cpu_mask;
+  /** SCHED_FIFO priority to run the thread at; 0 keeps the default policy */
+  int rt_priority;
+  /** Thread name, truncated to 15 characters; NULL for libuvc's default */
+  const char *name;
+} uvc_thread_opts_t;
+
+/** USB transfer tuning for uvc_stream_start_opts()
+ * @ingroup streaming
+ *
+ * Fields left at zero take their default value, which is derived from
+ * target_latency_us if that is set.
+ */
+typedef struct uvc_stream_opts {
+  /** Number of USB transfers kept in flight */
+  unsigned int num_transfers;
+  /** Number of packets in each isochronous transfer */
+  unsigned int packets_per_transfer;
+  /** Size of each bulk transfer in bytes, rounded up to the endpoint's
+   * packet size */
+  size_t bulk_transfer_size;
+  /** Size transfers from the negotiated bandwidth so that each one completes
+   * within this many microseconds */
+  uint32_t target_latency_us;
+  /** Allocate transfer buffers with libusb_dev_mem_alloc() so that the
+   * kernel can DMA into them without copying. Falls back to malloc() where
+   * that is unsupported; see uvc_stream_stats_t for which was used. */
+  uint8_t use_dev_mem;
+  /** For bulk streams whose payloads can hold a whole frame, receive
+   * transfers straight into frame buffers instead of copying each frame out
+   * of the transfer buffer. Frames that arrive split across payloads are
+   * still copied. Takes precedence over use_dev_mem. */
+  uint8_t direct_bulk;
+  /** Scheduling options for the thread that runs the frame callback */
+  uvc_thread_opts_t callback_thread;
+} uvc_stream_opts_t;
+
 /** Streaming mode, includes all information needed to select stream
  * @ingroup streaming
  */
@@ -531,6 +813,16 @@ typedef struct uvc_still_ctrl {
 
 uvc_error_t uvc_init(uvc_context_t **ctx, struct libusb_context *usb_ctx);
 void uvc_exit(uvc_context_t *ctx);
+void uvc_set_event_thread_opts(uvc_context_t *ctx, const uvc_thread_opts_t *opts);
+uvc_error_t uvc_set_external_events(uvc_context_t *ctx, uint8_t enable);
+uvc_error_t uvc_get_pollfds(uvc_context_t *ctx, uvc_pollfd_t **pollfds, int *num_pollfds);
+void uvc_free_pollfds(uvc_pollfd_t *pollfds);
+void uvc_set_pollfd_notifiers(uvc_context_t *ctx,
+    uvc_pollfd_added_callback_t *added_cb,
+    uvc_pollfd_removed_callback_t *removed_cb,
+    void *user_ptr);
+int uvc_get_next_timeout(uvc_context_t *ctx, struct timeval *tv);
+uvc_error_t uvc_handle_events(uvc_context_t *ctx);
 
 uvc_error_t uvc_get_device_list(
     uvc_context_t *ctx,
@@ -638,6 +930,11 @@ uvc_error_t uvc_stream_start(uvc_stream_handle_t *strmh,
     uvc_frame_callback_t *cb,
     void *user_ptr,
     uint8_t flags);
+uvc_error_t uvc_stream_start_opts(uvc_stream_handle_t *strmh,
+    uvc_frame_callback_t *cb,
+    void *user_ptr,
+    uint8_t flags,
+    const uvc_stream_opts_t *opts);
 uvc_error_t uvc_stream_start_iso(uvc_stream_handle_t *strmh,
     uvc_frame_callback_t *cb,
     void *user_ptr);
@@ -646,6 +943,23 @@ uvc_error_t uvc_stream_get_frame(
     uvc_frame_t **frame,
     int32_t timeout_us
 );
+uvc_error_t uvc_stream_set_frame_queue(uvc_stream_handle_t *strmh,
+    unsigned int depth,
+    enum uvc_queue_policy policy);
+uvc_error_t uvc_stream_get_stats(uvc_stream_handle_t *strmh, uvc_stream_stats_t *stats);
+uvc_error_t uvc_stream_get_clock_info(uvc_stream_handle_t *strmh, uvc_clock_info_t *info);
+uvc_error_t uvc_stream_set_frame_leases(uvc_stream_handle_t *strmh, unsigned int max_leases);
+uvc_error_t uvc_stream_set_roi(uvc_stream_handle_t *strmh, const uvc_roi_t *roi);
+uvc_error_t uvc_stream_set_convert(uvc_stream_handle_t *strmh, enum uvc_frame_format format);
+uvc_error_t uvc_stream_set_colorimetry(uvc_stream_handle_t *strmh,
+    enum uvc_color_matrix matrix, enum uvc_color_range range);
+uvc_error_t uvc_stream_acquire_frame(
+    uvc_stream_handle_t *strmh,
+    uvc_frame_t **frame,
+    int32_t timeout_us
+);
+void uvc_acquire_frame(uvc_frame_t *frame);
+void uvc_release_frame(uvc_frame_t *frame);
 uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh);
 void uvc_stream_close(uvc_stream_handle_t *strmh);
 
@@ -786,6 +1100,13 @@ void uvc_print_stream_ctrl(uvc_stream_ctrl_t *ctrl, FILE *stream);
 uvc_frame_t *uvc_allocate_frame(size_t data_bytes);
 void uvc_free_frame(uvc_frame_t *frame);
 
+uvc_error_t uvc_frame_pool_create(uvc_frame_pool_t **pool, unsigned int num_frames,
+    enum uvc_frame_format format, uint32_t width, uint32_t height, size_t data_bytes,
+    int flags);
+void uvc_frame_pool_destroy(uvc_frame_pool_t *pool);
+uvc_frame_t *uvc_frame_pool_get(uvc_frame_pool_t *pool);
+void uvc_frame_pool_put(uvc_frame_t *frame);
+
 uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out);
 
 uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out);
@@ -799,9 +1120,48 @@ uvc_error_t uvc_any2bgr(uvc_frame_t *in, uvc_frame_t *out);
 uvc_error_t uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out);
 uvc_error_t uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out);
 
+uvc_error_t uvc_nv12_2rgb(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_nv12_2bgr(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_nv12_2y(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_p010_2rgb(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_p010_2bgr(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_p010_2y16(uvc_frame_t *in, uvc_frame_t *out);
+
+uvc_error_t uvc_demosaic(uvc_convert_pool_t *pool, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format, enum uvc_demosaic_method method);
+uvc_error_t uvc_convert_roi(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format, const uvc_roi_t *roi);
+
+uvc_error_t uvc_convert_pool_create(uvc_convert_pool_t **pool, unsigned int num_threads,
+    const uvc_thread_opts_t *opts);
+void uvc_convert_pool_destroy(uvc_convert_pool_t *pool);
+uvc_error_t uvc_convert_frame(uvc_convert_pool_t *pool, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format);
+uvc_error_t uvc_convert_scaled(uvc_convert_pool_t *pool, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format, uint32_t width, uint32_t height,
+    enum uvc_scale_filter filter);
+
 #ifdef LIBUVC_HAS_JPEG
 uvc_error_t uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out);
 uvc_error_t uvc_mjpeg2gray(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_mjpeg2i420(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_mjpeg2nv12(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_mjpeg2yuyv(uvc_frame_t *in, uvc_frame_t *out);
+uvc_error_t uvc_mjpeg_decoder_create(uvc_mjpeg_decoder_t **decoder);
+void uvc_mjpeg_decoder_destroy(uvc_mjpeg_decoder_t *decoder);
+uvc_error_t uvc_mjpeg_decode(uvc_mjpeg_decoder_t *decoder, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format);
+uvc_error_t uvc_mjpeg_decode_scaled(uvc_mjpeg_decoder_t *decoder, uvc_frame_t *in,
+    uvc_frame_t *out, enum uvc_frame_format format, unsigned int scale_denom,
+    enum uvc_mjpeg_dct_method dct);
+
+uvc_error_t uvc_mjpeg_pipeline_create(uvc_mjpeg_pipeline_t **pipe, unsigned int num_threads,
+    unsigned int max_in_flight, enum uvc_queue_policy policy, enum uvc_frame_format format,
+    uvc_frame_callback_t *cb, void *user_ptr, const uvc_thread_opts_t *opts);
+void uvc_mjpeg_pipeline_destroy(uvc_mjpeg_pipeline_t *pipe);
+uvc_error_t uvc_mjpeg_pipeline_push(uvc_mjpeg_pipeline_t *pipe, uvc_frame_t *frame);
+void uvc_mjpeg_pipeline_callback(uvc_frame_t *frame, void *pipe);
+void uvc_mjpeg_pipeline_get_stats(uvc_mjpeg_pipeline_t *pipe, uvc_mjpeg_pipeline_stats_t *stats);
 #endif
 
 #ifdef __cplusplus
@@ -218,10 +218,10 @@ typedef struct uvc_device_info {
 /*
   set a high number of transfer buffers. This uses a lot of ram, but
   avoids problems with scheduling delays on slow boards causing missed
-  transfers. A better approach may be to make the transfer thread FIFO
-  scheduled (if we have root).
+  transfers. A better approach is to make the transfer thread FIFO
+  scheduled (if we have the privileges), see uvc_set_event_thread_opts().
   Default number of transfer buffers can be overwritten by defining
-  this macro.
+  this macro, or per stream with uvc_stream_start_opts().
  */
 #ifndef LIBUVC_NUM_TRANSFER_BUFS
 #if defined(__APPLE__) && defined(__MACH__)
@@ -231,8 +231,94 @@ typedef struct uvc_device_info {
 #endif
 #endif
 
+/* fewest transfers a stream keeps in flight when sizing them automatically */
+#define LIBUVC_MIN_TRANSFER_BUFS 4
+
 #define LIBUVC_XFER_META_BUF_SIZE ( 4 * 1024 )
 
+/** A counter that threads can sleep on until it changes.
+ *
+ * Used for the lock-free handoff between the assembler and frame consumers.
+ * Built on futexes on Linux; elsewhere a mutex and condition variable stand
+ * in, and are only touched when a thread is actually sleeping.
+ */
+struct uvc_wait_word {
+  uint32_t val;
+  /** Number of threads sleeping on val */
+  uint32_t waiters;
+#ifndef __linux__
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+};
+
+/** Number of SCR samples the device clock is fitted over */
+#define UVC_CLOCK_WINDOW 32
+/** Fewest SCR samples before PTS values are converted */
+#define UVC_CLOCK_MIN_SAMPLES 4
+
+struct uvc_clock_sample {
+  /** Device clock and USB frame number, unwrapped */
+  int64_t stc, sof;
+  /** CLOCK_MONOTONIC arrival time of the payload carrying the sample */
+  int64_t host_ns;
+};
+
+/** Device-to-host clock recovery state (see clock.c).
+ *
+ * Only the assembler updates this; the atomic fields are also read by
+ * uvc_stream_get_clock_info().
+ */
+struct uvc_clock {
+  uint32_t frequency;
+  struct uvc_clock_sample samples[UVC_CLOCK_WINDOW];
+  unsigned int head, count;
+  /* latest raw and unwrapped counters */
+  uint32_t last_stc;
+  uint16_t last_sof;
+  int64_t stc, sof;
+  /* fits, relative to the oldest sample in the window: sof = stc * sof_slope
+   * + sof_icpt, then host_ns = sof * host_slope + host_icpt */
+  uint8_t valid;
+  int64_t stc_ref, sof_ref, host_ref;
+  double sof_slope, sof_icpt, host_slope, host_icpt;
+  /* atomic */
+  uint32_t num_samples;
+  uint64_t measured_hz;
+  uint64_t error_ns;
+};
+
+/** Frame buffer that the payload assembler writes into.
+ *
+ * A stream rotates through a small pool of these: one is being assembled,
+ * completed ones wait in the stream's frame queue, and the rest are free or
+ * leased to the user (see uvc_stream_set_frame_leases()).
+ */
+struct uvc_frame_buffer {
+  /** Frame handed out when this buffer is leased. Must be the first member so
+   * that a leased uvc_frame_t can be mapped back to its buffer. */
+  struct uvc_frame frame;
+  struct uvc_stream_handle *strmh;
+  uint8_t *data;
+  uint8_t *meta;
+  /* the frame converted to the stream's conversion format, if it has one */
+  uint8_t *conv_data;
+  /* written by the assembler before the buffer is queued, then read by the
+   * thread that dequeues it */
+  size_t offset, bytes, meta_bytes, conv_bytes;
+  uint32_t seq, pts, last_scr;
+  struct timeval capture_time;
+  struct timespec capture_time_finished;
+  /** Whether the buffer is queued or held by the thread that dequeued it.
+   * Set by the assembler, cleared (atomically) by the consumer. */
+  uint8_t queued;
+  /** Whether a direct bulk transfer is receiving into the buffer. Only
+   * touched by the assembler. */
+  uint8_t in_transfer;
+  /** Number of outstanding leases (atomic) */
+  int refs;
+};
+
 struct uvc_stream_handle {
   struct uvc_device_handle *devh;
   struct uvc_stream_handle *prev, *next;
@@ -243,29 +329,85 @@ struct uvc_stream_handle {
   /** Current control block */
   struct uvc_stream_ctrl cur_ctrl;
 
-  /* listeners may only access hold*, and only when holding a
-   * lock on cb_mutex (probably signaled with cb_cond) */
+  /* state of the frame being assembled; outbuf points into out_fb */
   uint8_t fid;
-  uint32_t seq, hold_seq;
-  uint32_t pts, hold_pts;
-  uint32_t last_scr, hold_last_scr;
-  size_t got_bytes, hold_bytes;
-  uint8_t *outbuf, *holdbuf;
+  uint32_t seq;
+  uint32_t pts;
+  uint32_t last_scr;
+  size_t got_bytes;
+  uint8_t *outbuf;
+  struct uvc_frame_buffer *frame_bufs;
+  unsigned int num_frame_bufs;
+  size_t frame_buf_bytes;
+  struct uvc_frame_buffer *out_fb;
+  /* completed frames, oldest first. This is a lock-free ring: only the
+   * assembler advances queue_tail, while consumers (and the assembler, when
+   * dropping the oldest frame) claim entries by advancing queue_head with a
+   * compare-and-swap. The indices run freely; queue_mask maps them to slots */
+  struct uvc_frame_buffer **frame_queue;
+  unsigned int queue_depth, queue_mask;
+  uint32_t queue_head, queue_tail;
+  enum uvc_queue_policy queue_policy;
+  /* bumped when a frame is queued or the stream stops */
+  struct uvc_wait_word frame_ready;
+  /* bumped when a frame buffer is handed back or the stream stops */
+  struct uvc_wait_word buf_freed;
+  /** Number of frames the user may hold at once; zero disables leasing */
+  unsigned int max_leases;
+  /* updated with atomic operations */
+  uvc_stream_stats_t stats;
+  struct uvc_clock clock;
+  /* CLOCK_MONOTONIC arrival time of the payload being processed */
+  int64_t payload_host_ns;
+  /* time between isochronous packets, for timing packets within a transfer */
+  unsigned int iso_interval_us;
+  /* protects the transfer arrays; cb_cond signals transfers being freed */
   pthread_mutex_t cb_mutex;
   pthread_cond_t cb_cond;
   pthread_t cb_thread;
-  uint32_t last_polled_seq;
   uvc_frame_callback_t *user_cb;
   void *user_ptr;
-  struct libusb_transfer *transfers[LIBUVC_NUM_TRANSFER_BUFS];
-  uint8_t *transfer_bufs[LIBUVC_NUM_TRANSFER_BUFS];
+  uvc_thread_opts_t cb_thread_opts;
+  char cb_thread_name[16];
+  struct libusb_transfer **transfers;
+  uint8_t **transfer_bufs;
+  /* whether each transfer buffer came from libusb_dev_mem_alloc() */
+  uint8_t *transfer_dev_mem;
+  unsigned int num_transfers;
+  /* bulk payloads span several transfers when bulk transfers are smaller
+   * than dwMaxPayloadTransferSize */
+  size_t bulk_transfer_size;
+  size_t bulk_payload_bytes;
+  uint8_t bulk_header_info;
+  /* bulk transfers receive straight into frame buffers */
+  uint8_t direct_bulk;
+  /* part of each frame to keep; zero width keeps all of it */
+  uvc_roi_t roi;
+  /* bytes per row of the incoming frame, and the range of each row inside
+   * the ROI; roi_in_step is zero when frames aren't being cropped */
+  size_t roi_in_step, roi_start, roi_out_step;
+  /* bytes of the cropped frame assembled so far, while got_bytes counts the
+   * bytes of the incoming frame */
+  size_t roi_got_bytes;
+  /* format frames are converted to as they arrive, or UVC_FRAME_FORMAT_ANY */
+  enum uvc_frame_format conv_format;
+  /* converter for the current run; NULL when not converting */
+  uvc_error_t (*conv_func)(uvc_frame_t *in, uvc_frame_t *out);
+  uint32_t conv_width, conv_height;
+  size_t conv_in_step, conv_out_step, conv_buf_bytes;
+  /* rows of the frame being assembled that have been converted */
+  uint32_t conv_rows;
+  /* colorimetry of the frames; if color_override isn't set, the matrix
+   * comes from the format's color matching descriptor */
+  enum uvc_color_matrix color_matrix;
+  enum uvc_color_range color_range;
+  uint8_t color_override;
   struct uvc_frame frame;
   enum uvc_frame_format frame_format;
-  struct timespec capture_time_finished;
 
   /* raw metadata buffer if available */
-  uint8_t *meta_outbuf, *meta_holdbuf;
-  size_t meta_got_bytes, meta_hold_bytes;
+  uint8_t *meta_outbuf;
+  size_t meta_got_bytes;
 };
 
 /** Handle on an open UVC device
@@ -303,6 +445,13 @@ struct uvc_context {
   uvc_device_handle_t *open_devices;
   pthread_t handler_thread;
   int kill_handler_thread;
+  uvc_thread_opts_t event_thread_opts;
+  char event_thread_name[16];
+  /** True iff the application handles USB events itself */
+  uint8_t external_events;
+  uvc_pollfd_added_callback_t *pollfd_added;
+  uvc_pollfd_removed_callback_t *pollfd_removed;
+  void *pollfd_user_ptr;
 };
 
 uvc_error_t uvc_query_stream_ctrl(
@@ -312,6 +461,75 @@ uvc_error_t uvc_query_stream_ctrl(
     enum uvc_req_code req);
 
 void uvc_start_handler_thread(uvc_context_t *ctx);
+void _uvc_copy_thread_opts(uvc_thread_opts_t *dst, char name_buf[16],
+    const uvc_thread_opts_t *src);
+void _uvc_apply_thread_opts(const uvc_thread_opts_t *opts, const char *default_name);
+/** YUV to RGB conversions with SIMD kernels (see frame-simd.c) */
+enum uvc_yuv_conv {
+  UVC_YUYV2RGB,
+  UVC_YUYV2BGR,
+  UVC_UYVY2RGB,
+  UVC_UYVY2BGR,
+  UVC_NV12_2RGB,
+  UVC_NV12_2BGR,
+  UVC_P010_2RGB,
+  UVC_P010_2BGR,
+  UVC_YUV_NUM_CONV
+};
+
+/** Fixed-point YUV to RGB coefficients for one matrix and range, scaled by
+ * 2^14 (see frame.c) */
+struct uvc_yuv_coefs {
+  /* luma gain and black level */
+  int32_t y_mul, y_off;
+  /* chroma contributions to red, green and blue */
+  int32_t rv, gu, gv, bu;
+};
+
+const struct uvc_yuv_coefs *_uvc_yuv_coefs(const uvc_frame_t *frame);
+size_t _uvc_yuv_rgb_simd(enum uvc_yuv_conv conv, const struct uvc_yuv_coefs *coefs,
+    const uint8_t *in, const uint8_t *uv, uint8_t *out, size_t pixels);
+uvc_error_t _uvc_simd_use_kernels(const char *isa);
+void _uvc_mjpeg_limit_batch(uvc_mjpeg_decoder_t *decoder, unsigned int rows);
+void _uvc_mjpeg_release_thread_decoder(void);
+/** Converts rows [row, row + rows) of a frame; see _uvc_convert_rows() */
+typedef uvc_error_t (uvc_convert_rows_func_t)(void *arg, uint32_t row, uint32_t rows);
+uvc_error_t _uvc_convert_rows(uvc_convert_pool_t *pool, uint32_t height,
+    uvc_convert_rows_func_t *func, void *arg);
+
+size_t _uvc_bayer_bilinear_simd(const uint8_t *above, const uint8_t *row, const uint8_t *below,
+    uint8_t *out, size_t x, size_t width, int red_row, unsigned int color_x,
+    enum uvc_frame_format format);
+size_t _uvc_bayer_green_simd(const uint8_t *above2, const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *below2, uint8_t *green, size_t x, size_t width,
+    unsigned int color_x);
+size_t _uvc_bayer_edge_aware_simd(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *g_above, const uint8_t *g_row,
+    const uint8_t *g_below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format);
+size_t _uvc_packed_pixel_bytes(enum uvc_frame_format format);
+size_t _uvc_yuv420_frame_bytes(enum uvc_frame_format format, size_t step, uint32_t height);
+uvc_error_t uvc_ensure_frame_size(uvc_frame_t *frame, size_t need_bytes);
+uvc_error_t _uvc_ensure_frame_rows(uvc_frame_t *out, uint32_t width, uint32_t height,
+    size_t pixel_bytes);
+uvc_error_t _uvc_yuv420sp2rgb_prepare(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format out_format, const uvc_roi_t *roi);
+void _uvc_yuv420sp2rgb_rows(uvc_frame_t *in, uvc_frame_t *out, const uvc_roi_t *roi,
+    uint32_t first, uint32_t rows);
+uvc_error_t _uvc_ensure_frame_yuv420(uvc_frame_t *out, enum uvc_frame_format format,
+    uint32_t width, uint32_t height);
+#ifdef LIBUVC_LOOPBACK
+uvc_error_t _uvc_loopback_open(uvc_stream_handle_t **strmh, size_t frame_bytes,
+    unsigned int queue_depth, enum uvc_queue_policy policy);
+void _uvc_loopback_push(uvc_stream_handle_t *strmh, const void *data, size_t bytes);
+uvc_error_t _uvc_loopback_pop(uvc_stream_handle_t *strmh, int32_t timeout_us,
+    void *data, size_t bytes);
+void _uvc_loopback_stop(uvc_stream_handle_t *strmh);
+void _uvc_loopback_close(uvc_stream_handle_t *strmh);
+#endif
+void uvc_clock_reset(struct uvc_clock *clock, uint32_t frequency);
+void uvc_clock_add_sample(struct uvc_clock *clock, uint32_t stc, uint16_t sof, int64_t host_ns);
+int uvc_clock_pts_to_host(struct uvc_clock *clock, uint32_t pts, int64_t *host_ns);
 uvc_error_t uvc_claim_if(uvc_device_handle_t *devh, int idx);
 uvc_error_t uvc_release_if(uvc_device_handle_t *devh, int idx);
 
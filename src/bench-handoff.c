@@ -0,0 +1,218 @@
+/* Measures how long a completed frame takes to reach a waiting consumer.
+ *
+ * A producer thread stamps dummy frames with CLOCK_MONOTONIC and completes
+ * them at a fixed interval; a consumer thread polls them and records the
+ * delay. "locked" reproduces the handoff libuvc used before its lock-free
+ * frame queue: a queue under cb_mutex, woken with pthread_cond_broadcast().
+ * "ring" pushes the frames through a device-less stream, so they take
+ * libuvc's own queue and wakeups.
+ *
+ * usage: bench_handoff [frames] [interval_us] [frame_bytes] */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUEUE_DEPTH 4
+
+/* The pre-ring handoff: frames are copied into a free buffer and queued
+ * under a mutex, and consumers sleep on a condition variable */
+struct locked_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint8_t *bufs[QUEUE_DEPTH + 1];
+  unsigned int queued[QUEUE_DEPTH + 1];
+  unsigned int queue[QUEUE_DEPTH];
+  unsigned int head, count;
+  size_t frame_bytes;
+  int running;
+};
+
+struct bench {
+  const char *name;
+  struct locked_queue *lq;
+  uvc_stream_handle_t *strmh;
+  unsigned int frames, interval_us;
+  size_t frame_bytes;
+  uint64_t *latency_ns;
+  unsigned int received;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void locked_push(struct locked_queue *lq, const void *data) {
+  unsigned int i;
+
+  pthread_mutex_lock(&lq->mutex);
+
+  if (lq->count == QUEUE_DEPTH) {
+    /* UVC_QUEUE_DROP_OLDEST */
+    lq->queued[lq->queue[lq->head]] = 0;
+    lq->head = (lq->head + 1) % QUEUE_DEPTH;
+    lq->count--;
+  }
+
+  for (i = 0; lq->queued[i]; i++)
+    ;
+  memcpy(lq->bufs[i], data, lq->frame_bytes);
+  lq->queued[i] = 1;
+  lq->queue[(lq->head + lq->count) % QUEUE_DEPTH] = i;
+  lq->count++;
+
+  pthread_cond_broadcast(&lq->cond);
+  pthread_mutex_unlock(&lq->mutex);
+}
+
+static int locked_pop(struct locked_queue *lq, void *data, size_t bytes) {
+  unsigned int i;
+
+  pthread_mutex_lock(&lq->mutex);
+
+  while (lq->running && !lq->count)
+    pthread_cond_wait(&lq->cond, &lq->mutex);
+
+  if (!lq->count) {
+    pthread_mutex_unlock(&lq->mutex);
+    return -1;
+  }
+
+  i = lq->queue[lq->head];
+  memcpy(data, lq->bufs[i], bytes);
+  lq->queued[i] = 0;
+  lq->head = (lq->head + 1) % QUEUE_DEPTH;
+  lq->count--;
+
+  pthread_mutex_unlock(&lq->mutex);
+  return 0;
+}
+
+static void *consumer(void *arg) {
+  struct bench *b = arg;
+  uint64_t stamp;
+
+  for (;;) {
+    if (b->lq) {
+      if (locked_pop(b->lq, &stamp, sizeof(stamp)) < 0)
+        break;
+    } else if (_uvc_loopback_pop(b->strmh, 0, &stamp, sizeof(stamp)) != UVC_SUCCESS) {
+      break;
+    }
+
+    if (b->received < b->frames)
+      b->latency_ns[b->received++] = now_ns() - stamp;
+  }
+
+  return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void run(struct bench *b) {
+  uint8_t *frame = calloc(1, b->frame_bytes);
+  pthread_t thread;
+  unsigned int i;
+
+  b->received = 0;
+  pthread_create(&thread, NULL, consumer, b);
+  usleep(10000);
+
+  for (i = 0; i < b->frames; i++) {
+    uint64_t stamp = now_ns();
+
+    memcpy(frame, &stamp, sizeof(stamp));
+    if (b->lq)
+      locked_push(b->lq, frame);
+    else
+      _uvc_loopback_push(b->strmh, frame, b->frame_bytes);
+
+    if (b->interval_us)
+      usleep(b->interval_us);
+  }
+
+  /* let the consumer drain the queue */
+  usleep(10000);
+  if (b->lq) {
+    pthread_mutex_lock(&b->lq->mutex);
+    b->lq->running = 0;
+    pthread_cond_broadcast(&b->lq->cond);
+    pthread_mutex_unlock(&b->lq->mutex);
+  } else {
+    _uvc_loopback_stop(b->strmh);
+  }
+  pthread_join(thread, NULL);
+  free(frame);
+
+  qsort(b->latency_ns, b->received, sizeof(*b->latency_ns), compare_u64);
+
+  if (!b->received) {
+    printf("%-6s no frames received\n", b->name);
+    return;
+  }
+
+#define PCT(p) (b->latency_ns[(size_t) ((b->received - 1) * (p))] / 1000.0)
+  printf("%-6s %8u %9.1f %9.1f %9.1f %9.1f %9.1f\n", b->name, b->received,
+         PCT(0.5), PCT(0.9), PCT(0.99), PCT(0.999), PCT(1.0));
+#undef PCT
+}
+
+int main(int argc, char **argv) {
+  struct bench b;
+  struct locked_queue lq;
+  unsigned int i;
+
+  memset(&b, 0, sizeof(b));
+  b.frames = argc > 1 ? atoi(argv[1]) : 20000;
+  b.interval_us = argc > 2 ? atoi(argv[2]) : 100;
+  b.frame_bytes = argc > 3 ? atoi(argv[3]) : 4096;
+  if (!b.frames || b.frame_bytes < sizeof(uint64_t)) {
+    fprintf(stderr, "usage: %s [frames] [interval_us] [frame_bytes]\n", argv[0]);
+    return 1;
+  }
+  b.latency_ns = calloc(b.frames, sizeof(*b.latency_ns));
+
+  printf("%u frames of %zu bytes, %u us apart; latency in us\n",
+         b.frames, b.frame_bytes, b.interval_us);
+  printf("%-6s %8s %9s %9s %9s %9s %9s\n", "", "received", "p50", "p90", "p99", "p99.9", "max");
+
+  memset(&lq, 0, sizeof(lq));
+  pthread_mutex_init(&lq.mutex, NULL);
+  pthread_cond_init(&lq.cond, NULL);
+  lq.frame_bytes = b.frame_bytes;
+  lq.running = 1;
+  for (i = 0; i <= QUEUE_DEPTH; i++)
+    lq.bufs[i] = malloc(b.frame_bytes);
+
+  b.name = "locked";
+  b.lq = &lq;
+  run(&b);
+
+  for (i = 0; i <= QUEUE_DEPTH; i++)
+    free(lq.bufs[i]);
+  pthread_cond_destroy(&lq.cond);
+  pthread_mutex_destroy(&lq.mutex);
+
+  if (_uvc_loopback_open(&b.strmh, b.frame_bytes, QUEUE_DEPTH, UVC_QUEUE_DROP_OLDEST)
+      != UVC_SUCCESS) {
+    fprintf(stderr, "unable to open loopback stream\n");
+    return 1;
+  }
+
+  b.name = "ring";
+  b.lq = NULL;
+  run(&b);
+
+  _uvc_loopback_close(b.strmh);
+  free(b.latency_ns);
+
+  return 0;
+}
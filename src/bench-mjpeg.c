@@ -0,0 +1,166 @@
+/* Measures MJPEG decode throughput when reading scanlines a row at a time
+ * and an iMCU row at a time.
+ *
+ * The input is a recorded MJPEG stream: one JPEG, or JPEG frames written
+ * back to back as a camera sends them. Every frame is decoded to RGB (or
+ * gray) the given number of times in each mode with one reused decoder.
+ *
+ * usage: bench_mjpeg file [iterations] [rgb|gray] */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_FRAMES 1024
+
+static const struct {
+  const char *name;
+  unsigned int rows;
+} modes[] = {
+  { "row", 1 },
+  { "imcu", 0 },
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Walks the marker segments up to the frame header to find the image size */
+static int jpeg_size(const uint8_t *data, size_t bytes, uint32_t *width, uint32_t *height) {
+  size_t pos = 2;
+
+  while (pos + 4 <= bytes && data[pos] == 0xff) {
+    uint8_t marker = data[pos + 1];
+    size_t len = (data[pos + 2] << 8) | data[pos + 3];
+
+    /* SOF0 to SOF15, other than DHT, JPG and DAC */
+    if (marker >= 0xc0 && marker <= 0xcf
+        && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+      if (pos + 9 > bytes)
+        return -1;
+      *height = (data[pos + 5] << 8) | data[pos + 6];
+      *width = (data[pos + 7] << 8) | data[pos + 8];
+      return 0;
+    }
+
+    if (marker == 0xda)
+      break;
+    pos += 2 + len;
+  }
+
+  return -1;
+}
+
+/* Splits the stream at each SOI marker */
+static unsigned int split_frames(uint8_t *data, size_t bytes, uvc_frame_t *frames) {
+  unsigned int count = 0;
+  size_t start, end;
+
+  for (start = 0; start + 3 <= bytes && count < MAX_FRAMES; start = end) {
+    for (end = start + 3; end + 3 <= bytes; end++) {
+      if (data[end] == 0xff && data[end + 1] == 0xd8 && data[end + 2] == 0xff)
+        break;
+    }
+    if (end + 3 > bytes)
+      end = bytes;
+
+    if (data[start] != 0xff || data[start + 1] != 0xd8)
+      continue;
+
+    memset(&frames[count], 0, sizeof(frames[count]));
+    frames[count].data = data + start;
+    frames[count].data_bytes = end - start;
+    frames[count].frame_format = UVC_FRAME_FORMAT_MJPEG;
+    frames[count].library_owns_data = 0;
+    if (jpeg_size(frames[count].data, frames[count].data_bytes,
+                  &frames[count].width, &frames[count].height) < 0)
+      continue;
+    count++;
+  }
+
+  return count;
+}
+
+int main(int argc, char **argv) {
+  static uvc_frame_t frames[MAX_FRAMES];
+  enum uvc_frame_format format = UVC_FRAME_FORMAT_RGB;
+  unsigned int iterations, count, mode, i, n;
+  uvc_mjpeg_decoder_t *decoder;
+  uvc_frame_t *out;
+  uint8_t *data;
+  long bytes;
+  FILE *fp;
+
+  if (argc < 2 || (argc > 3 && strcmp(argv[3], "rgb") && strcmp(argv[3], "gray"))) {
+    fprintf(stderr, "usage: %s file [iterations] [rgb|gray]\n", argv[0]);
+    return 1;
+  }
+  iterations = argc > 2 ? atoi(argv[2]) : 100;
+  if (argc > 3 && !strcmp(argv[3], "gray"))
+    format = UVC_FRAME_FORMAT_GRAY8;
+
+  fp = fopen(argv[1], "rb");
+  if (!fp) {
+    perror(argv[1]);
+    return 1;
+  }
+  fseek(fp, 0, SEEK_END);
+  bytes = ftell(fp);
+  rewind(fp);
+  data = malloc(bytes > 0 ? bytes : 1);
+  if (bytes <= 0 || fread(data, 1, bytes, fp) != (size_t) bytes) {
+    fprintf(stderr, "unable to read %s\n", argv[1]);
+    return 1;
+  }
+  fclose(fp);
+
+  count = split_frames(data, bytes, frames);
+  if (!count) {
+    fprintf(stderr, "no JPEG frames in %s\n", argv[1]);
+    return 1;
+  }
+
+  if (uvc_mjpeg_decoder_create(&decoder) != UVC_SUCCESS)
+    return 1;
+  out = uvc_allocate_frame(0);
+
+  printf("%u frames of %ux%u, %u iterations, to %s\n", count, frames[0].width,
+         frames[0].height, iterations, format == UVC_FRAME_FORMAT_RGB ? "RGB" : "gray");
+  printf("%-5s %10s %10s\n", "", "frames/s", "ms/frame");
+
+  for (mode = 0; mode < sizeof(modes) / sizeof(modes[0]); mode++) {
+    uint64_t start;
+    double secs;
+
+    _uvc_mjpeg_limit_batch(decoder, modes[mode].rows);
+
+    /* warms up the decoder and checks the frames decode at all */
+    for (i = 0; i < count; i++) {
+      uvc_error_t ret = uvc_mjpeg_decode(decoder, &frames[i], out, format);
+
+      if (ret != UVC_SUCCESS) {
+        uvc_perror(ret, "uvc_mjpeg_decode");
+        return 1;
+      }
+    }
+
+    start = now_ns();
+    for (n = 0; n < iterations; n++) {
+      for (i = 0; i < count; i++)
+        uvc_mjpeg_decode(decoder, &frames[i], out, format);
+    }
+    secs = (now_ns() - start) / 1e9;
+
+    printf("%-5s %10.1f %10.3f\n", modes[mode].name,
+           (double) iterations * count / secs, secs * 1000 / ((double) iterations * count));
+  }
+
+  uvc_free_frame(out);
+  uvc_mjpeg_decoder_destroy(decoder);
+  free(data);
+
+  return 0;
+}
@@ -0,0 +1,240 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2010-2012 Ken Tossell
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @defgroup clock Device clock recovery
+ * @brief Mapping of device timestamps to host time
+ *
+ * UVC payload headers carry a presentation time stamp (PTS), the value of the
+ * device clock when the device started capturing the frame, and a source
+ * clock reference (SCR), which pairs the device clock with the 11-bit USB
+ * start-of-frame (SOF) counter. The clock is recovered in two stages, each a
+ * least-squares fit over a sliding window of recent SCR samples:
+ *
+ * -# device clock (STC) to USB frame number, both sampled by the device and
+ *    therefore free of host-side jitter;
+ * -# USB frame number to host CLOCK_MONOTONIC time, using the time each
+ *    payload arrived. Arrival is only ever late, by however long USB and the
+ *    scheduler took to deliver it, so the fit is shifted down onto its
+ *    earliest sample.
+ *
+ * A PTS is then carried through both fits to get the host time at which
+ * capture started.
+ */
+#include <float.h>
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+
+/** @internal
+ * @brief Least-squares fit of y = slope * x + icpt
+ * @return 0 on success, -1 if x doesn't vary
+ */
+static int _uvc_clock_fit(const double *x, const double *y, unsigned int n,
+    double *slope, double *icpt) {
+  double mean_x = 0, mean_y = 0, sxx = 0, sxy = 0;
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    mean_x += x[i];
+    mean_y += y[i];
+  }
+  mean_x /= n;
+  mean_y /= n;
+
+  for (i = 0; i < n; i++) {
+    sxx += (x[i] - mean_x) * (x[i] - mean_x);
+    sxy += (x[i] - mean_x) * (y[i] - mean_y);
+  }
+
+  if (sxx <= 0)
+    return -1;
+
+  *slope = sxy / sxx;
+  *icpt = mean_y - *slope * mean_x;
+  return 0;
+}
+
+/** @internal
+ * @brief Refit both stages over the current window
+ */
+static void _uvc_clock_update(struct uvc_clock *clock) {
+  double stc[UVC_CLOCK_WINDOW], sof[UVC_CLOCK_WINDOW], host[UVC_CLOCK_WINDOW];
+  double sof_slope, sof_icpt, host_slope, host_icpt;
+  double resid, min_resid = DBL_MAX, next_resid = DBL_MAX, abs_resid = 0;
+  unsigned int i, n = clock->count;
+  const struct uvc_clock_sample *ref;
+
+  if (n < UVC_CLOCK_MIN_SAMPLES)
+    return;
+
+  /* Work relative to the oldest sample to keep the doubles precise */
+  ref = &clock->samples[(clock->head + UVC_CLOCK_WINDOW - n) % UVC_CLOCK_WINDOW];
+
+  for (i = 0; i < n; i++) {
+    const struct uvc_clock_sample *s =
+      &clock->samples[(clock->head + UVC_CLOCK_WINDOW - n + i) % UVC_CLOCK_WINDOW];
+
+    stc[i] = (double) (s->stc - ref->stc);
+    sof[i] = (double) (s->sof - ref->sof);
+    host[i] = (double) (s->host_ns - ref->host_ns);
+  }
+
+  if (_uvc_clock_fit(stc, sof, n, &sof_slope, &sof_icpt) < 0
+      || _uvc_clock_fit(sof, host, n, &host_slope, &host_icpt) < 0)
+    return;
+
+  for (i = 0; i < n; i++) {
+    resid = sof[i] - (sof_slope * stc[i] + sof_icpt);
+    abs_resid += resid < 0 ? -resid : resid;
+
+    resid = host[i] - (host_slope * sof[i] + host_icpt);
+    if (resid < min_resid) {
+      next_resid = min_resid;
+      min_resid = resid;
+    } else if (resid < next_resid) {
+      next_resid = resid;
+    }
+  }
+
+  clock->stc_ref = ref->stc;
+  clock->sof_ref = ref->sof;
+  clock->host_ref = ref->host_ns;
+  clock->sof_slope = sof_slope;
+  clock->sof_icpt = sof_icpt;
+  clock->host_slope = host_slope;
+  clock->host_icpt = host_icpt + min_resid;
+
+  /* Error: scatter of the device-side fit, in host time, plus how well the
+   * earliest arrivals pin down the host-side fit */
+  __atomic_store_n(&clock->error_ns,
+                   (uint64_t) (abs_resid / n * host_slope + (next_resid - min_resid)),
+                   __ATOMIC_RELAXED);
+  if (sof_slope > 0)
+    __atomic_store_n(&clock->measured_hz, (uint64_t) (1000.0 / sof_slope), __ATOMIC_RELAXED);
+  __atomic_store_n(&clock->num_samples, n, __ATOMIC_RELAXED);
+  clock->valid = 1;
+}
+
+/** @internal
+ * @brief Reset clock recovery, e.g. when a stream starts
+ *
+ * @param frequency Nominal device clock frequency (dwClockFrequency), in Hz
+ */
+void uvc_clock_reset(struct uvc_clock *clock, uint32_t frequency) {
+  memset(clock, 0, sizeof(*clock));
+  clock->frequency = frequency;
+}
+
+/** @internal
+ * @brief Add an SCR sample to the window
+ *
+ * Payloads within the same USB frame carry the same SCR, so only the first
+ * sample of each frame is kept.
+ *
+ * @param stc Device clock value from the SCR
+ * @param sof 11-bit USB frame number from the SCR
+ * @param host_ns CLOCK_MONOTONIC time at which the payload arrived
+ */
+void uvc_clock_add_sample(struct uvc_clock *clock, uint32_t stc, uint16_t sof, int64_t host_ns) {
+  struct uvc_clock_sample *sample;
+
+  sof &= 0x7ff;
+
+  if (clock->count > 0) {
+    if (sof == clock->last_sof)
+      return;
+
+    /* unwrap both counters, assuming samples arrive less than a wrap apart */
+    clock->stc += (uint32_t) (stc - clock->last_stc);
+    clock->sof += (sof - clock->last_sof) & 0x7ff;
+  } else {
+    clock->stc = stc;
+    clock->sof = sof;
+  }
+
+  clock->last_stc = stc;
+  clock->last_sof = sof;
+
+  sample = &clock->samples[clock->head];
+  sample->stc = clock->stc;
+  sample->sof = clock->sof;
+  sample->host_ns = host_ns;
+
+  clock->head = (clock->head + 1) % UVC_CLOCK_WINDOW;
+  if (clock->count < UVC_CLOCK_WINDOW)
+    clock->count++;
+
+  _uvc_clock_update(clock);
+}
+
+/** @internal
+ * @brief Convert a PTS to host CLOCK_MONOTONIC time
+ * @return 0 on success, -1 if there aren't enough samples yet
+ */
+int uvc_clock_pts_to_host(struct uvc_clock *clock, uint32_t pts, int64_t *host_ns) {
+  double stc, sof;
+
+  if (!clock->valid)
+    return -1;
+
+  /* the PTS lies close to the latest SCR, on either side of it */
+  stc = (double) (clock->stc + (int32_t) (pts - clock->last_stc) - clock->stc_ref);
+  sof = clock->sof_slope * stc + clock->sof_icpt;
+  *host_ns = clock->host_ref + (int64_t) (clock->host_slope * sof + clock->host_icpt);
+
+  return 0;
+}
+
+/** @brief Get the state of a stream's clock recovery
+ * @ingroup clock
+ *
+ * Frames get a capture_time, the host CLOCK_MONOTONIC time at which the
+ * device started capturing them, once the device has sent enough clock
+ * references. This reports how accurate that timestamp is currently estimated
+ * to be.
+ *
+ * @param strmh UVC stream
+ * @param[out] info Clock recovery state
+ * @return UVC_ERROR_NOT_FOUND if the device hasn't sent enough clock
+ * references yet
+ */
+uvc_error_t uvc_stream_get_clock_info(uvc_stream_handle_t *strmh, uvc_clock_info_t *info) {
+  struct uvc_clock *clock = &strmh->clock;
+
+  info->num_samples = __atomic_load_n(&clock->num_samples, __ATOMIC_RELAXED);
+  info->nominal_hz = clock->frequency;
+  info->measured_hz = __atomic_load_n(&clock->measured_hz, __ATOMIC_RELAXED);
+  info->error_ns = __atomic_load_n(&clock->error_ns, __ATOMIC_RELAXED);
+
+  return info->num_samples > 0 ? UVC_SUCCESS : UVC_ERROR_NOT_FOUND;
+}
@@ -93,6 +93,9 @@ uvc_error_t uvc_parse_vs_frame_frame(uvc_streaming_interface_t *stream_if,
 uvc_error_t uvc_parse_vs_input_header(uvc_streaming_interface_t *stream_if,
 				      const unsigned char *block,
 				      size_t block_size);
+uvc_error_t uvc_parse_vs_color_format(uvc_streaming_interface_t *stream_if,
+				      const unsigned char *block,
+				      size_t block_size);
 
 void LIBUSB_CALL _uvc_status_callback(struct libusb_transfer *transfer);
 
@@ -1461,6 +1464,32 @@ uvc_error_t uvc_parse_vs_format_mjpeg(uvc_streaming_interface_t *stream_if,
   return UVC_SUCCESS;
 }
 
+/** @internal
+ * @brief Parse a VideoStreaming color matching block, which describes the
+ * format before it
+ * @ingroup device
+ */
+uvc_error_t uvc_parse_vs_color_format(uvc_streaming_interface_t *stream_if,
+				      const unsigned char *block,
+				      size_t block_size) {
+  uvc_format_desc_t *format;
+
+  UVC_ENTER();
+
+  if (!stream_if->format_descs || block_size < 6) {
+    UVC_EXIT(UVC_SUCCESS);
+    return UVC_SUCCESS;
+  }
+
+  format = stream_if->format_descs->prev;
+  format->bColorPrimaries = block[3];
+  format->bTransferCharacteristics = block[4];
+  format->bMatrixCoefficients = block[5];
+
+  UVC_EXIT(UVC_SUCCESS);
+  return UVC_SUCCESS;
+}
+
 /** @internal
  * @brief Parse a VideoStreaming uncompressed frame block.
  * @ingroup device
@@ -1672,7 +1701,7 @@ uvc_error_t uvc_parse_vs(
     UVC_DEBUG("unsupported descriptor subtype VS_FORMAT_DV");
     break;
   case UVC_VS_COLORFORMAT:
-    UVC_DEBUG("unsupported descriptor subtype VS_COLORFORMAT");
+    ret = uvc_parse_vs_color_format(stream_if, block, block_size);
     break;
   case UVC_VS_FORMAT_FRAME_BASED:
     ret = uvc_parse_vs_frame_format ( stream_if, block, block_size );
@@ -1732,7 +1761,8 @@ void uvc_close(uvc_device_handle_t *devh) {
    * then we need to cancel the handler thread. When we call libusb_close,
    * it'll cause a return from the thread's libusb_handle_events call, after
    * which the handler thread will check the flag we set and then exit. */
-  if (ctx->own_usb_ctx && ctx->open_devices == devh && devh->next == NULL) {
+  if (ctx->own_usb_ctx && !ctx->external_events
+      && ctx->open_devices == devh && devh->next == NULL) {
     ctx->kill_handler_thread = 1;
     libusb_close(devh->usb_devh);
     pthread_join(ctx->handler_thread, NULL);
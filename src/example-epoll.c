@@ -0,0 +1,163 @@
+/* Drives a stream entirely from an epoll loop: libuvc starts no event
+ * handler thread and no callback thread, so frames are assembled and
+ * consumed on the thread that calls epoll_wait(). Linux only. */
+#include "libuvc/libuvc.h"
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint32_t poll_to_epoll(short events) {
+  /* POLLIN/POLLOUT share their values with EPOLLIN/EPOLLOUT */
+  return (uint32_t) events & (EPOLLIN | EPOLLOUT);
+}
+
+void pollfd_added(int fd, short events, void *ptr) {
+  int epfd = *(int *) ptr;
+  struct epoll_event ev = { .events = poll_to_epoll(events), .data.fd = fd };
+
+  epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void pollfd_removed(int fd, void *ptr) {
+  int epfd = *(int *) ptr;
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int main(int argc, char **argv) {
+  uvc_context_t *ctx;
+  uvc_device_t *dev;
+  uvc_device_handle_t *devh;
+  uvc_stream_handle_t *strmh;
+  uvc_stream_ctrl_t ctrl;
+  uvc_pollfd_t *pollfds;
+  int num_pollfds, i;
+  int epfd;
+  time_t end;
+  uvc_error_t res;
+
+  epfd = epoll_create1(0);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return 1;
+  }
+
+  res = uvc_init(&ctx, NULL);
+
+  if (res < 0) {
+    uvc_perror(res, "uvc_init");
+    return res;
+  }
+
+  /* Don't spawn the event handler thread; we'll handle events below */
+  uvc_set_external_events(ctx, 1);
+
+  /* Watch the descriptors libusb has now, and follow any changes */
+  res = uvc_get_pollfds(ctx, &pollfds, &num_pollfds);
+  if (res < 0) {
+    uvc_perror(res, "uvc_get_pollfds");
+    uvc_exit(ctx);
+    return res;
+  }
+
+  for (i = 0; i < num_pollfds; i++)
+    pollfd_added(pollfds[i].fd, pollfds[i].events, &epfd);
+  uvc_free_pollfds(pollfds);
+
+  uvc_set_pollfd_notifiers(ctx, pollfd_added, pollfd_removed, &epfd);
+
+  res = uvc_find_device(ctx, &dev, 0, 0, NULL);
+
+  if (res < 0) {
+    uvc_perror(res, "uvc_find_device");
+  } else {
+    res = uvc_open(dev, &devh);
+
+    if (res < 0) {
+      uvc_perror(res, "uvc_open");
+    } else {
+      const uvc_format_desc_t *format_desc = uvc_get_format_descs(devh);
+      const uvc_frame_desc_t *frame_desc = format_desc->frame_descs;
+      enum uvc_frame_format frame_format;
+
+      switch (format_desc->bDescriptorSubtype) {
+      case UVC_VS_FORMAT_MJPEG:
+        frame_format = UVC_COLOR_FORMAT_MJPEG;
+        break;
+      case UVC_VS_FORMAT_FRAME_BASED:
+        frame_format = UVC_FRAME_FORMAT_H264;
+        break;
+      default:
+        frame_format = UVC_FRAME_FORMAT_YUYV;
+        break;
+      }
+
+      res = uvc_get_stream_ctrl_format_size(
+          devh, &ctrl, frame_format,
+          frame_desc->wWidth, frame_desc->wHeight,
+          10000000 / frame_desc->dwDefaultFrameInterval);
+
+      if (res < 0) {
+        uvc_perror(res, "get_mode");
+      } else if ((res = uvc_stream_open_ctrl(devh, &strmh, &ctrl)) < 0) {
+        uvc_perror(res, "uvc_stream_open_ctrl");
+      } else {
+        /* No callback: frames are polled from the loop */
+        res = uvc_stream_start(strmh, NULL, NULL, 0);
+
+        if (res < 0) {
+          uvc_perror(res, "uvc_stream_start");
+        } else {
+          puts("Streaming...");
+          end = time(NULL) + 10; /* stream for 10 seconds */
+
+          while (time(NULL) < end) {
+            struct epoll_event events[8];
+            struct timeval tv;
+            int timeout_ms = 100;
+            uvc_frame_t *frame;
+
+            /* Wake up in time for libusb's next timeout */
+            if (uvc_get_next_timeout(ctx, &tv) == 1) {
+              int usb_timeout_ms = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+              if (usb_timeout_ms < timeout_ms)
+                timeout_ms = usb_timeout_ms;
+            }
+
+            if (epoll_wait(epfd, events, 8, timeout_ms) < 0) {
+              perror("epoll_wait");
+              break;
+            }
+
+            /* Complete whatever transfers are done ... */
+            uvc_handle_events(ctx);
+
+            /* ... and take the frames they finished, without waiting */
+            while (uvc_stream_get_frame(strmh, &frame, -1) == UVC_SUCCESS && frame) {
+              if (frame->sequence % 30 == 0)
+                printf(" * got image %u (%zu bytes)\n", frame->sequence, frame->data_bytes);
+            }
+          }
+
+          /* Processes the cancelled transfers itself, as there is no
+           * handler thread */
+          uvc_stream_stop(strmh);
+          puts("Done streaming.");
+        }
+
+        uvc_stream_close(strmh);
+      }
+
+      uvc_close(devh);
+    }
+
+    uvc_unref_device(dev);
+  }
+
+  uvc_exit(ctx);
+  close(epfd);
+
+  return 0;
+}
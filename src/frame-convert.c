@@ -0,0 +1,433 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2010-2012 Ken Tossell
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @defgroup convert Parallel frame conversion
+ * @brief Converting frames on several threads at once
+ *
+ * A conversion pool keeps a set of worker threads. uvc_convert_frame() cuts
+ * the frame into bands of rows and the workers, along with the calling
+ * thread, take bands until none are left. Formats whose rows can't be
+ * converted independently, such as MJPEG, are converted on the calling
+ * thread alone.
+ */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+
+/** Number of bands to cut a frame into per thread, so that threads that
+ * finish early can pick up the slack */
+#define LIBUVC_CONVERT_BANDS_PER_THREAD 4
+
+/* A conversion handed to the pool */
+struct uvc_convert_job {
+  uvc_convert_rows_func_t *func;
+  void *arg;
+  uint32_t height, band_rows;
+  unsigned int num_bands;
+  /* updated with atomic operations */
+  unsigned int next_band;
+  uvc_error_t ret;
+};
+
+struct uvc_convert_pool {
+  /* serializes conversions */
+  pthread_mutex_t job_mutex;
+  /* protects the fields below */
+  pthread_mutex_t mutex;
+  /* signals a new job, or shutdown */
+  pthread_cond_t work_cond;
+  /* signals that every worker is done with the job */
+  pthread_cond_t done_cond;
+  struct uvc_convert_job *job;
+  uint32_t job_seq;
+  unsigned int busy;
+  uint8_t shutdown;
+  pthread_t *threads;
+  unsigned int num_threads;
+  uvc_thread_opts_t thread_opts;
+  char thread_name[16];
+};
+
+/* Conversions that work row by row, so can be done in bands */
+static const struct {
+  enum uvc_frame_format in_format, out_format;
+  uvc_error_t (*convert)(uvc_frame_t *in, uvc_frame_t *out);
+  size_t out_pixel_bytes;
+  /* semi-planar 4:2:0: converted with _uvc_yuv420sp2rgb_rows() instead */
+  uint8_t yuv420sp;
+} band_converters[] = {
+  { UVC_FRAME_FORMAT_YUYV, UVC_FRAME_FORMAT_RGB, uvc_yuyv2rgb, 3, 0 },
+  { UVC_FRAME_FORMAT_YUYV, UVC_FRAME_FORMAT_BGR, uvc_yuyv2bgr, 3, 0 },
+  { UVC_FRAME_FORMAT_YUYV, UVC_FRAME_FORMAT_GRAY8, uvc_yuyv2y, 1, 0 },
+  { UVC_FRAME_FORMAT_UYVY, UVC_FRAME_FORMAT_RGB, uvc_uyvy2rgb, 3, 0 },
+  { UVC_FRAME_FORMAT_UYVY, UVC_FRAME_FORMAT_BGR, uvc_uyvy2bgr, 3, 0 },
+  { UVC_FRAME_FORMAT_NV12, UVC_FRAME_FORMAT_RGB, uvc_nv12_2rgb, 3, 1 },
+  { UVC_FRAME_FORMAT_NV12, UVC_FRAME_FORMAT_BGR, uvc_nv12_2bgr, 3, 1 },
+  { UVC_FRAME_FORMAT_P010, UVC_FRAME_FORMAT_RGB, uvc_p010_2rgb, 3, 1 },
+  { UVC_FRAME_FORMAT_P010, UVC_FRAME_FORMAT_BGR, uvc_p010_2bgr, 3, 1 },
+};
+
+/* A conversion done by running a single-frame converter on bands */
+struct uvc_band_conversion {
+  uvc_error_t (*convert)(uvc_frame_t *in, uvc_frame_t *out);
+  uvc_frame_t *in, *out;
+  /* bytes of pixels in a row, without padding */
+  size_t in_row_bytes, out_row_bytes;
+  size_t out_step;
+};
+
+/** @internal
+ * @brief Convert a band by treating it as a frame of its own
+ */
+static uvc_error_t _uvc_convert_band(void *arg, uint32_t row, uint32_t rows) {
+  struct uvc_band_conversion *conv = arg;
+  uvc_frame_t in = *conv->in;
+  uvc_frame_t out;
+
+  in.height = rows;
+  in.data = (uint8_t *) conv->in->data + row * conv->in->step;
+  in.data_bytes = (rows - 1) * conv->in->step + conv->in_row_bytes;
+
+  memset(&out, 0, sizeof(out));
+  out.data = (uint8_t *) conv->out->data + row * conv->out_step;
+  out.data_bytes = (rows - 1) * conv->out_step + conv->out_row_bytes;
+  out.step = conv->out_step;
+
+  return conv->convert(&in, &out);
+}
+
+/** @internal
+ * @brief Convert a band of row pairs of a semi-planar 4:2:0 frame
+ *
+ * Each pair of luma rows shares a row of chroma, so bands of whole pairs
+ * never split one between threads.
+ */
+static uvc_error_t _uvc_convert_yuv420sp_band(void *arg, uint32_t pair, uint32_t pairs) {
+  struct uvc_band_conversion *conv = arg;
+  uint32_t row = pair * 2;
+  uint32_t rows = pairs * 2;
+
+  /* the last pair of an odd height frame has a single row */
+  if (rows > conv->in->height - row)
+    rows = conv->in->height - row;
+
+  _uvc_yuv420sp2rgb_rows(conv->in, conv->out, NULL, row, rows);
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Convert bands of the pool's current job until none are left
+ */
+static void _uvc_convert_bands(struct uvc_convert_job *job) {
+  unsigned int band;
+
+  while ((band = __atomic_fetch_add(&job->next_band, 1, __ATOMIC_RELAXED)) < job->num_bands) {
+    uint32_t row = band * job->band_rows;
+    uint32_t rows = job->height - row < job->band_rows ? job->height - row : job->band_rows;
+    uvc_error_t ret;
+
+    ret = job->func(job->arg, row, rows);
+    if (ret != UVC_SUCCESS) {
+      uvc_error_t expected = UVC_SUCCESS;
+      __atomic_compare_exchange_n(&job->ret, &expected, ret, 0,
+                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/** @internal
+ * @brief Worker thread
+ */
+static void *_uvc_convert_worker(void *arg) {
+  uvc_convert_pool_t *pool = arg;
+  uint32_t seen_seq = 0;
+
+  _uvc_apply_thread_opts(&pool->thread_opts, "uvc_convert");
+
+  pthread_mutex_lock(&pool->mutex);
+
+  for (;;) {
+    struct uvc_convert_job *job;
+
+    while (!pool->shutdown && pool->job_seq == seen_seq)
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+
+    if (pool->shutdown)
+      break;
+
+    seen_seq = pool->job_seq;
+    job = pool->job;
+    pthread_mutex_unlock(&pool->mutex);
+
+    _uvc_convert_bands(job);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->busy == 0)
+      pthread_cond_signal(&pool->done_cond);
+  }
+
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+/** @brief Create a pool of threads for converting frames
+ * @ingroup convert
+ *
+ * @param[out] ppool New pool
+ * @param num_threads Number of worker threads. The thread that calls
+ * uvc_convert_frame() converts bands as well, so this is usually one less
+ * than the number of cores to use.
+ * @param opts Scheduling options for the workers, or NULL for the defaults.
+ * The name, if any, is copied.
+ */
+uvc_error_t uvc_convert_pool_create(uvc_convert_pool_t **ppool, unsigned int num_threads,
+    const uvc_thread_opts_t *opts) {
+  uvc_convert_pool_t *pool;
+
+  pool = calloc(1, sizeof(*pool));
+  if (!pool)
+    return UVC_ERROR_NO_MEM;
+
+  if (num_threads > 0) {
+    pool->threads = calloc(num_threads, sizeof(*pool->threads));
+    if (!pool->threads) {
+      free(pool);
+      return UVC_ERROR_NO_MEM;
+    }
+  }
+
+  pthread_mutex_init(&pool->job_mutex, NULL);
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  _uvc_copy_thread_opts(&pool->thread_opts, pool->thread_name, opts);
+
+  for (; pool->num_threads < num_threads; pool->num_threads++) {
+    if (pthread_create(&pool->threads[pool->num_threads], NULL,
+                       _uvc_convert_worker, pool) != 0) {
+      UVC_DEBUG("unable to start conversion thread %u", pool->num_threads);
+      uvc_convert_pool_destroy(pool);
+      return UVC_ERROR_OTHER;
+    }
+  }
+
+  *ppool = pool;
+  return UVC_SUCCESS;
+}
+
+/** @brief Stop a conversion pool's threads and free it
+ * @ingroup convert
+ */
+void uvc_convert_pool_destroy(uvc_convert_pool_t *pool) {
+  unsigned int i;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (i = 0; i < pool->num_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_mutex_destroy(&pool->job_mutex);
+  free(pool->threads);
+  free(pool);
+}
+
+/** @brief Convert a frame using a pool of threads
+ * @ingroup convert
+ *
+ * YUYV and UYVY frames, and NV12 and P010 frames going to RGB or BGR, are
+ * converted in bands of rows spread across the pool; raw Bayer frames are
+ * demosaiced with uvc_demosaic(). Other conversions, such as from MJPEG or
+ * to the luma of NV12 and P010, run on the calling thread. Calls on the
+ * same pool are serialized.
+ *
+ * @param pool Conversion pool
+ * @param in Frame to convert
+ * @param out Converted frame
+ * @param format Format to convert to: UVC_FRAME_FORMAT_RGB,
+ * UVC_FRAME_FORMAT_BGR, UVC_FRAME_FORMAT_GRAY8, (from P010)
+ * UVC_FRAME_FORMAT_GRAY16 or (from MJPEG) UVC_FRAME_FORMAT_I420,
+ * UVC_FRAME_FORMAT_NV12 or UVC_FRAME_FORMAT_YUYV
+ */
+uvc_error_t uvc_convert_frame(uvc_convert_pool_t *pool, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format) {
+  struct uvc_band_conversion conv;
+  uvc_error_t ret;
+  unsigned int i;
+
+  switch (in->frame_format) {
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+  case UVC_FRAME_FORMAT_SGRBG8:
+  case UVC_FRAME_FORMAT_SGBRG8:
+  case UVC_FRAME_FORMAT_SRGGB8:
+  case UVC_FRAME_FORMAT_SBGGR8:
+    return uvc_demosaic(pool, in, out, format, UVC_DEMOSAIC_BILINEAR);
+#ifdef LIBUVC_HAS_JPEG
+  case UVC_FRAME_FORMAT_MJPEG:
+    if (format == UVC_FRAME_FORMAT_I420 || format == UVC_FRAME_FORMAT_NV12
+        || format == UVC_FRAME_FORMAT_YUYV)
+      return uvc_mjpeg_decode(NULL, in, out, format);
+    break;
+#endif
+  default:
+    break;
+  }
+
+  for (i = 0; i < sizeof(band_converters) / sizeof(band_converters[0]); i++) {
+    if (band_converters[i].in_format == in->frame_format
+        && band_converters[i].out_format == format)
+      break;
+  }
+
+  if (i == sizeof(band_converters) / sizeof(band_converters[0])
+      || (!in->step && !band_converters[i].yuv420sp)) {
+    switch (format) {
+    case UVC_FRAME_FORMAT_RGB:
+      return uvc_any2rgb(in, out);
+    case UVC_FRAME_FORMAT_BGR:
+      return uvc_any2bgr(in, out);
+    case UVC_FRAME_FORMAT_GRAY8:
+      if (in->frame_format == UVC_FRAME_FORMAT_NV12)
+        return uvc_nv12_2y(in, out);
+#ifdef LIBUVC_HAS_JPEG
+      if (in->frame_format == UVC_FRAME_FORMAT_MJPEG)
+        return uvc_mjpeg2gray(in, out);
+#endif
+      return UVC_ERROR_NOT_SUPPORTED;
+    case UVC_FRAME_FORMAT_GRAY16:
+      if (in->frame_format == UVC_FRAME_FORMAT_P010)
+        return uvc_p010_2y16(in, out);
+      return UVC_ERROR_NOT_SUPPORTED;
+    default:
+      return UVC_ERROR_NOT_SUPPORTED;
+    }
+  }
+
+  conv.convert = band_converters[i].convert;
+  conv.in = in;
+  conv.out = out;
+
+  if (band_converters[i].yuv420sp) {
+    ret = _uvc_yuv420sp2rgb_prepare(in, out, format, NULL);
+    if (ret != UVC_SUCCESS)
+      return ret;
+
+    return _uvc_convert_rows(pool, (in->height + 1) / 2, _uvc_convert_yuv420sp_band, &conv);
+  }
+
+  conv.in_row_bytes = in->width * _uvc_packed_pixel_bytes(in->frame_format);
+  conv.out_row_bytes = in->width * band_converters[i].out_pixel_bytes;
+
+  if (!in->height || in->data_bytes < (in->height - 1) * in->step + conv.in_row_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (_uvc_ensure_frame_rows(out, in->width, in->height, band_converters[i].out_pixel_bytes) < 0)
+    return UVC_ERROR_NO_MEM;
+
+  conv.out_step = out->step;
+  out->frame_format = format;
+  out->sequence = in->sequence;
+  out->capture_time = in->capture_time;
+  out->capture_time_finished = in->capture_time_finished;
+  out->source = in->source;
+
+  return _uvc_convert_rows(pool, in->height, _uvc_convert_band, &conv);
+}
+
+/** @internal
+ * @brief Run a row-by-row conversion on a pool
+ *
+ * Calls func on bands of rows, in parallel, until all rows are covered.
+ *
+ * @param pool Conversion pool, or NULL to convert on the calling thread
+ * @param height Number of rows
+ * @param func Function that converts a band of rows
+ * @param arg Argument to func
+ * @return The first error that func returned, if any
+ */
+uvc_error_t _uvc_convert_rows(uvc_convert_pool_t *pool, uint32_t height,
+    uvc_convert_rows_func_t *func, void *arg) {
+  struct uvc_convert_job job;
+  unsigned int num_bands;
+
+  if (height == 0)
+    return UVC_SUCCESS;
+
+  if (!pool)
+    return func(arg, 0, height);
+
+  memset(&job, 0, sizeof(job));
+  job.func = func;
+  job.arg = arg;
+  job.height = height;
+
+  num_bands = (pool->num_threads + 1) * LIBUVC_CONVERT_BANDS_PER_THREAD;
+  if (num_bands > height)
+    num_bands = height;
+
+  job.band_rows = (height + num_bands - 1) / num_bands;
+  job.num_bands = (height + job.band_rows - 1) / job.band_rows;
+
+  pthread_mutex_lock(&pool->job_mutex);
+
+  if (pool->num_threads > 0) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = &job;
+    pool->job_seq++;
+    pool->busy = pool->num_threads;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  _uvc_convert_bands(&job);
+
+  if (pool->num_threads > 0) {
+    /* every worker has to let go of the job before it goes out of scope */
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->busy > 0)
+      pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+  }
+
+  pthread_mutex_unlock(&pool->job_mutex);
+
+  return job.ret;
+}
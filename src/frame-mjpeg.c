@@ -40,8 +40,6 @@
 #include <jpeglib.h>
 #include <setjmp.h>
 
-extern uvc_error_t uvc_ensure_frame_size(uvc_frame_t *frame, size_t need_bytes);
-
 struct error_mgr {
   struct jpeg_error_mgr super;
   jmp_buf jmp;
@@ -122,78 +120,502 @@ static void insert_huff_tables(j_decompress_ptr dinfo) {
   COPY_HUFF_TABLE(dinfo, ac_huff_tbl_ptrs[1], ac_chromi);
 }
 
-static uvc_error_t uvc_mjpeg_convert(uvc_frame_t *in, uvc_frame_t *out) {
+/** Most scanlines handed to libjpeg per call: an iMCU row is at most 4
+ * (sampling factor) times 16 (scaled DCT size) lines */
+#define LIBUVC_MJPEG_MAX_ROWS 64
+
+#if JPEG_LIB_VERSION >= 70
+#define UVC_JPEG_DCT_V_SIZE(dinfo) ((dinfo)->min_DCT_v_scaled_size)
+#else
+#define UVC_JPEG_DCT_V_SIZE(dinfo) ((dinfo)->min_DCT_scaled_size)
+#endif
+
+struct uvc_mjpeg_decoder {
   struct jpeg_decompress_struct dinfo;
   struct error_mgr jerr;
-  size_t lines_read;
-  dinfo.err = jpeg_std_error(&jerr.super);
-  jerr.super.error_exit = _error_exit;
+  /* one iMCU row of raw Y, Cb and Cr samples, for YUV output */
+  JSAMPLE *raw;
+  size_t raw_bytes;
+  /* most scanlines per jpeg_read_scanlines() call for RGB and gray output,
+   * normally a whole iMCU row; see _uvc_mjpeg_limit_batch() */
+  unsigned int max_batch_rows;
+};
 
-  if (setjmp(jerr.jmp)) {
-    goto fail;
+/* Decoder for uvc_mjpeg2rgb() and friends, one per thread */
+static pthread_key_t thread_decoder_key;
+static pthread_once_t thread_decoder_once = PTHREAD_ONCE_INIT;
+
+/** @brief Create an MJPEG decoder
+ * @ingroup frame
+ *
+ * Setting up libjpeg for a frame costs about as much as decoding a small
+ * one. A decoder keeps libjpeg's state, its memory pools and the default
+ * Huffman tables from one frame to the next, so that only the decoding
+ * itself is done per frame. A decoder must not be used by two threads at
+ * once; uvc_mjpeg2rgb() and uvc_mjpeg2gray() keep one per thread.
+ *
+ * @param[out] pdecoder New decoder
+ */
+uvc_error_t uvc_mjpeg_decoder_create(uvc_mjpeg_decoder_t **pdecoder) {
+  uvc_mjpeg_decoder_t *decoder;
+
+  decoder = calloc(1, sizeof(*decoder));
+  if (!decoder)
+    return UVC_ERROR_NO_MEM;
+
+  decoder->dinfo.err = jpeg_std_error(&decoder->jerr.super);
+  decoder->jerr.super.error_exit = _error_exit;
+
+  if (setjmp(decoder->jerr.jmp)) {
+    jpeg_destroy_decompress(&decoder->dinfo);
+    free(decoder);
+    return UVC_ERROR_NO_MEM;
+  }
+
+  jpeg_create_decompress(&decoder->dinfo);
+  /* allocate the tables once; they live as long as the decoder */
+  insert_huff_tables(&decoder->dinfo);
+  decoder->max_batch_rows = LIBUVC_MJPEG_MAX_ROWS;
+
+  *pdecoder = decoder;
+  return UVC_SUCCESS;
+}
+
+/** @brief Free an MJPEG decoder
+ * @ingroup frame
+ *
+ * @param decoder Decoder to free
+ */
+void uvc_mjpeg_decoder_destroy(uvc_mjpeg_decoder_t *decoder) {
+  jpeg_destroy_decompress(&decoder->dinfo);
+  free(decoder->raw);
+  free(decoder);
+}
+
+static void _uvc_mjpeg_free_thread_decoder(void *decoder) {
+  uvc_mjpeg_decoder_destroy(decoder);
+}
+
+static void _uvc_mjpeg_create_thread_key(void) {
+  pthread_key_create(&thread_decoder_key, _uvc_mjpeg_free_thread_decoder);
+}
+
+/** @internal
+ * @brief Get the calling thread's decoder, creating it on first use
+ *
+ * The decoder is freed when the thread exits, or by uvc_exit() on the
+ * thread that calls it.
+ */
+static uvc_mjpeg_decoder_t *_uvc_mjpeg_thread_decoder(void) {
+  uvc_mjpeg_decoder_t *decoder;
+
+  pthread_once(&thread_decoder_once, _uvc_mjpeg_create_thread_key);
+
+  decoder = pthread_getspecific(thread_decoder_key);
+  if (!decoder) {
+    if (uvc_mjpeg_decoder_create(&decoder) != UVC_SUCCESS)
+      return NULL;
+    pthread_setspecific(thread_decoder_key, decoder);
+  }
+
+  return decoder;
+}
+
+/** @internal
+ * @brief Free the calling thread's decoder
+ *
+ * The key's destructor never runs for the main thread, so uvc_exit() frees
+ * the caller's decoder here. The key itself lives as long as the process:
+ * decoders on threads that outlive the context are still freed when those
+ * threads exit, which deleting the key would prevent.
+ */
+void _uvc_mjpeg_release_thread_decoder(void) {
+  uvc_mjpeg_decoder_t *decoder;
+
+  pthread_once(&thread_decoder_once, _uvc_mjpeg_create_thread_key);
+
+  decoder = pthread_getspecific(thread_decoder_key);
+  if (decoder) {
+    pthread_setspecific(thread_decoder_key, NULL);
+    uvc_mjpeg_decoder_destroy(decoder);
+  }
+}
+
+/** @internal
+ * @brief libjpeg's IDCT for a uvc_mjpeg_dct_method
+ */
+static J_DCT_METHOD _uvc_jpeg_dct_method(enum uvc_mjpeg_dct_method dct) {
+  switch (dct) {
+  case UVC_MJPEG_DCT_INTEGER:
+    return JDCT_ISLOW;
+  case UVC_MJPEG_DCT_FLOAT:
+    return JDCT_FLOAT;
+  default:
+    return JDCT_IFAST;
   }
+}
+
+/** @internal
+ * @brief Limit how many scanlines an RGB or gray decode reads per call
+ *
+ * For comparing reading an iMCU row at a time with reading one row at a
+ * time. Only affects the given decoder, which must not be decoding.
+ *
+ * @param rows Most rows per jpeg_read_scanlines() call, or 0 for a whole
+ *        iMCU row
+ */
+void _uvc_mjpeg_limit_batch(uvc_mjpeg_decoder_t *decoder, unsigned int rows) {
+  if (!rows || rows > LIBUVC_MJPEG_MAX_ROWS)
+    rows = LIBUVC_MJPEG_MAX_ROWS;
+  decoder->max_batch_rows = rows;
+}
 
-  jpeg_create_decompress(&dinfo);
-  jpeg_mem_src(&dinfo, in->data, in->data_bytes);
-  jpeg_read_header(&dinfo, TRUE);
+static uvc_error_t uvc_mjpeg_convert(uvc_mjpeg_decoder_t *decoder, uvc_frame_t *in,
+    uvc_frame_t *out, unsigned int scale_denom, enum uvc_mjpeg_dct_method dct) {
+  struct jpeg_decompress_struct *dinfo = &decoder->dinfo;
+  JSAMPROW rows[LIBUVC_MJPEG_MAX_ROWS];
+  unsigned int batch;
 
-  if (dinfo.dc_huff_tbl_ptrs[0] == NULL) {
-    /* This frame is missing the Huffman tables: fill in the standard ones */
-    insert_huff_tables(&dinfo);
+  if (setjmp(decoder->jerr.jmp)) {
+    goto fail;
   }
 
+  /* Most UVC MJPEG frames are missing the Huffman tables: start from the
+   * standard ones, which a DHT segment in the frame overrides. libjpeg keeps
+   * tables across frames, so this also undoes the previous frame's. */
+  insert_huff_tables(dinfo);
+
+  jpeg_mem_src(dinfo, in->data, in->data_bytes);
+  jpeg_read_header(dinfo, TRUE);
+
   if (out->frame_format == UVC_FRAME_FORMAT_RGB)
-    dinfo.out_color_space = JCS_RGB;
+    dinfo->out_color_space = JCS_RGB;
   else if (out->frame_format == UVC_FRAME_FORMAT_GRAY8)
-    dinfo.out_color_space = JCS_GRAYSCALE;
+    dinfo->out_color_space = JCS_GRAYSCALE;
   else
     goto fail;
 
-  dinfo.dct_method = JDCT_IFAST;
+  /* libjpeg scales by shrinking the IDCT, which skips most of its work */
+  dinfo->scale_num = 1;
+  dinfo->scale_denom = scale_denom;
+  dinfo->dct_method = _uvc_jpeg_dct_method(dct);
+
+  jpeg_start_decompress(dinfo);
+
+  if (dinfo->output_width > out->width || dinfo->output_height > out->height)
+    goto fail;
+
+  /* Ask for a whole iMCU row at a time, which libjpeg can produce in one
+   * pass instead of handing it out line by line */
+  batch = dinfo->max_v_samp_factor * UVC_JPEG_DCT_V_SIZE(dinfo);
+  if (batch < (unsigned int) dinfo->rec_outbuf_height)
+    batch = dinfo->rec_outbuf_height;
+  if (batch > decoder->max_batch_rows)
+    batch = decoder->max_batch_rows;
 
-  jpeg_start_decompress(&dinfo);
+  while (dinfo->output_scanline < dinfo->output_height) {
+    unsigned int i, count = dinfo->output_height - dinfo->output_scanline;
 
-  lines_read = 0;
-  while (dinfo.output_scanline < dinfo.output_height) {
-    unsigned char *buffer[1] = {( unsigned char*) out->data + lines_read * out->step };
-    int num_scanlines;
+    if (count > batch)
+      count = batch;
 
-    num_scanlines = jpeg_read_scanlines(&dinfo, buffer, 1);
-    lines_read += num_scanlines;
+    for (i = 0; i < count; i++)
+      rows[i] = (uint8_t *) out->data + (size_t) (dinfo->output_scanline + i) * out->step;
+
+    jpeg_read_scanlines(dinfo, rows, count);
   }
 
-  jpeg_finish_decompress(&dinfo);
-  jpeg_destroy_decompress(&dinfo);
+  jpeg_finish_decompress(dinfo);
   return 0;
 
 fail:
-  jpeg_destroy_decompress(&dinfo);
+  /* leaves the decoder ready for the next frame */
+  jpeg_abort_decompress(dinfo);
   return UVC_ERROR_OTHER;
 }
 
-/** @brief Convert an MJPEG frame to RGB
+/** @internal
+ * @brief Write rows of an iMCU row of raw samples to a YUV frame
+ *
+ * Luma is copied. Chroma is averaged over the samples that cover each output
+ * chroma site, which copies it when the subsampling already matches and
+ * averages pairs of rows when 4:2:2 becomes 4:2:0.
+ *
+ * @param planes Rows of Y, Cb and Cr for the iMCU row
+ * @param width Width of the decoded image
+ * @param y0 First output row
+ * @param rows Number of output rows
+ * @param h_samp Horizontal sampling factor of Y relative to Cb and Cr
+ * @param v_samp Vertical sampling factor of Y relative to Cb and Cr
+ */
+static void _uvc_mjpeg_put_yuv_rows(uvc_frame_t *out, JSAMPARRAY planes[3],
+    uint32_t width, uint32_t y0, uint32_t rows, int h_samp, int v_samp) {
+  uint8_t *data = out->data;
+  uint32_t cw = (width + 1) / 2;
+  uint32_t y, i;
+
+#define UVC_MJPEG_CHROMA(c, x0, x1, ya, yb) \
+  ((planes[c][(ya) / v_samp][(x0) / h_samp] + planes[c][(ya) / v_samp][(x1) / h_samp] \
+    + planes[c][(yb) / v_samp][(x0) / h_samp] + planes[c][(yb) / v_samp][(x1) / h_samp] + 2) >> 2)
+
+  if (out->frame_format == UVC_FRAME_FORMAT_YUYV) {
+    for (y = 0; y < rows; y++) {
+      const JSAMPLE *py = planes[0][y];
+      uint8_t *p = data + (y0 + y) * out->step;
+
+      for (i = 0; i < width / 2; i++) {
+        p[4 * i] = py[2 * i];
+        p[4 * i + 1] = UVC_MJPEG_CHROMA(1, 2 * i, 2 * i + 1, y, y);
+        p[4 * i + 2] = py[2 * i + 1];
+        p[4 * i + 3] = UVC_MJPEG_CHROMA(2, 2 * i, 2 * i + 1, y, y);
+      }
+    }
+    return;
+  }
+
+  for (y = 0; y < rows; y++)
+    memcpy(data + (y0 + y) * out->step, planes[0][y], width);
+
+  /* y0 is a multiple of the iMCU height, which is even. An odd last row or
+   * column is averaged with itself rather than with the block padding. */
+  for (y = 0; y < (rows + 1) / 2; y++) {
+    uint32_t cy = y0 / 2 + y;
+    uint32_t ya = 2 * y, yb = 2 * y + 1 < rows ? 2 * y + 1 : 2 * y;
+
+    if (out->frame_format == UVC_FRAME_FORMAT_NV12) {
+      uint8_t *puv = data + (out->height + cy) * out->step;
+
+      for (i = 0; i < cw; i++) {
+        uint32_t x1 = 2 * i + 1 < width ? 2 * i + 1 : 2 * i;
+
+        puv[2 * i] = UVC_MJPEG_CHROMA(1, 2 * i, x1, ya, yb);
+        puv[2 * i + 1] = UVC_MJPEG_CHROMA(2, 2 * i, x1, ya, yb);
+      }
+    } else {
+      size_t cstep = (out->step + 1) / 2;
+      uint8_t *pu = data + out->height * out->step + cy * cstep;
+      uint8_t *pv = pu + cstep * ((out->height + 1) / 2);
+
+      for (i = 0; i < cw; i++) {
+        uint32_t x1 = 2 * i + 1 < width ? 2 * i + 1 : 2 * i;
+
+        pu[i] = UVC_MJPEG_CHROMA(1, 2 * i, x1, ya, yb);
+        pv[i] = UVC_MJPEG_CHROMA(2, 2 * i, x1, ya, yb);
+      }
+    }
+  }
+
+#undef UVC_MJPEG_CHROMA
+}
+
+/** @internal
+ * @brief Decode to YUV straight from libjpeg's raw samples
+ *
+ * Raw data mode hands out the Y, Cb and Cr planes as they come out of the
+ * IDCT, so there is no chroma upsampling or color conversion to undo.
+ * Frames must be YCbCr with Cb and Cr at the same resolution and luma at
+ * one or two times that in each direction, which covers the 4:2:2 and 4:2:0
+ * frames UVC cameras send.
+ */
+static uvc_error_t uvc_mjpeg_convert_raw(uvc_mjpeg_decoder_t *decoder, uvc_frame_t *in,
+    uvc_frame_t *out, enum uvc_mjpeg_dct_method dct) {
+  struct jpeg_decompress_struct *dinfo = &decoder->dinfo;
+  JSAMPROW rows[3][LIBUVC_MJPEG_MAX_ROWS];
+  JSAMPARRAY planes[3];
+  size_t bytes;
+  JSAMPLE *p;
+  int h_samp, v_samp, c;
+  volatile uvc_error_t ret = UVC_ERROR_OTHER;
+
+  if (setjmp(decoder->jerr.jmp)) {
+    goto fail;
+  }
+
+  insert_huff_tables(dinfo);
+
+  jpeg_mem_src(dinfo, in->data, in->data_bytes);
+  jpeg_read_header(dinfo, TRUE);
+
+  h_samp = dinfo->comp_info[0].h_samp_factor;
+  v_samp = dinfo->comp_info[0].v_samp_factor;
+  if (dinfo->num_components != 3 || dinfo->jpeg_color_space != JCS_YCbCr
+      || h_samp > 2 || v_samp > 2) {
+    ret = UVC_ERROR_NOT_SUPPORTED;
+    goto fail;
+  }
+  for (c = 1; c < 3; c++) {
+    if (dinfo->comp_info[c].h_samp_factor != 1 || dinfo->comp_info[c].v_samp_factor != 1) {
+      ret = UVC_ERROR_NOT_SUPPORTED;
+      goto fail;
+    }
+  }
+
+  dinfo->raw_data_out = TRUE;
+  dinfo->dct_method = _uvc_jpeg_dct_method(dct);
+
+  jpeg_start_decompress(dinfo);
+
+  if (dinfo->output_width > out->width || dinfo->output_height > out->height)
+    goto fail;
+
+  bytes = 0;
+  for (c = 0; c < 3; c++) {
+    jpeg_component_info *comp = &dinfo->comp_info[c];
+    bytes += (size_t) comp->width_in_blocks * DCTSIZE * comp->v_samp_factor * DCTSIZE;
+  }
+
+  if (decoder->raw_bytes < bytes) {
+    p = realloc(decoder->raw, bytes);
+    if (!p) {
+      ret = UVC_ERROR_NO_MEM;
+      goto fail;
+    }
+    decoder->raw = p;
+    decoder->raw_bytes = bytes;
+  }
+
+  p = decoder->raw;
+  for (c = 0; c < 3; c++) {
+    jpeg_component_info *comp = &dinfo->comp_info[c];
+    size_t row_bytes = (size_t) comp->width_in_blocks * DCTSIZE;
+    int row;
+
+    for (row = 0; row < comp->v_samp_factor * DCTSIZE; row++) {
+      rows[c][row] = p;
+      p += row_bytes;
+    }
+    planes[c] = rows[c];
+  }
+
+  while (dinfo->output_scanline < dinfo->output_height) {
+    uint32_t y0 = dinfo->output_scanline;
+    uint32_t count;
+
+    jpeg_read_raw_data(dinfo, planes, v_samp * DCTSIZE);
+
+    /* the last iMCU row runs past the picture into padding; output_height
+     * is no taller than out, as checked above */
+    count = dinfo->output_scanline - y0;
+    if (count > dinfo->output_height - y0)
+      count = dinfo->output_height - y0;
+    _uvc_mjpeg_put_yuv_rows(out, planes, dinfo->output_width, y0, count, h_samp, v_samp);
+  }
+
+  jpeg_finish_decompress(dinfo);
+  return UVC_SUCCESS;
+
+fail:
+  jpeg_abort_decompress(dinfo);
+  return ret;
+}
+
+/** @brief Decode an MJPEG frame at a reduced size
  * @ingroup frame
  *
+ * libjpeg shrinks the frame while decoding it, doing a fraction of the work
+ * of a full decode, which suits previews, thumbnails and motion detection.
+ * The output is the input's size divided by scale_denom, rounded up.
+ *
+ * @param decoder Decoder from uvc_mjpeg_decoder_create(), or NULL to use
+ *        the calling thread's own, which is freed when the thread exits or
+ *        calls uvc_exit()
  * @param in MJPEG frame
- * @param out RGB frame
+ * @param out Decoded frame
+ * @param format Format to decode to, as for uvc_mjpeg_decode(). Only
+ *        UVC_FRAME_FORMAT_RGB and UVC_FRAME_FORMAT_GRAY8 can be scaled.
+ * @param scale_denom 1, 2, 4 or 8
+ * @param dct IDCT to decode with
  */
-uvc_error_t uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+uvc_error_t uvc_mjpeg_decode_scaled(uvc_mjpeg_decoder_t *decoder, uvc_frame_t *in,
+    uvc_frame_t *out, enum uvc_frame_format format, unsigned int scale_denom,
+    enum uvc_mjpeg_dct_method dct) {
+  uint32_t width, height;
+  uvc_error_t ret;
+
   if (in->frame_format != UVC_FRAME_FORMAT_MJPEG)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
+  if (scale_denom != 1 && scale_denom != 2 && scale_denom != 4 && scale_denom != 8)
+    return UVC_ERROR_INVALID_PARAM;
+
+  width = (in->width + scale_denom - 1) / scale_denom;
+  height = (in->height + scale_denom - 1) / scale_denom;
+
+  switch (format) {
+  case UVC_FRAME_FORMAT_RGB:
+  case UVC_FRAME_FORMAT_GRAY8:
+    ret = _uvc_ensure_frame_rows(out, width, height, format == UVC_FRAME_FORMAT_RGB ? 3 : 1);
+    break;
+  case UVC_FRAME_FORMAT_YUYV:
+    if (scale_denom != 1)
+      return UVC_ERROR_NOT_SUPPORTED;
+    if (in->width % 2)
+      return UVC_ERROR_INVALID_PARAM;
+    ret = _uvc_ensure_frame_rows(out, width, height, 2);
+    break;
+  case UVC_FRAME_FORMAT_I420:
+  case UVC_FRAME_FORMAT_NV12:
+    if (scale_denom != 1)
+      return UVC_ERROR_NOT_SUPPORTED;
+    ret = _uvc_ensure_frame_yuv420(out, format, width, height);
+    break;
+  default:
+    return UVC_ERROR_NOT_SUPPORTED;
+  }
+
+  if (ret < 0)
     return UVC_ERROR_NO_MEM;
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_RGB;
-  out->step = in->width * 3;
+  if (!decoder) {
+    decoder = _uvc_mjpeg_thread_decoder();
+    if (!decoder)
+      return UVC_ERROR_NO_MEM;
+  }
+
+  out->frame_format = format;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  return uvc_mjpeg_convert(in, out);
+  if (format == UVC_FRAME_FORMAT_RGB || format == UVC_FRAME_FORMAT_GRAY8)
+    return uvc_mjpeg_convert(decoder, in, out, scale_denom, dct);
+
+  /* JFIF samples are full range BT.601 */
+  out->color_matrix = UVC_COLOR_MATRIX_BT601;
+  out->color_range = UVC_COLOR_RANGE_FULL;
+
+  return uvc_mjpeg_convert_raw(decoder, in, out, dct);
+}
+
+/** @brief Decode an MJPEG frame with a given decoder
+ * @ingroup frame
+ *
+ * @param decoder Decoder from uvc_mjpeg_decoder_create(), or NULL to use
+ *        the calling thread's own, which is freed when the thread exits or
+ *        calls uvc_exit()
+ * @param in MJPEG frame
+ * @param out Decoded frame
+ * @param format Format to decode to: UVC_FRAME_FORMAT_RGB,
+ *        UVC_FRAME_FORMAT_GRAY8, UVC_FRAME_FORMAT_I420,
+ *        UVC_FRAME_FORMAT_NV12 or UVC_FRAME_FORMAT_YUYV. The YUV formats are
+ *        taken from the JPEG's own samples without a round trip through RGB,
+ *        and need a 4:2:0 or 4:2:2 frame, as cameras send; YUYV also needs
+ *        an even width.
+ */
+uvc_error_t uvc_mjpeg_decode(uvc_mjpeg_decoder_t *decoder, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format) {
+  return uvc_mjpeg_decode_scaled(decoder, in, out, format, 1, UVC_MJPEG_DCT_FAST);
+}
+
+/** @brief Convert an MJPEG frame to RGB
+ * @ingroup frame
+ *
+ * @param in MJPEG frame
+ * @param out RGB frame
+ */
+uvc_error_t uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+  return uvc_mjpeg_decode(NULL, in, out, UVC_FRAME_FORMAT_RGB);
 }
 
 /** @brief Convert an MJPEG frame to GRAY8
@@ -203,20 +625,35 @@ uvc_error_t uvc_mjpeg2rgb(uvc_frame_t *in, uvc_frame_t *out) {
  * @param out GRAY8 frame
  */
 uvc_error_t uvc_mjpeg2gray(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_MJPEG)
-    return UVC_ERROR_INVALID_PARAM;
+  return uvc_mjpeg_decode(NULL, in, out, UVC_FRAME_FORMAT_GRAY8);
+}
 
-  if (uvc_ensure_frame_size(out, in->width * in->height) < 0)
-    return UVC_ERROR_NO_MEM;
+/** @brief Convert an MJPEG frame to I420
+ * @ingroup frame
+ *
+ * @param in MJPEG frame
+ * @param out I420 frame
+ */
+uvc_error_t uvc_mjpeg2i420(uvc_frame_t *in, uvc_frame_t *out) {
+  return uvc_mjpeg_decode(NULL, in, out, UVC_FRAME_FORMAT_I420);
+}
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_GRAY8;
-  out->step = in->width;
-  out->sequence = in->sequence;
-  out->capture_time = in->capture_time;
-  out->capture_time_finished = in->capture_time_finished;
-  out->source = in->source;
+/** @brief Convert an MJPEG frame to NV12
+ * @ingroup frame
+ *
+ * @param in MJPEG frame
+ * @param out NV12 frame
+ */
+uvc_error_t uvc_mjpeg2nv12(uvc_frame_t *in, uvc_frame_t *out) {
+  return uvc_mjpeg_decode(NULL, in, out, UVC_FRAME_FORMAT_NV12);
+}
 
-  return uvc_mjpeg_convert(in, out);
+/** @brief Convert an MJPEG frame to YUYV
+ * @ingroup frame
+ *
+ * @param in MJPEG frame
+ * @param out YUYV frame
+ */
+uvc_error_t uvc_mjpeg2yuyv(uvc_frame_t *in, uvc_frame_t *out) {
+  return uvc_mjpeg_decode(NULL, in, out, UVC_FRAME_FORMAT_YUYV);
 }
@@ -0,0 +1,327 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2010-2012 Ken Tossell
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @file
+ * @brief Pools of preallocated frames
+ *
+ * A frame pool allocates all of its frames up front, in one block of memory,
+ * so that taking a frame for a conversion or a copy and giving it back again
+ * is just a locked push or pop of a pointer. Applications handling many
+ * cameras at once avoid hammering the heap from every stream's thread.
+ * Each frame also gets a metadata buffer as large as any a stream collects,
+ * so uvc_duplicate_frame() into a pool frame doesn't allocate either.
+ */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+/** Alignment of each frame's data, one cache line and enough for any SIMD
+ * loads */
+#define LIBUVC_FRAME_POOL_ALIGN 64
+/** Size of the huge pages requested with UVC_FRAME_POOL_HUGE_PAGES */
+#define LIBUVC_HUGE_PAGE_BYTES (2 * 1024 * 1024)
+
+struct uvc_frame_pool {
+  /* protects free_frames, num_free and destroyed */
+  pthread_mutex_t mutex;
+  uvc_frame_t *frames;
+  uvc_frame_t **free_frames;
+  unsigned int num_frames, num_free;
+  /* uvc_frame_pool_destroy() was called with frames still in use; the last
+   * uvc_frame_pool_put() frees the pool */
+  uint8_t destroyed;
+  enum uvc_frame_format format;
+  uint32_t width, height;
+  size_t step, frame_bytes;
+  uint8_t *data;
+  /* non-zero if data was mapped with huge pages, in which case it's the
+   * length of the mapping */
+  size_t mapped_bytes;
+};
+
+/** @internal
+ * @brief Allocate the pool's storage
+ */
+static uvc_error_t _uvc_frame_pool_alloc(uvc_frame_pool_t *pool, size_t bytes, int flags) {
+  size_t align = LIBUVC_FRAME_POOL_ALIGN;
+  void *data;
+
+  if (flags & UVC_FRAME_POOL_HUGE_PAGES) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+    size_t len = (bytes + LIBUVC_HUGE_PAGE_BYTES - 1) & ~(size_t) (LIBUVC_HUGE_PAGE_BYTES - 1);
+
+    /* explicit huge pages only work if the administrator reserved some */
+    data = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+      pool->data = data;
+      pool->mapped_bytes = len;
+      return UVC_SUCCESS;
+    }
+    UVC_DEBUG("no huge pages reserved, falling back to transparent huge pages");
+#endif
+    /* aligning to the huge page size lets the kernel back the block with
+     * transparent huge pages */
+    align = LIBUVC_HUGE_PAGE_BYTES;
+  }
+
+#ifdef _MSC_VER
+  data = _aligned_malloc(bytes, align);
+  if (!data)
+    return UVC_ERROR_NO_MEM;
+#else
+  if (posix_memalign(&data, align, bytes) != 0)
+    return UVC_ERROR_NO_MEM;
+#endif
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (flags & UVC_FRAME_POOL_HUGE_PAGES)
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+
+  pool->data = data;
+  return UVC_SUCCESS;
+}
+
+/** @brief Create a pool of preallocated frames
+ * @ingroup frame
+ *
+ * Allocates num_frames frames big enough for a width x height image in the
+ * given format. Each frame's data is aligned to 64 bytes. Frames taken from
+ * the pool can be passed as the output of any conversion or of
+ * uvc_duplicate_frame(), as long as the result fits; conversions that need
+ * more room than a pool frame has fail with UVC_ERROR_NO_MEM instead of
+ * allocating.
+ *
+ * The pool may be used from several threads at once.
+ *
+ * @param[out] ppool New pool
+ * @param num_frames Number of frames to allocate
+ * @param format Format the frames are meant for
+ * @param width Width of the frames
+ * @param height Height of the frames
+ * @param data_bytes Minimum size of each frame's data. Required for
+ *        compressed formats, whose size doesn't follow from the dimensions;
+ *        may be zero otherwise.
+ * @param flags Bitwise OR of enum uvc_frame_pool_flags. With
+ *        UVC_FRAME_POOL_HUGE_PAGES the frames are placed in huge pages if
+ *        any are reserved, and otherwise in memory the kernel may back with
+ *        transparent huge pages.
+ */
+uvc_error_t uvc_frame_pool_create(uvc_frame_pool_t **ppool, unsigned int num_frames,
+    enum uvc_frame_format format, uint32_t width, uint32_t height, size_t data_bytes,
+    int flags) {
+  uvc_frame_pool_t *pool;
+  size_t step, frame_bytes, slot_bytes;
+  uint8_t *meta;
+  unsigned int i;
+  uvc_error_t ret;
+
+  switch (format) {
+  case UVC_FRAME_FORMAT_NV12:
+  case UVC_FRAME_FORMAT_I420:
+    step = width;
+    frame_bytes = _uvc_yuv420_frame_bytes(format, step, height);
+    break;
+  case UVC_FRAME_FORMAT_P010:
+    step = (size_t) width * 2;
+    frame_bytes = _uvc_yuv420_frame_bytes(format, step, height);
+    break;
+  default:
+    /* zero for compressed formats */
+    step = width * _uvc_packed_pixel_bytes(format);
+    frame_bytes = step * height;
+    break;
+  }
+
+  if (data_bytes > frame_bytes)
+    frame_bytes = data_bytes;
+
+  if (!num_frames || !frame_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  pool = calloc(1, sizeof(*pool));
+  if (!pool)
+    return UVC_ERROR_NO_MEM;
+
+  pool->frames = calloc(num_frames, sizeof(*pool->frames));
+  pool->free_frames = calloc(num_frames, sizeof(*pool->free_frames));
+  if (!pool->frames || !pool->free_frames) {
+    ret = UVC_ERROR_NO_MEM;
+    goto fail;
+  }
+
+  slot_bytes = (frame_bytes + LIBUVC_FRAME_POOL_ALIGN - 1)
+      & ~(size_t) (LIBUVC_FRAME_POOL_ALIGN - 1);
+  /* the metadata buffers follow the frames */
+  ret = _uvc_frame_pool_alloc(pool, (slot_bytes + LIBUVC_XFER_META_BUF_SIZE) * num_frames,
+                              flags);
+  if (ret != UVC_SUCCESS)
+    goto fail;
+  meta = pool->data + slot_bytes * num_frames;
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pool->num_frames = num_frames;
+  pool->format = format;
+  pool->width = width;
+  pool->height = height;
+  pool->step = step;
+  pool->frame_bytes = frame_bytes;
+
+  for (i = 0; i < num_frames; i++) {
+    uvc_frame_t *frame = &pool->frames[i];
+
+    frame->data = pool->data + i * slot_bytes;
+    frame->data_capacity = frame_bytes;
+    frame->metadata = meta + i * LIBUVC_XFER_META_BUF_SIZE;
+    frame->library_owns_data = 1;
+    frame->pool = pool;
+    pool->free_frames[pool->num_free++] = frame;
+  }
+
+  *ppool = pool;
+  return UVC_SUCCESS;
+
+fail:
+  free(pool->frames);
+  free(pool->free_frames);
+  free(pool);
+  return ret;
+}
+
+/** @internal
+ * @brief Free a pool and its frames
+ */
+static void _uvc_frame_pool_free(uvc_frame_pool_t *pool) {
+#if defined(__linux__) && defined(MAP_HUGETLB)
+  if (pool->mapped_bytes)
+    munmap(pool->data, pool->mapped_bytes);
+  else
+#endif
+#ifdef _MSC_VER
+    _aligned_free(pool->data);
+#else
+    free(pool->data);
+#endif
+
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->frames);
+  free(pool->free_frames);
+  free(pool);
+}
+
+/** @brief Free a frame pool
+ * @ingroup frame
+ *
+ * Frames still in use stay valid. The pool is then freed when the last of
+ * them is returned.
+ *
+ * @param pool Pool to free
+ */
+void uvc_frame_pool_destroy(uvc_frame_pool_t *pool) {
+  unsigned int in_use;
+
+  pthread_mutex_lock(&pool->mutex);
+  in_use = pool->num_frames - pool->num_free;
+  pool->destroyed = 1;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (in_use) {
+    UVC_DEBUG("destroying frame pool with %u frames still in use", in_use);
+    return;
+  }
+
+  _uvc_frame_pool_free(pool);
+}
+
+/** @brief Take a frame from a pool
+ * @ingroup frame
+ *
+ * The frame is set up with the pool's format and dimensions and can hold
+ * the pool's frame size. Give it back with uvc_frame_pool_put() or
+ * uvc_free_frame().
+ *
+ * @param pool Pool to take a frame from
+ * @return Frame, or NULL if every frame is in use
+ */
+uvc_frame_t *uvc_frame_pool_get(uvc_frame_pool_t *pool) {
+  uvc_frame_t *frame = NULL;
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->num_free > 0)
+    frame = pool->free_frames[--pool->num_free];
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (!frame)
+    return NULL;
+
+  frame->data_bytes = pool->frame_bytes;
+  /* keep the metadata buffer for the next copy, but not its contents */
+  frame->metadata_bytes = 0;
+  frame->width = pool->width;
+  frame->height = pool->height;
+  frame->frame_format = pool->format;
+  frame->step = pool->step;
+  frame->sequence = 0;
+  memset(&frame->capture_time, 0, sizeof(frame->capture_time));
+  memset(&frame->capture_time_finished, 0, sizeof(frame->capture_time_finished));
+  frame->source = NULL;
+  frame->color_matrix = UVC_COLOR_MATRIX_BT601;
+  frame->color_range = UVC_COLOR_RANGE_FULL;
+
+  return frame;
+}
+
+/** @brief Return a frame to its pool
+ * @ingroup frame
+ *
+ * @param frame Frame obtained from uvc_frame_pool_get()
+ */
+void uvc_frame_pool_put(uvc_frame_t *frame) {
+  uvc_frame_pool_t *pool = frame->pool;
+  int last;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->free_frames[pool->num_free++] = frame;
+  last = pool->destroyed && pool->num_free == pool->num_frames;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (last)
+    _uvc_frame_pool_free(pool);
+}
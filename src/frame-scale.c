@@ -0,0 +1,340 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2010-2012 Ken Tossell
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @defgroup scale Scaled conversion
+ * @brief Converting and resizing frames in one pass
+ *
+ * Luma and chroma are filtered in the YUV domain, straight from the input
+ * frame, and each output pixel is converted to RGB only once. This avoids
+ * building a full-size RGB frame just to shrink it.
+ */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+
+struct uvc_scale {
+  uvc_frame_t *in, *out;
+  size_t in_step;
+  enum uvc_frame_format format;
+  enum uvc_scale_filter filter;
+  struct uvc_yuv_coefs coefs;
+  size_t out_pixel_bytes;
+  /* box: output column x covers input columns [cols[x], cols[x + 1]);
+   * bilinear: output column x samples input column cols[x] / 65536 */
+  uint32_t *cols;
+};
+
+static inline unsigned char sat(int i) {
+  return (unsigned char)( i >= 255 ? 255 : (i < 0 ? 0 : i));
+}
+
+/** @internal
+ * @brief Write one output pixel
+ */
+static inline void _uvc_scale_put(uint8_t *out, enum uvc_frame_format format,
+    const struct uvc_yuv_coefs *c, int y, int u, int v) {
+  int r, g, b;
+
+  if (format == UVC_FRAME_FORMAT_GRAY8) {
+    out[0] = y;
+    return;
+  }
+
+  r = (c->rv * (v - 128)) >> 14;
+  g = (c->gu * (u - 128) + c->gv * (v - 128)) >> 14;
+  b = (c->bu * (u - 128)) >> 14;
+  y = (c->y_mul * (y - c->y_off)) >> 14;
+
+  if (format == UVC_FRAME_FORMAT_RGB) {
+    out[0] = sat(y + r);
+    out[1] = sat(y + g);
+    out[2] = sat(y + b);
+  } else {
+    out[0] = sat(y + b);
+    out[1] = sat(y + g);
+    out[2] = sat(y + r);
+  }
+}
+
+/** @internal
+ * @brief Add an input row's samples to per-column sums
+ *
+ * @param ys Luma of each column
+ * @param uvs Chroma of each column pair: U at the even index, V at the odd
+ */
+static void _uvc_scale_add_row(struct uvc_scale *sc, uint32_t y, uint32_t *ys, uint32_t *uvs) {
+  const uint8_t *row = (uint8_t *) sc->in->data + y * sc->in_step;
+  const uint8_t *uv;
+  uint32_t x, w = sc->in->width;
+
+  switch (sc->in->frame_format) {
+  case UVC_FRAME_FORMAT_YUYV:
+    for (x = 0; x < w; x += 2, row += 4) {
+      ys[x] += row[0];
+      uvs[x] += row[1];
+      ys[x + 1] += row[2];
+      uvs[x + 1] += row[3];
+    }
+    break;
+  case UVC_FRAME_FORMAT_UYVY:
+    for (x = 0; x < w; x += 2, row += 4) {
+      uvs[x] += row[0];
+      ys[x] += row[1];
+      uvs[x + 1] += row[2];
+      ys[x + 1] += row[3];
+    }
+    break;
+  default:
+    /* NV12: the chroma plane follows the luma plane, one row per two */
+    uv = (uint8_t *) sc->in->data + (sc->in->height + y / 2) * sc->in_step;
+    for (x = 0; x < w; x++) {
+      ys[x] += row[x];
+      uvs[x] += uv[x];
+    }
+    break;
+  }
+}
+
+/** @internal
+ * @brief Box filter: average every input pixel that an output pixel covers
+ */
+static uvc_error_t _uvc_scale_box_rows(struct uvc_scale *sc, uint32_t row, uint32_t rows) {
+  uint32_t in_w = sc->in->width, in_h = sc->in->height;
+  uint32_t out_w = sc->out->width, out_h = sc->out->height;
+  uint32_t *ys = malloc(2 * in_w * sizeof(*ys));
+  uint32_t *uvs = ys + in_w;
+  uint32_t oy, ox, y, x;
+
+  if (!ys)
+    return UVC_ERROR_NO_MEM;
+
+  for (oy = row; oy < row + rows; oy++) {
+    uint32_t y0 = (uint64_t) oy * in_h / out_h;
+    uint32_t y1 = (uint64_t) (oy + 1) * in_h / out_h;
+    uint8_t *out = (uint8_t *) sc->out->data + oy * sc->out->step;
+
+    if (y1 <= y0)
+      y1 = y0 + 1;
+
+    memset(ys, 0, 2 * in_w * sizeof(*ys));
+    for (y = y0; y < y1; y++)
+      _uvc_scale_add_row(sc, y, ys, uvs);
+
+    for (ox = 0; ox < out_w; ox++, out += sc->out_pixel_bytes) {
+      uint32_t x0 = sc->cols[ox], x1 = sc->cols[ox + 1];
+      uint32_t n;
+      uint32_t ysum = 0, usum = 0, vsum = 0;
+
+      /* when enlarging, every output pixel still needs an input pixel */
+      if (x1 <= x0)
+        x1 = x0 + 1;
+      n = (x1 - x0) * (y1 - y0);
+
+      for (x = x0; x < x1; x++) {
+        ysum += ys[x];
+        usum += uvs[x & ~1u];
+        vsum += uvs[x | 1];
+      }
+
+      _uvc_scale_put(out, sc->format, &sc->coefs, (ysum + n / 2) / n, (usum + n / 2) / n,
+                     (vsum + n / 2) / n);
+    }
+  }
+
+  free(ys);
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Bilinear filter: interpolate between the four input pixels nearest
+ * to each output pixel's centre
+ */
+static uvc_error_t _uvc_scale_bilinear_rows(struct uvc_scale *sc, uint32_t row, uint32_t rows) {
+  uint32_t in_w = sc->in->width, in_h = sc->in->height;
+  uint32_t out_w = sc->out->width, out_h = sc->out->height;
+  /* luma and chroma of the two input rows around the sample point */
+  uint32_t *buf = malloc(4 * in_w * sizeof(*buf));
+  uint32_t *ys0 = buf, *uvs0 = buf + in_w, *ys1 = buf + 2 * in_w, *uvs1 = buf + 3 * in_w;
+  uint32_t oy, ox;
+
+  if (!buf)
+    return UVC_ERROR_NO_MEM;
+
+  for (oy = row; oy < row + rows; oy++) {
+    int64_t pos = ((2 * (int64_t) oy + 1) * in_h << 16) / (2 * out_h) - 32768;
+    uint32_t y0, y1, fy;
+    uint8_t *out = (uint8_t *) sc->out->data + oy * sc->out->step;
+
+    if (pos < 0)
+      pos = 0;
+    if (pos > (int64_t) (in_h - 1) << 16)
+      pos = (int64_t) (in_h - 1) << 16;
+    y0 = pos >> 16;
+    y1 = y0 + 1 < in_h ? y0 + 1 : y0;
+    fy = (pos >> 8) & 0xff;
+
+    memset(buf, 0, 4 * in_w * sizeof(*buf));
+    _uvc_scale_add_row(sc, y0, ys0, uvs0);
+    _uvc_scale_add_row(sc, y1, ys1, uvs1);
+
+#define UVC_LERP2(a, b, c, d) \
+  ((((a) * (256 - fx) + (b) * fx) * (256 - fy) + ((c) * (256 - fx) + (d) * fx) * fy + 32768) >> 16)
+
+    for (ox = 0; ox < out_w; ox++, out += sc->out_pixel_bytes) {
+      uint32_t x0 = sc->cols[ox] >> 16;
+      uint32_t x1 = x0 + 1 < in_w ? x0 + 1 : x0;
+      uint32_t fx = (sc->cols[ox] >> 8) & 0xff;
+      uint32_t u0 = x0 & ~1u, u1 = x1 & ~1u;
+
+      _uvc_scale_put(out, sc->format, &sc->coefs,
+                     UVC_LERP2(ys0[x0], ys0[x1], ys1[x0], ys1[x1]),
+                     UVC_LERP2(uvs0[u0], uvs0[u1], uvs1[u0], uvs1[u1]),
+                     UVC_LERP2(uvs0[u0 | 1], uvs0[u1 | 1], uvs1[u0 | 1], uvs1[u1 | 1]));
+    }
+
+#undef UVC_LERP2
+  }
+
+  free(buf);
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Scale a band of output rows; called through _uvc_convert_rows()
+ */
+static uvc_error_t _uvc_scale_rows(void *arg, uint32_t row, uint32_t rows) {
+  struct uvc_scale *sc = arg;
+
+  if (sc->filter == UVC_SCALE_BILINEAR)
+    return _uvc_scale_bilinear_rows(sc, row, rows);
+  else
+    return _uvc_scale_box_rows(sc, row, rows);
+}
+
+/** @brief Convert a frame and resize it in one pass
+ * @ingroup scale
+ *
+ * Accepts YUYV, UYVY and NV12 frames of even width. Typical uses are
+ * producing a preview at 1/2 or 1/4 size alongside the full-size frame, but
+ * any output size works.
+ *
+ * @param pool Pool to spread the work over, or NULL to convert on the
+ * calling thread
+ * @param in Frame to convert
+ * @param out Converted frame
+ * @param format Format to convert to: UVC_FRAME_FORMAT_RGB,
+ * UVC_FRAME_FORMAT_BGR or UVC_FRAME_FORMAT_GRAY8
+ * @param width Width of the converted frame
+ * @param height Height of the converted frame
+ * @param filter UVC_SCALE_BOX averages all the input pixels under each
+ * output pixel, which suits shrinking by any amount. UVC_SCALE_BILINEAR
+ * interpolates, which is smoother for enlarging or shrinking by less than
+ * half, and aliases beyond that.
+ */
+uvc_error_t uvc_convert_scaled(uvc_convert_pool_t *pool, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format, uint32_t width, uint32_t height,
+    enum uvc_scale_filter filter) {
+  struct uvc_scale sc;
+  size_t min_bytes;
+  uvc_error_t ret;
+  uint32_t x;
+
+  memset(&sc, 0, sizeof(sc));
+  sc.in = in;
+  sc.out = out;
+  sc.format = format;
+  sc.filter = filter;
+  sc.coefs = *_uvc_yuv_coefs(in);
+
+  switch (format) {
+  case UVC_FRAME_FORMAT_RGB:
+  case UVC_FRAME_FORMAT_BGR:
+    sc.out_pixel_bytes = 3;
+    break;
+  case UVC_FRAME_FORMAT_GRAY8:
+    sc.out_pixel_bytes = 1;
+    break;
+  default:
+    return UVC_ERROR_NOT_SUPPORTED;
+  }
+
+  switch (in->frame_format) {
+  case UVC_FRAME_FORMAT_YUYV:
+  case UVC_FRAME_FORMAT_UYVY:
+    sc.in_step = in->step ? in->step : in->width * 2;
+    min_bytes = sc.in_step * (in->height - 1) + in->width * 2;
+    break;
+  case UVC_FRAME_FORMAT_NV12:
+    sc.in_step = in->step ? in->step : in->width;
+    min_bytes = sc.in_step * (in->height + (in->height + 1) / 2 - 1) + in->width;
+    break;
+  default:
+    return UVC_ERROR_NOT_SUPPORTED;
+  }
+
+  if (!width || !height || !in->width || !in->height || (in->width & 1)
+      || in->data_bytes < min_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (_uvc_ensure_frame_rows(out, width, height, sc.out_pixel_bytes) < 0)
+    return UVC_ERROR_NO_MEM;
+
+  out->frame_format = format;
+  out->sequence = in->sequence;
+  out->capture_time = in->capture_time;
+  out->capture_time_finished = in->capture_time_finished;
+  out->source = in->source;
+
+  sc.cols = malloc((width + 1) * sizeof(*sc.cols));
+  if (!sc.cols)
+    return UVC_ERROR_NO_MEM;
+
+  for (x = 0; x <= width; x++) {
+    if (filter == UVC_SCALE_BILINEAR) {
+      int64_t pos = ((2 * (int64_t) x + 1) * in->width << 16) / (2 * width) - 32768;
+
+      if (pos < 0)
+        pos = 0;
+      if (pos > (int64_t) (in->width - 1) << 16)
+        pos = (int64_t) (in->width - 1) << 16;
+      sc.cols[x] = pos;
+    } else {
+      sc.cols[x] = (uint64_t) x * in->width / width;
+    }
+  }
+
+  ret = _uvc_convert_rows(pool, height, _uvc_scale_rows, &sc);
+
+  free(sc.cols);
+  return ret;
+}
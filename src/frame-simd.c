@@ -0,0 +1,911 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2010-2012 Ken Tossell
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @file
+ * @brief SIMD kernels for YUV to RGB/BGR conversion
+ *
+ * The kernels reproduce the scalar conversion in frame.c bit for bit: the
+ * chroma terms are computed as 32-bit products, shifted down by 14 and added
+ * to the scaled luma with unsigned saturation. The coefficients for the
+ * frame's colorimetry are broadcast into vectors once per call. The blue
+ * coefficient can exceed 16 bits, so it is applied as u + ((bu - 2^14) * u
+ * >> 14), which is the same thing. frame.c converts whole blocks of pixels
+ * with the best kernel the CPU supports, chosen on first use, and finishes
+ * any remainder with the scalar macros.
+ *
+ * Every kernel is built from a loader, which fetches a block of luma and
+ * chroma samples in one of the input layouts, and a common routine that
+ * computes and stores the pixels. 10-bit P010 samples are reduced to their
+ * top 8 bits.
+ *
+ * Bayer demosaicing is vectorized the same way: every candidate value is
+ * computed for 8 pixels at once, and each lane picks the right one for its
+ * site in the pattern. Edge-aware demosaicing also picks per lane between
+ * the horizontal and vertical green estimates by comparing gradients.
+ */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define UVC_SIMD_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define UVC_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+/* Converts blocks * (pixels per block) pixels. Packed formats only use in;
+ * semi-planar formats take a row of luma in in and of chroma in uv. */
+typedef void (uvc_yuv_kernel_t)(const uint8_t *in, const uint8_t *uv, uint8_t *out,
+    size_t blocks, const struct uvc_yuv_coefs *coefs);
+
+/* Bilinear demosaicing of pixels x up to width of a row; returns the column
+ * it stopped at. See _uvc_bayer_bilinear_simd(). */
+typedef size_t (uvc_bayer_kernel_t)(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format);
+
+/* The two passes of edge-aware demosaicing; see _uvc_bayer_green_simd() and
+ * _uvc_bayer_edge_aware_simd() */
+typedef size_t (uvc_bayer_green_kernel_t)(const uint8_t *above2, const uint8_t *above,
+    const uint8_t *row, const uint8_t *below, const uint8_t *below2, uint8_t *green,
+    size_t x, size_t width, unsigned int color_x);
+typedef size_t (uvc_bayer_edge_aware_kernel_t)(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *g_above, const uint8_t *g_row,
+    const uint8_t *g_below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format);
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static uvc_yuv_kernel_t *kernels[UVC_YUV_NUM_CONV];
+static size_t kernel_block_pixels;
+static uvc_bayer_kernel_t *bayer_kernel;
+static uvc_bayer_green_kernel_t *bayer_green_kernel;
+static uvc_bayer_edge_aware_kernel_t *bayer_edge_aware_kernel;
+
+/* Bytes of input (luma for semi-planar formats) per pixel */
+#define UVC_YUYV_BYTES 2
+#define UVC_UYVY_BYTES 2
+#define UVC_NV12_BYTES 1
+#define UVC_P010_BYTES 2
+
+/* Instantiate a kernel from block(in, uv, out, bgr, coefs), which converts
+ * block_pixels pixels, with a loader for the given layout. The coefficients
+ * are copied to a local so the compiler can keep them in registers. */
+#define UVC_YUV_KERNEL(isa, attr, layout, bgr, block, block_pixels) \
+  static attr void _uvc_##layout##_##bgr##_##isa(const uint8_t *src, const uint8_t *src_uv, \
+      uint8_t *dst, size_t blocks, const struct uvc_yuv_coefs *coefs) { \
+    const struct uvc_yuv_coefs c = *coefs; \
+    for (; blocks; blocks--) { \
+      block(_uvc_load_##layout##_##isa, src, src_uv, dst, bgr, &c); \
+      src += UVC_##layout##_BYTES * block_pixels; \
+      src_uv += UVC_##layout##_BYTES * block_pixels; \
+      dst += 3 * block_pixels; \
+    } \
+  }
+
+#define UVC_YUV_KERNELS(isa, attr, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, YUYV, 0, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, YUYV, 1, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, UYVY, 0, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, UYVY, 1, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, NV12, 0, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, NV12, 1, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, P010, 0, block, block_pixels) \
+  UVC_YUV_KERNEL(isa, attr, P010, 1, block, block_pixels)
+
+#define UVC_YUV_USE_KERNELS(isa, block_pixels) { \
+    kernels[UVC_YUYV2RGB] = _uvc_YUYV_0_##isa; \
+    kernels[UVC_YUYV2BGR] = _uvc_YUYV_1_##isa; \
+    kernels[UVC_UYVY2RGB] = _uvc_UYVY_0_##isa; \
+    kernels[UVC_UYVY2BGR] = _uvc_UYVY_1_##isa; \
+    kernels[UVC_NV12_2RGB] = _uvc_NV12_0_##isa; \
+    kernels[UVC_NV12_2BGR] = _uvc_NV12_1_##isa; \
+    kernels[UVC_P010_2RGB] = _uvc_P010_0_##isa; \
+    kernels[UVC_P010_2BGR] = _uvc_P010_1_##isa; \
+    kernel_block_pixels = block_pixels; \
+  }
+
+#ifdef UVC_SIMD_X86
+
+#define UVC_SSE2 __attribute__((target("sse2")))
+#define UVC_SSSE3 __attribute__((target("ssse3")))
+#define UVC_AVX2 __attribute__((target("avx2")))
+
+/* SSE2 and SSSE3 loaders fetch 8 pixels: y holds 16-bit luma, uv
+ * alternating 16-bit U and V, one pair per two pixels */
+static inline UVC_SSE2 void _uvc_load_YUYV_sse2(const uint8_t *in, const uint8_t *uv_in,
+    __m128i *y, __m128i *uv) {
+  __m128i x = _mm_loadu_si128((const __m128i *) in);
+  *y = _mm_and_si128(x, _mm_set1_epi16(0xff));
+  *uv = _mm_srli_epi16(x, 8);
+}
+
+static inline UVC_SSE2 void _uvc_load_UYVY_sse2(const uint8_t *in, const uint8_t *uv_in,
+    __m128i *y, __m128i *uv) {
+  __m128i x = _mm_loadu_si128((const __m128i *) in);
+  *y = _mm_srli_epi16(x, 8);
+  *uv = _mm_and_si128(x, _mm_set1_epi16(0xff));
+}
+
+static inline UVC_SSE2 void _uvc_load_NV12_sse2(const uint8_t *in, const uint8_t *uv_in,
+    __m128i *y, __m128i *uv) {
+  *y = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) in), _mm_setzero_si128());
+  *uv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) uv_in), _mm_setzero_si128());
+}
+
+static inline UVC_SSE2 void _uvc_load_P010_sse2(const uint8_t *in, const uint8_t *uv_in,
+    __m128i *y, __m128i *uv) {
+  *y = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) in), 8);
+  *uv = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) uv_in), 8);
+}
+
+#define _uvc_load_YUYV_ssse3 _uvc_load_YUYV_sse2
+#define _uvc_load_UYVY_ssse3 _uvc_load_UYVY_sse2
+#define _uvc_load_NV12_ssse3 _uvc_load_NV12_sse2
+#define _uvc_load_P010_ssse3 _uvc_load_P010_sse2
+
+/* Each 32-bit lane of a coefficient vector multiplies one (U, V) pair */
+#define UVC_UV_COEFFS(cu, cv) _mm_set_epi16(cv, cu, cv, cu, cv, cu, cv, cu)
+
+/** @internal
+ * @brief Compute the three channels of 8 pixels
+ *
+ * @param[out] first First channel of each pixel (R, or B for BGR) in bytes
+ * 0-7, second channel (G) in bytes 8-15
+ * @param[out] last Last channel of each pixel in bytes 0-7
+ */
+static inline UVC_SSE2 void _uvc_yuv_sse2_channels(__m128i y, __m128i uv, int bgr,
+    const struct uvc_yuv_coefs *c, __m128i *first, __m128i *last) {
+  __m128i r, g, b, u;
+
+  uv = _mm_sub_epi16(uv, _mm_set1_epi16(128));
+
+  /* (y_mul * (y - y_off)) >> 14, as the high half of y_mul * 4 * (y - y_off) */
+  y = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(y, _mm_set1_epi16(c->y_off)), 2),
+                      _mm_set1_epi16(c->y_mul));
+
+  r = _mm_srai_epi32(_mm_madd_epi16(uv, UVC_UV_COEFFS(0, c->rv)), 14);
+  g = _mm_srai_epi32(_mm_madd_epi16(uv, UVC_UV_COEFFS(c->gu, c->gv)), 14);
+  u = _mm_srai_epi32(_mm_slli_epi32(uv, 16), 16);
+  b = _mm_srai_epi32(_mm_madd_epi16(uv, UVC_UV_COEFFS(c->bu - 16384, 0)), 14);
+  b = _mm_add_epi32(b, u);
+
+  /* one chroma value per pixel pair, so duplicate each */
+  r = _mm_packs_epi32(r, r);
+  r = _mm_add_epi16(y, _mm_unpacklo_epi16(r, r));
+  g = _mm_packs_epi32(g, g);
+  g = _mm_add_epi16(y, _mm_unpacklo_epi16(g, g));
+  b = _mm_packs_epi32(b, b);
+  b = _mm_add_epi16(y, _mm_unpacklo_epi16(b, b));
+
+  *first = _mm_packus_epi16(bgr ? b : r, g);
+  *last = _mm_packus_epi16(bgr ? r : b, bgr ? r : b);
+}
+
+/** @internal
+ * @brief Convert 8 pixels, writing each as a 32-bit store that the next
+ * pixel partly overwrites
+ */
+#define _uvc_yuv_sse2_block(load, in, uv_in, out, bgr, c) { \
+    __m128i y, uv, first, last, pairs, pixels[2]; \
+    uint32_t px; \
+    int i; \
+    load(in, uv_in, &y, &uv); \
+    _uvc_yuv_sse2_channels(y, uv, bgr, c, &first, &last); \
+    pairs = _mm_unpacklo_epi8(first, _mm_srli_si128(first, 8)); \
+    last = _mm_unpacklo_epi8(last, _mm_setzero_si128()); \
+    pixels[0] = _mm_unpacklo_epi16(pairs, last); \
+    pixels[1] = _mm_unpackhi_epi16(pairs, last); \
+    for (i = 0; i < 8; i++) { \
+      px = _mm_cvtsi128_si32(pixels[i >> 2]); \
+      pixels[i >> 2] = _mm_srli_si128(pixels[i >> 2], 4); \
+      /* the last pixel must not write past the block */ \
+      memcpy(out + 3 * i, &px, i < 7 ? 4 : 3); \
+    } \
+  }
+
+UVC_YUV_KERNELS(sse2, UVC_SSE2, _uvc_yuv_sse2_block, 8)
+
+/* Shuffles from the output of _uvc_yuv_sse2_channels to 24 bytes of packed
+ * pixels: 16 bytes (shuffle 0), then 8 more (shuffle 1) */
+#define UVC_SHUF_FIRST_0 _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5)
+#define UVC_SHUF_LAST_0 _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1)
+#define UVC_SHUF_FIRST_1 _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1)
+#define UVC_SHUF_LAST_1 _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1)
+
+/** @internal
+ * @brief Convert 8 pixels, interleaving the channels with byte shuffles
+ */
+#define _uvc_yuv_ssse3_block(load, in, uv_in, out, bgr, c) { \
+    __m128i y, uv, first, last; \
+    load(in, uv_in, &y, &uv); \
+    _uvc_yuv_sse2_channels(y, uv, bgr, c, &first, &last); \
+    _mm_storeu_si128((__m128i *) out, \
+                     _mm_or_si128(_mm_shuffle_epi8(first, UVC_SHUF_FIRST_0), \
+                                  _mm_shuffle_epi8(last, UVC_SHUF_LAST_0))); \
+    _mm_storel_epi64((__m128i *) (out + 16), \
+                     _mm_or_si128(_mm_shuffle_epi8(first, UVC_SHUF_FIRST_1), \
+                                  _mm_shuffle_epi8(last, UVC_SHUF_LAST_1))); \
+  }
+
+UVC_YUV_KERNELS(ssse3, UVC_SSSE3, _uvc_yuv_ssse3_block, 8)
+
+/* AVX2 loaders fetch 16 pixels, laid out as two SSE2 loads side by side */
+static inline UVC_AVX2 void _uvc_load_YUYV_avx2(const uint8_t *in, const uint8_t *uv_in,
+    __m256i *y, __m256i *uv) {
+  __m256i x = _mm256_loadu_si256((const __m256i *) in);
+  *y = _mm256_and_si256(x, _mm256_set1_epi16(0xff));
+  *uv = _mm256_srli_epi16(x, 8);
+}
+
+static inline UVC_AVX2 void _uvc_load_UYVY_avx2(const uint8_t *in, const uint8_t *uv_in,
+    __m256i *y, __m256i *uv) {
+  __m256i x = _mm256_loadu_si256((const __m256i *) in);
+  *y = _mm256_srli_epi16(x, 8);
+  *uv = _mm256_and_si256(x, _mm256_set1_epi16(0xff));
+}
+
+static inline UVC_AVX2 void _uvc_load_NV12_avx2(const uint8_t *in, const uint8_t *uv_in,
+    __m256i *y, __m256i *uv) {
+  *y = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) in));
+  *uv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) uv_in));
+}
+
+static inline UVC_AVX2 void _uvc_load_P010_avx2(const uint8_t *in, const uint8_t *uv_in,
+    __m256i *y, __m256i *uv) {
+  *y = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *) in), 8);
+  *uv = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *) uv_in), 8);
+}
+
+#define UVC_M256_DUP(x) _mm256_broadcastsi128_si256(x)
+
+/** @internal
+ * @brief Convert 16 pixels
+ *
+ * Works like the SSSE3 block on each 128-bit lane, i.e. on 8 pixels at a time.
+ */
+static inline UVC_AVX2 void _uvc_yuv_avx2_store(__m256i y, __m256i uv, uint8_t *out, int bgr,
+    const struct uvc_yuv_coefs *c) {
+  __m256i r, g, b, u, first, last, out0, out1;
+
+  uv = _mm256_sub_epi16(uv, _mm256_set1_epi16(128));
+
+  y = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(y, _mm256_set1_epi16(c->y_off)), 2),
+                         _mm256_set1_epi16(c->y_mul));
+
+  r = _mm256_srai_epi32(_mm256_madd_epi16(uv, UVC_M256_DUP(UVC_UV_COEFFS(0, c->rv))), 14);
+  g = _mm256_srai_epi32(_mm256_madd_epi16(uv, UVC_M256_DUP(UVC_UV_COEFFS(c->gu, c->gv))), 14);
+  u = _mm256_srai_epi32(_mm256_slli_epi32(uv, 16), 16);
+  b = _mm256_srai_epi32(_mm256_madd_epi16(uv, UVC_M256_DUP(UVC_UV_COEFFS(c->bu - 16384, 0))), 14);
+  b = _mm256_add_epi32(b, u);
+
+  r = _mm256_packs_epi32(r, r);
+  r = _mm256_add_epi16(y, _mm256_unpacklo_epi16(r, r));
+  g = _mm256_packs_epi32(g, g);
+  g = _mm256_add_epi16(y, _mm256_unpacklo_epi16(g, g));
+  b = _mm256_packs_epi32(b, b);
+  b = _mm256_add_epi16(y, _mm256_unpacklo_epi16(b, b));
+
+  first = _mm256_packus_epi16(bgr ? b : r, g);
+  last = _mm256_packus_epi16(bgr ? r : b, bgr ? r : b);
+
+  out0 = _mm256_or_si256(_mm256_shuffle_epi8(first, UVC_M256_DUP(UVC_SHUF_FIRST_0)),
+                         _mm256_shuffle_epi8(last, UVC_M256_DUP(UVC_SHUF_LAST_0)));
+  out1 = _mm256_or_si256(_mm256_shuffle_epi8(first, UVC_M256_DUP(UVC_SHUF_FIRST_1)),
+                         _mm256_shuffle_epi8(last, UVC_M256_DUP(UVC_SHUF_LAST_1)));
+
+  _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(out0));
+  _mm_storel_epi64((__m128i *) (out + 16), _mm256_castsi256_si128(out1));
+  _mm_storeu_si128((__m128i *) (out + 24), _mm256_extracti128_si256(out0, 1));
+  _mm_storel_epi64((__m128i *) (out + 40), _mm256_extracti128_si256(out1, 1));
+}
+
+#define _uvc_yuv_avx2_block(load, in, uv_in, out, bgr, c) { \
+    __m256i y, uv; \
+    load(in, uv_in, &y, &uv); \
+    _uvc_yuv_avx2_store(y, uv, out, bgr, c); \
+  }
+
+UVC_YUV_KERNELS(avx2, UVC_AVX2, _uvc_yuv_avx2_block, 16)
+
+static inline UVC_SSSE3 __m128i _uvc_select_ssse3(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* Lanes holding the row's red or blue samples */
+#define UVC_BAYER_SITE_SSSE3(color_x) \
+  ((color_x) ? _mm_set_epi16(-1, 0, -1, 0, -1, 0, -1, 0) \
+             : _mm_set_epi16(0, -1, 0, -1, 0, -1, 0, -1))
+
+#define UVC_BAYER_LOAD(p, offset) \
+  _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) ((p) + x + (offset))), zero)
+
+/* Stores 8 demosaiced pixels from 16-bit channels in the range 0 to 255 */
+static inline UVC_SSSE3 void _uvc_bayer_store_ssse3(__m128i red, __m128i g, __m128i blue,
+    uint8_t *out, size_t x, enum uvc_frame_format format) {
+  if (format == UVC_FRAME_FORMAT_GRAY8) {
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(red, _mm_set1_epi16(77)),
+                              _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(blue, _mm_set1_epi16(29)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    _mm_storel_epi64((__m128i *) (out + x), _mm_packus_epi16(y, y));
+  } else {
+    __m128i first, last;
+
+    if (format == UVC_FRAME_FORMAT_BGR) {
+      first = _mm_packus_epi16(blue, g);
+      last = _mm_packus_epi16(red, red);
+    } else {
+      first = _mm_packus_epi16(red, g);
+      last = _mm_packus_epi16(blue, blue);
+    }
+
+    _mm_storeu_si128((__m128i *) (out + 3 * x),
+                     _mm_or_si128(_mm_shuffle_epi8(first, UVC_SHUF_FIRST_0),
+                                  _mm_shuffle_epi8(last, UVC_SHUF_LAST_0)));
+    _mm_storel_epi64((__m128i *) (out + 3 * x + 16),
+                     _mm_or_si128(_mm_shuffle_epi8(first, UVC_SHUF_FIRST_1),
+                                  _mm_shuffle_epi8(last, UVC_SHUF_LAST_1)));
+  }
+}
+
+static UVC_SSSE3 size_t _uvc_bayer_bilinear_ssse3(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i site = UVC_BAYER_SITE_SSSE3(color_x);
+
+  /* 8 pixels at a time, reading one column either side */
+  for (; x + 9 <= width; x += 8) {
+    __m128i c = UVC_BAYER_LOAD(row, 0);
+    __m128i h = _mm_add_epi16(UVC_BAYER_LOAD(row, -1), UVC_BAYER_LOAD(row, 1));
+    __m128i v = _mm_add_epi16(UVC_BAYER_LOAD(above, 0), UVC_BAYER_LOAD(below, 0));
+    __m128i d = _mm_add_epi16(_mm_add_epi16(UVC_BAYER_LOAD(above, -1), UVC_BAYER_LOAD(above, 1)),
+                              _mm_add_epi16(UVC_BAYER_LOAD(below, -1), UVC_BAYER_LOAD(below, 1)));
+    __m128i h2 = _mm_srli_epi16(_mm_add_epi16(h, _mm_set1_epi16(1)), 1);
+    __m128i v2 = _mm_srli_epi16(_mm_add_epi16(v, _mm_set1_epi16(1)), 1);
+    __m128i hv4 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(h, v), _mm_set1_epi16(2)), 2);
+    __m128i d4 = _mm_srli_epi16(_mm_add_epi16(d, _mm_set1_epi16(2)), 2);
+    __m128i own = _uvc_select_ssse3(site, c, h2);
+    __m128i g = _uvc_select_ssse3(site, hv4, c);
+    __m128i other = _uvc_select_ssse3(site, d4, v2);
+
+    _uvc_bayer_store_ssse3(red_row ? own : other, g, red_row ? other : own, out, x, format);
+  }
+
+  return x;
+}
+
+static UVC_SSSE3 size_t _uvc_bayer_green_ssse3(const uint8_t *above2, const uint8_t *above,
+    const uint8_t *row, const uint8_t *below, const uint8_t *below2, uint8_t *green,
+    size_t x, size_t width, unsigned int color_x) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i site = UVC_BAYER_SITE_SSSE3(color_x);
+
+  /* 8 pixels at a time, reading two columns either side */
+  for (; x + 10 <= width; x += 8) {
+    __m128i c = UVC_BAYER_LOAD(row, 0);
+    __m128i l = UVC_BAYER_LOAD(row, -1), r = UVC_BAYER_LOAD(row, 1);
+    __m128i u = UVC_BAYER_LOAD(above, 0), d = UVC_BAYER_LOAD(below, 0);
+    __m128i c2 = _mm_add_epi16(c, c);
+    __m128i curv_h = _mm_sub_epi16(c2, _mm_add_epi16(UVC_BAYER_LOAD(row, -2),
+                                                     UVC_BAYER_LOAD(row, 2)));
+    __m128i curv_v = _mm_sub_epi16(c2, _mm_add_epi16(UVC_BAYER_LOAD(above2, 0),
+                                                     UVC_BAYER_LOAD(below2, 0)));
+    __m128i grad_h = _mm_add_epi16(_mm_abs_epi16(_mm_sub_epi16(l, r)), _mm_abs_epi16(curv_h));
+    __m128i grad_v = _mm_add_epi16(_mm_abs_epi16(_mm_sub_epi16(u, d)), _mm_abs_epi16(curv_v));
+    /* four times the estimates, which may be negative */
+    __m128i est_h = _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(l, r), 1), curv_h);
+    __m128i est_v = _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(u, d), 1), curv_v);
+    __m128i g = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(est_h, est_v), _mm_set1_epi16(4)), 3);
+
+    g = _uvc_select_ssse3(_mm_cmpgt_epi16(grad_h, grad_v),
+                          _mm_srai_epi16(_mm_add_epi16(est_v, _mm_set1_epi16(2)), 2), g);
+    g = _uvc_select_ssse3(_mm_cmplt_epi16(grad_h, grad_v),
+                          _mm_srai_epi16(_mm_add_epi16(est_h, _mm_set1_epi16(2)), 2), g);
+    g = _uvc_select_ssse3(site, g, c);
+    _mm_storel_epi64((__m128i *) (green + x), _mm_packus_epi16(g, g));
+  }
+
+  return x;
+}
+
+static UVC_SSSE3 size_t _uvc_bayer_edge_aware_ssse3(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *g_above, const uint8_t *g_row,
+    const uint8_t *g_below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi16(255);
+  const __m128i site = UVC_BAYER_SITE_SSSE3(color_x);
+
+/* Colour minus green */
+#define UVC_BAYER_DIFF(p, gp, offset) _mm_sub_epi16(UVC_BAYER_LOAD(p, offset), \
+                                                    UVC_BAYER_LOAD(gp, offset))
+
+  /* 8 pixels at a time, reading one column either side */
+  for (; x + 9 <= width; x += 8) {
+    __m128i g = UVC_BAYER_LOAD(g_row, 0);
+    __m128i h = _mm_add_epi16(UVC_BAYER_DIFF(row, g_row, -1), UVC_BAYER_DIFF(row, g_row, 1));
+    __m128i v = _mm_add_epi16(UVC_BAYER_DIFF(above, g_above, 0),
+                              UVC_BAYER_DIFF(below, g_below, 0));
+    __m128i d = _mm_add_epi16(_mm_add_epi16(UVC_BAYER_DIFF(above, g_above, -1),
+                                            UVC_BAYER_DIFF(above, g_above, 1)),
+                              _mm_add_epi16(UVC_BAYER_DIFF(below, g_below, -1),
+                                            UVC_BAYER_DIFF(below, g_below, 1)));
+    __m128i h2 = _mm_srai_epi16(_mm_add_epi16(h, _mm_set1_epi16(1)), 1);
+    __m128i v2 = _mm_srai_epi16(_mm_add_epi16(v, _mm_set1_epi16(1)), 1);
+    __m128i d4 = _mm_srai_epi16(_mm_add_epi16(d, _mm_set1_epi16(2)), 2);
+    __m128i own = _uvc_select_ssse3(site, UVC_BAYER_LOAD(row, 0), _mm_add_epi16(g, h2));
+    __m128i other = _mm_add_epi16(g, _uvc_select_ssse3(site, d4, v2));
+
+    own = _mm_min_epi16(_mm_max_epi16(own, zero), max);
+    other = _mm_min_epi16(_mm_max_epi16(other, zero), max);
+    _uvc_bayer_store_ssse3(red_row ? own : other, g, red_row ? other : own, out, x, format);
+  }
+
+#undef UVC_BAYER_DIFF
+
+  return x;
+}
+
+#undef UVC_BAYER_LOAD
+
+#endif /* UVC_SIMD_X86 */
+
+#ifdef UVC_SIMD_NEON
+
+/* NEON loaders fetch 16 pixels: 16-bit luma of the even and odd pixels, and
+ * the 16-bit U and V they share */
+static inline void _uvc_load_YUYV_neon(const uint8_t *in, const uint8_t *uv_in,
+    int16x8_t *y0, int16x8_t *y1, int16x8_t *u, int16x8_t *v) {
+  uint8x8x4_t x = vld4_u8(in);
+  *y0 = vreinterpretq_s16_u16(vmovl_u8(x.val[0]));
+  *u = vreinterpretq_s16_u16(vmovl_u8(x.val[1]));
+  *y1 = vreinterpretq_s16_u16(vmovl_u8(x.val[2]));
+  *v = vreinterpretq_s16_u16(vmovl_u8(x.val[3]));
+}
+
+static inline void _uvc_load_UYVY_neon(const uint8_t *in, const uint8_t *uv_in,
+    int16x8_t *y0, int16x8_t *y1, int16x8_t *u, int16x8_t *v) {
+  uint8x8x4_t x = vld4_u8(in);
+  *u = vreinterpretq_s16_u16(vmovl_u8(x.val[0]));
+  *y0 = vreinterpretq_s16_u16(vmovl_u8(x.val[1]));
+  *v = vreinterpretq_s16_u16(vmovl_u8(x.val[2]));
+  *y1 = vreinterpretq_s16_u16(vmovl_u8(x.val[3]));
+}
+
+static inline void _uvc_load_NV12_neon(const uint8_t *in, const uint8_t *uv_in,
+    int16x8_t *y0, int16x8_t *y1, int16x8_t *u, int16x8_t *v) {
+  uint8x8x2_t y = vld2_u8(in);
+  uint8x8x2_t uv = vld2_u8(uv_in);
+  *y0 = vreinterpretq_s16_u16(vmovl_u8(y.val[0]));
+  *y1 = vreinterpretq_s16_u16(vmovl_u8(y.val[1]));
+  *u = vreinterpretq_s16_u16(vmovl_u8(uv.val[0]));
+  *v = vreinterpretq_s16_u16(vmovl_u8(uv.val[1]));
+}
+
+static inline void _uvc_load_P010_neon(const uint8_t *in, const uint8_t *uv_in,
+    int16x8_t *y0, int16x8_t *y1, int16x8_t *u, int16x8_t *v) {
+  uint16x8x2_t y = vld2q_u16((const uint16_t *) in);
+  uint16x8x2_t uv = vld2q_u16((const uint16_t *) uv_in);
+  *y0 = vreinterpretq_s16_u16(vshrq_n_u16(y.val[0], 8));
+  *y1 = vreinterpretq_s16_u16(vshrq_n_u16(y.val[1], 8));
+  *u = vreinterpretq_s16_u16(vshrq_n_u16(uv.val[0], 8));
+  *v = vreinterpretq_s16_u16(vshrq_n_u16(uv.val[1], 8));
+}
+
+/** @internal
+ * @brief Add a chroma term, (c * uv) >> 14 as in the scalar code, to luma
+ */
+static inline int16x8_t _uvc_neon_add_chroma(int16x8_t y, int32x4_t lo, int32x4_t hi) {
+  return vaddq_s16(y, vcombine_s16(vshrn_n_s32(lo, 14), vshrn_n_s32(hi, 14)));
+}
+
+/** @internal
+ * @brief Scale luma, (y_mul * (y - y_off)) >> 14 as in the scalar code
+ */
+static inline int16x8_t _uvc_neon_luma(int16x8_t y, const struct uvc_yuv_coefs *c) {
+  y = vsubq_s16(y, vdupq_n_s16(c->y_off));
+  return vcombine_s16(vshrn_n_s32(vmull_n_s16(vget_low_s16(y), c->y_mul), 14),
+                      vshrn_n_s32(vmull_n_s16(vget_high_s16(y), c->y_mul), 14));
+}
+
+/** @internal
+ * @brief Convert 16 pixels
+ */
+static inline void _uvc_yuv_neon_store(int16x8_t y0, int16x8_t y1, int16x8_t u, int16x8_t v,
+    uint8_t *out, int bgr, const struct uvc_yuv_coefs *c) {
+  int32x4_t r_lo, r_hi, g_lo, g_hi, b_lo, b_hi;
+  uint8x8x2_t r, g, b;
+  uint8x16x3_t px;
+
+  u = vsubq_s16(u, vdupq_n_s16(128));
+  v = vsubq_s16(v, vdupq_n_s16(128));
+  y0 = _uvc_neon_luma(y0, c);
+  y1 = _uvc_neon_luma(y1, c);
+
+  r_lo = vmull_n_s16(vget_low_s16(v), c->rv);
+  r_hi = vmull_n_s16(vget_high_s16(v), c->rv);
+  g_lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(u), c->gu), vget_low_s16(v), c->gv);
+  g_hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(u), c->gu), vget_high_s16(v), c->gv);
+  b_lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(u), c->bu - 16384), vget_low_s16(u), 16384);
+  b_hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(u), c->bu - 16384), vget_high_s16(u), 16384);
+
+  /* even and odd pixels, then interleaved */
+  r = vzip_u8(vqmovun_s16(_uvc_neon_add_chroma(y0, r_lo, r_hi)),
+              vqmovun_s16(_uvc_neon_add_chroma(y1, r_lo, r_hi)));
+  g = vzip_u8(vqmovun_s16(_uvc_neon_add_chroma(y0, g_lo, g_hi)),
+              vqmovun_s16(_uvc_neon_add_chroma(y1, g_lo, g_hi)));
+  b = vzip_u8(vqmovun_s16(_uvc_neon_add_chroma(y0, b_lo, b_hi)),
+              vqmovun_s16(_uvc_neon_add_chroma(y1, b_lo, b_hi)));
+
+  px.val[0] = bgr ? vcombine_u8(b.val[0], b.val[1]) : vcombine_u8(r.val[0], r.val[1]);
+  px.val[1] = vcombine_u8(g.val[0], g.val[1]);
+  px.val[2] = bgr ? vcombine_u8(r.val[0], r.val[1]) : vcombine_u8(b.val[0], b.val[1]);
+  vst3q_u8(out, px);
+}
+
+#define _uvc_yuv_neon_block(load, in, uv_in, out, bgr, c) { \
+    int16x8_t y0, y1, u, v; \
+    load(in, uv_in, &y0, &y1, &u, &v); \
+    _uvc_yuv_neon_store(y0, y1, u, v, out, bgr, c); \
+  }
+
+UVC_YUV_KERNELS(neon, , _uvc_yuv_neon_block, 16)
+
+static const uint16_t bayer_even_lanes[8] = { 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 };
+
+/* Lanes holding the row's red or blue samples */
+#define UVC_BAYER_SITE_NEON(color_x) \
+  ((color_x) ? vmvnq_u16(vld1q_u16(bayer_even_lanes)) : vld1q_u16(bayer_even_lanes))
+
+#define UVC_BAYER_LOAD(p, offset) vmovl_u8(vld1_u8((p) + x + (offset)))
+#define UVC_BAYER_LOAD_S16(p, offset) vreinterpretq_s16_u16(UVC_BAYER_LOAD(p, offset))
+
+/* Stores 8 demosaiced pixels from 16-bit channels in the range 0 to 255 */
+static inline void _uvc_bayer_store_neon(uint16x8_t red, uint16x8_t g, uint16x8_t blue,
+    uint8_t *out, size_t x, enum uvc_frame_format format) {
+  if (format == UVC_FRAME_FORMAT_GRAY8) {
+    uint16x8_t y = vmlaq_n_u16(vmulq_n_u16(red, 77), g, 150);
+    y = vmlaq_n_u16(y, blue, 29);
+    vst1_u8(out + x, vmovn_u16(vshrq_n_u16(vaddq_u16(y, vdupq_n_u16(128)), 8)));
+  } else {
+    uint8x8x3_t px;
+
+    px.val[0] = vmovn_u16(format == UVC_FRAME_FORMAT_BGR ? blue : red);
+    px.val[1] = vmovn_u16(g);
+    px.val[2] = vmovn_u16(format == UVC_FRAME_FORMAT_BGR ? red : blue);
+    vst3_u8(out + 3 * x, px);
+  }
+}
+
+static size_t _uvc_bayer_bilinear_neon(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format) {
+  const uint16x8_t site = UVC_BAYER_SITE_NEON(color_x);
+
+  /* 8 pixels at a time, reading one column either side */
+  for (; x + 9 <= width; x += 8) {
+    uint16x8_t c = UVC_BAYER_LOAD(row, 0);
+    uint16x8_t h = vaddq_u16(UVC_BAYER_LOAD(row, -1), UVC_BAYER_LOAD(row, 1));
+    uint16x8_t v = vaddq_u16(UVC_BAYER_LOAD(above, 0), UVC_BAYER_LOAD(below, 0));
+    uint16x8_t d = vaddq_u16(vaddq_u16(UVC_BAYER_LOAD(above, -1), UVC_BAYER_LOAD(above, 1)),
+                             vaddq_u16(UVC_BAYER_LOAD(below, -1), UVC_BAYER_LOAD(below, 1)));
+    uint16x8_t h2 = vshrq_n_u16(vaddq_u16(h, vdupq_n_u16(1)), 1);
+    uint16x8_t v2 = vshrq_n_u16(vaddq_u16(v, vdupq_n_u16(1)), 1);
+    uint16x8_t hv4 = vshrq_n_u16(vaddq_u16(vaddq_u16(h, v), vdupq_n_u16(2)), 2);
+    uint16x8_t d4 = vshrq_n_u16(vaddq_u16(d, vdupq_n_u16(2)), 2);
+    uint16x8_t own = vbslq_u16(site, c, h2);
+    uint16x8_t g = vbslq_u16(site, hv4, c);
+    uint16x8_t other = vbslq_u16(site, d4, v2);
+
+    _uvc_bayer_store_neon(red_row ? own : other, g, red_row ? other : own, out, x, format);
+  }
+
+  return x;
+}
+
+static size_t _uvc_bayer_green_neon(const uint8_t *above2, const uint8_t *above,
+    const uint8_t *row, const uint8_t *below, const uint8_t *below2, uint8_t *green,
+    size_t x, size_t width, unsigned int color_x) {
+  const uint16x8_t site = UVC_BAYER_SITE_NEON(color_x);
+
+  /* 8 pixels at a time, reading two columns either side */
+  for (; x + 10 <= width; x += 8) {
+    int16x8_t c = UVC_BAYER_LOAD_S16(row, 0);
+    int16x8_t l = UVC_BAYER_LOAD_S16(row, -1), r = UVC_BAYER_LOAD_S16(row, 1);
+    int16x8_t u = UVC_BAYER_LOAD_S16(above, 0), d = UVC_BAYER_LOAD_S16(below, 0);
+    int16x8_t c2 = vaddq_s16(c, c);
+    int16x8_t curv_h = vsubq_s16(c2, vaddq_s16(UVC_BAYER_LOAD_S16(row, -2),
+                                               UVC_BAYER_LOAD_S16(row, 2)));
+    int16x8_t curv_v = vsubq_s16(c2, vaddq_s16(UVC_BAYER_LOAD_S16(above2, 0),
+                                               UVC_BAYER_LOAD_S16(below2, 0)));
+    int16x8_t grad_h = vaddq_s16(vabdq_s16(l, r), vabsq_s16(curv_h));
+    int16x8_t grad_v = vaddq_s16(vabdq_s16(u, d), vabsq_s16(curv_v));
+    /* four times the estimates, which may be negative */
+    int16x8_t est_h = vaddq_s16(vshlq_n_s16(vaddq_s16(l, r), 1), curv_h);
+    int16x8_t est_v = vaddq_s16(vshlq_n_s16(vaddq_s16(u, d), 1), curv_v);
+    int16x8_t g = vshrq_n_s16(vaddq_s16(vaddq_s16(est_h, est_v), vdupq_n_s16(4)), 3);
+
+    g = vbslq_s16(vcgtq_s16(grad_h, grad_v),
+                  vshrq_n_s16(vaddq_s16(est_v, vdupq_n_s16(2)), 2), g);
+    g = vbslq_s16(vcltq_s16(grad_h, grad_v),
+                  vshrq_n_s16(vaddq_s16(est_h, vdupq_n_s16(2)), 2), g);
+    g = vbslq_s16(site, g, c);
+    vst1_u8(green + x, vqmovun_s16(g));
+  }
+
+  return x;
+}
+
+static size_t _uvc_bayer_edge_aware_neon(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *g_above, const uint8_t *g_row,
+    const uint8_t *g_below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format) {
+  const uint16x8_t site = UVC_BAYER_SITE_NEON(color_x);
+
+/* Colour minus green */
+#define UVC_BAYER_DIFF(p, gp, offset) vsubq_s16(UVC_BAYER_LOAD_S16(p, offset), \
+                                                UVC_BAYER_LOAD_S16(gp, offset))
+
+  /* 8 pixels at a time, reading one column either side */
+  for (; x + 9 <= width; x += 8) {
+    int16x8_t g = UVC_BAYER_LOAD_S16(g_row, 0);
+    int16x8_t h = vaddq_s16(UVC_BAYER_DIFF(row, g_row, -1), UVC_BAYER_DIFF(row, g_row, 1));
+    int16x8_t v = vaddq_s16(UVC_BAYER_DIFF(above, g_above, 0),
+                            UVC_BAYER_DIFF(below, g_below, 0));
+    int16x8_t d = vaddq_s16(vaddq_s16(UVC_BAYER_DIFF(above, g_above, -1),
+                                      UVC_BAYER_DIFF(above, g_above, 1)),
+                            vaddq_s16(UVC_BAYER_DIFF(below, g_below, -1),
+                                      UVC_BAYER_DIFF(below, g_below, 1)));
+    int16x8_t h2 = vshrq_n_s16(vaddq_s16(h, vdupq_n_s16(1)), 1);
+    int16x8_t v2 = vshrq_n_s16(vaddq_s16(v, vdupq_n_s16(1)), 1);
+    int16x8_t d4 = vshrq_n_s16(vaddq_s16(d, vdupq_n_s16(2)), 2);
+    int16x8_t own = vbslq_s16(site, UVC_BAYER_LOAD_S16(row, 0), vaddq_s16(g, h2));
+    int16x8_t other = vaddq_s16(g, vbslq_s16(site, d4, v2));
+    /* clamp to 0 to 255 */
+    uint16x8_t own8 = vmovl_u8(vqmovun_s16(own));
+    uint16x8_t other8 = vmovl_u8(vqmovun_s16(other));
+
+    _uvc_bayer_store_neon(red_row ? own8 : other8, vreinterpretq_u16_s16(g),
+                          red_row ? other8 : own8, out, x, format);
+  }
+
+#undef UVC_BAYER_DIFF
+
+  return x;
+}
+
+#undef UVC_BAYER_LOAD_S16
+#undef UVC_BAYER_LOAD
+
+#endif /* UVC_SIMD_NEON */
+
+#if defined(UVC_SIMD_X86) || defined(UVC_SIMD_NEON)
+#define UVC_BAYER_USE_KERNELS(isa) { \
+    bayer_kernel = _uvc_bayer_bilinear_##isa; \
+    bayer_green_kernel = _uvc_bayer_green_##isa; \
+    bayer_edge_aware_kernel = _uvc_bayer_edge_aware_##isa; \
+  }
+#endif
+
+/** @internal
+ * @brief Pick the kernels for this CPU
+ */
+static void _uvc_simd_init_kernels(void) {
+#if defined(UVC_SIMD_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    UVC_YUV_USE_KERNELS(avx2, 16)
+  else if (__builtin_cpu_supports("ssse3"))
+    UVC_YUV_USE_KERNELS(ssse3, 8)
+  else if (__builtin_cpu_supports("sse2"))
+    UVC_YUV_USE_KERNELS(sse2, 8)
+
+  if (__builtin_cpu_supports("ssse3"))
+    UVC_BAYER_USE_KERNELS(ssse3)
+#elif defined(UVC_SIMD_NEON)
+  UVC_YUV_USE_KERNELS(neon, 16)
+  UVC_BAYER_USE_KERNELS(neon)
+#endif
+}
+
+/** @internal
+ * @brief Force a particular set of YUV and Bayer kernels
+ *
+ * For comparing kernels against each other and the scalar code; not safe
+ * while conversions are running. The Bayer kernels need SSSE3, so "sse2"
+ * demosaics with the scalar code.
+ *
+ * @param isa "scalar" to convert without SIMD, or "sse2", "ssse3", "avx2"
+ * or "neon"
+ * @return UVC_ERROR_NOT_SUPPORTED if the kernels weren't built or the CPU
+ * can't run them
+ */
+uvc_error_t _uvc_simd_use_kernels(const char *isa) {
+  pthread_once(&kernels_once, _uvc_simd_init_kernels);
+
+  if (!strcmp(isa, "scalar")) {
+    memset(kernels, 0, sizeof(kernels));
+    bayer_kernel = NULL;
+    bayer_green_kernel = NULL;
+    bayer_edge_aware_kernel = NULL;
+    return UVC_SUCCESS;
+  }
+
+#if defined(UVC_SIMD_X86)
+  if (!strcmp(isa, "avx2") && __builtin_cpu_supports("avx2")) {
+    UVC_YUV_USE_KERNELS(avx2, 16)
+    UVC_BAYER_USE_KERNELS(ssse3)
+    return UVC_SUCCESS;
+  }
+  if (!strcmp(isa, "ssse3") && __builtin_cpu_supports("ssse3")) {
+    UVC_YUV_USE_KERNELS(ssse3, 8)
+    UVC_BAYER_USE_KERNELS(ssse3)
+    return UVC_SUCCESS;
+  }
+  if (!strcmp(isa, "sse2") && __builtin_cpu_supports("sse2")) {
+    UVC_YUV_USE_KERNELS(sse2, 8)
+    bayer_kernel = NULL;
+    bayer_green_kernel = NULL;
+    bayer_edge_aware_kernel = NULL;
+    return UVC_SUCCESS;
+  }
+#elif defined(UVC_SIMD_NEON)
+  if (!strcmp(isa, "neon")) {
+    UVC_YUV_USE_KERNELS(neon, 16)
+    UVC_BAYER_USE_KERNELS(neon)
+    return UVC_SUCCESS;
+  }
+#endif
+
+  return UVC_ERROR_NOT_SUPPORTED;
+}
+
+/** @internal
+ * @brief Convert the leading pixels of a row of YUV pixels with SIMD
+ *
+ * @param conv Conversion to perform
+ * @param coefs Coefficients for the frame's colorimetry
+ * @param in Input pixels, or luma for semi-planar formats
+ * @param uv Chroma for semi-planar formats, NULL for packed formats
+ * @param out Output pixels
+ * @param pixels Number of pixels available
+ * @return Number of pixels converted, which may be zero; the caller converts
+ * the rest
+ */
+size_t _uvc_yuv_rgb_simd(enum uvc_yuv_conv conv, const struct uvc_yuv_coefs *coefs,
+    const uint8_t *in, const uint8_t *uv, uint8_t *out, size_t pixels) {
+  size_t blocks;
+
+  pthread_once(&kernels_once, _uvc_simd_init_kernels);
+
+  if (!kernels[conv])
+    return 0;
+
+  if (!uv)
+    uv = in;
+
+  blocks = pixels / kernel_block_pixels;
+  if (blocks)
+    kernels[conv](in, uv, out, blocks, coefs);
+
+  return blocks * kernel_block_pixels;
+}
+
+/** @internal
+ * @brief Demosaic the interior of a row bilinearly with SIMD
+ *
+ * Matches the scalar code in _uvc_demosaic_bilinear_row().
+ *
+ * @param above Row above, reflected at the top edge
+ * @param row Row to demosaic
+ * @param below Row below, reflected at the bottom edge
+ * @param out Start of the output row
+ * @param x First column to demosaic; must be even and at least 1
+ * @param width Width of the rows
+ * @param red_row Whether the row holds red rather than blue samples
+ * @param color_x Parity of the columns that hold red or blue
+ * @param format Output format: RGB, BGR or GRAY8
+ * @return Column at which the caller should carry on
+ */
+size_t _uvc_bayer_bilinear_simd(const uint8_t *above, const uint8_t *row, const uint8_t *below,
+    uint8_t *out, size_t x, size_t width, int red_row, unsigned int color_x,
+    enum uvc_frame_format format) {
+  pthread_once(&kernels_once, _uvc_simd_init_kernels);
+
+  if (!bayer_kernel)
+    return x;
+
+  return bayer_kernel(above, row, below, out, x, width, red_row, color_x, format);
+}
+
+/** @internal
+ * @brief Interpolate green for the interior of a row with SIMD
+ *
+ * Matches the scalar code in _uvc_demosaic_green_row().
+ *
+ * @param above2 Row two above, reflected at the top edge
+ * @param above Row above
+ * @param row Row to interpolate
+ * @param below Row below
+ * @param below2 Row two below, reflected at the bottom edge
+ * @param green Green for each column of the row
+ * @param x First column to interpolate; must be even and at least 2
+ * @param width Width of the rows
+ * @param color_x Parity of the columns that hold red or blue
+ * @return Column at which the caller should carry on
+ */
+size_t _uvc_bayer_green_simd(const uint8_t *above2, const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *below2, uint8_t *green, size_t x, size_t width,
+    unsigned int color_x) {
+  pthread_once(&kernels_once, _uvc_simd_init_kernels);
+
+  if (!bayer_green_kernel)
+    return x;
+
+  return bayer_green_kernel(above2, above, row, below, below2, green, x, width, color_x);
+}
+
+/** @internal
+ * @brief Interpolate red and blue for the interior of a row with SIMD
+ *
+ * Matches the scalar code in _uvc_demosaic_edge_aware_row().
+ *
+ * @param above Row above, reflected at the top edge
+ * @param row Row to demosaic
+ * @param below Row below, reflected at the bottom edge
+ * @param g_above Green for the row above
+ * @param g_row Green for the row
+ * @param g_below Green for the row below
+ * @param out Start of the output row
+ * @param x First column to demosaic; must be even and at least 1
+ * @param width Width of the rows
+ * @param red_row Whether the row holds red rather than blue samples
+ * @param color_x Parity of the columns that hold red or blue
+ * @param format Output format: RGB, BGR or GRAY8
+ * @return Column at which the caller should carry on
+ */
+size_t _uvc_bayer_edge_aware_simd(const uint8_t *above, const uint8_t *row,
+    const uint8_t *below, const uint8_t *g_above, const uint8_t *g_row,
+    const uint8_t *g_below, uint8_t *out, size_t x, size_t width, int red_row,
+    unsigned int color_x, enum uvc_frame_format format) {
+  pthread_once(&kernels_once, _uvc_simd_init_kernels);
+
+  if (!bayer_edge_aware_kernel)
+    return x;
+
+  return bayer_edge_aware_kernel(above, row, below, g_above, g_row, g_below, out, x, width,
+                                 red_row, color_x, format);
+}
@@ -38,15 +38,29 @@
 #include "libuvc/libuvc.h"
 #include "libuvc/libuvc_internal.h"
 
-/** @internal */
+/** @internal
+ * @brief Make sure a frame can hold need_bytes of data
+ *
+ * Library-owned buffers only ever grow, so a frame that is reused for
+ * frames of varying size settles at the largest one. Buffers from a frame
+ * pool can't grow at all.
+ */
 uvc_error_t uvc_ensure_frame_size(uvc_frame_t *frame, size_t need_bytes) {
   if (frame->library_owns_data) {
-    if (!frame->data || frame->data_bytes != need_bytes) {
-      frame->data_bytes = need_bytes;
-      frame->data = realloc(frame->data, frame->data_bytes);
+    if (!frame->data || frame->data_capacity < need_bytes) {
+      void *data;
+
+      if (frame->pool)
+        return UVC_ERROR_NO_MEM;
+
+      data = realloc(frame->data, need_bytes);
+      if (!data)
+        return UVC_ERROR_NO_MEM;
+
+      frame->data = data;
+      frame->data_capacity = need_bytes;
     }
-    if (!frame->data)
-      return UVC_ERROR_NO_MEM;
+    frame->data_bytes = need_bytes;
     return UVC_SUCCESS;
   } else {
     if (!frame->data || frame->data_bytes < need_bytes)
@@ -55,6 +69,32 @@ uvc_error_t uvc_ensure_frame_size(uvc_frame_t *frame, size_t need_bytes) {
   }
 }
 
+/** @internal
+ * @brief Make room for a conversion's output of width x height pixels
+ *
+ * A buffer supplied by the caller keeps its step if that is wide enough, so
+ * frames can be converted straight into buffers with padded rows or into
+ * part of a larger image. Buffers owned by the library are tightly packed.
+ * Sets the frame's width, height and step.
+ */
+uvc_error_t _uvc_ensure_frame_rows(uvc_frame_t *out, uint32_t width, uint32_t height,
+    size_t pixel_bytes) {
+  size_t row_bytes = width * pixel_bytes;
+  size_t step = row_bytes;
+
+  if (!out->library_owns_data && out->step > row_bytes)
+    step = out->step;
+
+  /* the last row needs no padding */
+  if (uvc_ensure_frame_size(out, height ? step * (height - 1) + row_bytes : 0) < 0)
+    return UVC_ERROR_NO_MEM;
+
+  out->width = width;
+  out->height = height;
+  out->step = step;
+  return UVC_SUCCESS;
+}
+
 /** @brief Allocate a frame structure
  * @ingroup frame
  *
@@ -73,6 +113,7 @@ uvc_frame_t *uvc_allocate_frame(size_t data_bytes) {
 
   if (data_bytes > 0) {
     frame->data_bytes = data_bytes;
+    frame->data_capacity = data_bytes;
     frame->data = malloc(data_bytes);
 
     if (!frame->data) {
@@ -87,12 +128,20 @@ uvc_frame_t *uvc_allocate_frame(size_t data_bytes) {
 /** @brief Free a frame structure
  * @ingroup frame
  *
+ * Frames that came from a frame pool are returned to it, as with
+ * uvc_frame_pool_put().
+ *
  * @param frame Frame to destroy
  */
 void uvc_free_frame(uvc_frame_t *frame) {
+  if (frame->pool) {
+    uvc_frame_pool_put(frame);
+    return;
+  }
+
   if (frame->library_owns_data)
   {
-    if (frame->data_bytes > 0)
+    if (frame->data)
       free(frame->data);
     if (frame->metadata_bytes > 0)
       free(frame->metadata);
@@ -112,6 +161,10 @@ static inline unsigned char sat(int i) {
  * @param out Duplicate frame
  */
 uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out) {
+  /* pool frames have a fixed metadata buffer, as large as a stream's */
+  if (out->pool && in->metadata && in->metadata_bytes > LIBUVC_XFER_META_BUF_SIZE)
+    return UVC_ERROR_NO_MEM;
+
   if (uvc_ensure_frame_size(out, in->data_bytes) < 0)
     return UVC_ERROR_NO_MEM;
 
@@ -123,12 +176,14 @@ uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out) {
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
+  out->color_matrix = in->color_matrix;
+  out->color_range = in->color_range;
 
   memcpy(out->data, in->data, in->data_bytes);
 
   if (in->metadata && in->metadata_bytes > 0)
   {
-      if (out->metadata_bytes < in->metadata_bytes)
+      if (!out->pool && out->metadata_bytes < in->metadata_bytes)
       {
           out->metadata = realloc(out->metadata, in->metadata_bytes);
       }
@@ -150,71 +205,170 @@ uvc_error_t uvc_duplicate_frame(uvc_frame_t *in, uvc_frame_t *out) {
     (prgb)[4] = sat(pyuv[2] + g); \
     (prgb)[5] = sat(pyuv[2] + b); \
     }
-#define IYUYV2RGB_2(pyuv, prgb) { \
-    int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
-    (prgb)[0] = sat(*(pyuv) + r); \
-    (prgb)[1] = sat(*(pyuv) + g); \
-    (prgb)[2] = sat(*(pyuv) + b); \
-    (prgb)[3] = sat((pyuv)[2] + r); \
-    (prgb)[4] = sat((pyuv)[2] + g); \
-    (prgb)[5] = sat((pyuv)[2] + b); \
-    }
-#define IYUYV2RGB_16(pyuv, prgb) IYUYV2RGB_8(pyuv, prgb); IYUYV2RGB_8(pyuv + 16, prgb + 24);
-#define IYUYV2RGB_8(pyuv, prgb) IYUYV2RGB_4(pyuv, prgb); IYUYV2RGB_4(pyuv + 8, prgb + 12);
-#define IYUYV2RGB_4(pyuv, prgb) IYUYV2RGB_2(pyuv, prgb); IYUYV2RGB_2(pyuv + 4, prgb + 6);
+/* YUV to RGB coefficients, by matrix and range. Full-range BT.601 keeps the
+ * coefficients libuvc has always used. */
+static const struct uvc_yuv_coefs yuv_coefs[3][2] = {
+  { { 16384, 0, 22987, -5636, -11698, 29049 }, { 19077, 16, 26149, -6419, -13320, 33050 } },
+  { { 16384, 0, 25802, -3069, -7670, 30402 }, { 19077, 16, 29372, -3494, -8731, 34610 } },
+  { { 16384, 0, 24160, -2696, -9361, 30825 }, { 19077, 16, 27503, -3069, -10657, 35091 } },
+};
+
+/** @internal
+ * @brief Look up the YUV to RGB coefficients for a frame's colorimetry
+ *
+ * Each channel is computed as
+ * sat(((y_mul * (y - y_off)) >> 14) + ((c_u * (u - 128) + c_v * (v - 128)) >> 14)),
+ * which for full-range frames reduces to adding the chroma term to y.
+ */
+const struct uvc_yuv_coefs *_uvc_yuv_coefs(const uvc_frame_t *frame) {
+  unsigned int matrix = frame->color_matrix;
+  unsigned int range = frame->color_range;
 
-/** @brief Convert a frame from YUYV to RGB
- * @ingroup frame
+  if (matrix > UVC_COLOR_MATRIX_BT2020)
+    matrix = UVC_COLOR_MATRIX_BT601;
+  if (range > UVC_COLOR_RANGE_LIMITED)
+    range = UVC_COLOR_RANGE_FULL;
+
+  return &yuv_coefs[matrix][range];
+}
+
+#define IYUV_LUMA(y, c) (((c).y_mul * ((y) - (c).y_off)) >> 14)
+#define IYUV2RGB_2(y0, y1, u, v, prgb, c) { \
+    int r = ((c).rv * ((v) - 128)) >> 14; \
+    int g = ((c).gu * ((u) - 128) + (c).gv * ((v) - 128)) >> 14; \
+    int b = ((c).bu * ((u) - 128)) >> 14; \
+    int l0 = IYUV_LUMA(y0, c); \
+    int l1 = IYUV_LUMA(y1, c); \
+    (prgb)[0] = sat(l0 + r); \
+    (prgb)[1] = sat(l0 + g); \
+    (prgb)[2] = sat(l0 + b); \
+    (prgb)[3] = sat(l1 + r); \
+    (prgb)[4] = sat(l1 + g); \
+    (prgb)[5] = sat(l1 + b); \
+    }
+#define IYUV2BGR_2(y0, y1, u, v, pbgr, c) { \
+    int r = ((c).rv * ((v) - 128)) >> 14; \
+    int g = ((c).gu * ((u) - 128) + (c).gv * ((v) - 128)) >> 14; \
+    int b = ((c).bu * ((u) - 128)) >> 14; \
+    int l0 = IYUV_LUMA(y0, c); \
+    int l1 = IYUV_LUMA(y1, c); \
+    (pbgr)[0] = sat(l0 + b); \
+    (pbgr)[1] = sat(l0 + g); \
+    (pbgr)[2] = sat(l0 + r); \
+    (pbgr)[3] = sat(l1 + b); \
+    (pbgr)[4] = sat(l1 + g); \
+    (pbgr)[5] = sat(l1 + r); \
+    }
+#define IYUYV2RGB_2(pyuv, prgb, c) \
+  IYUV2RGB_2((pyuv)[0], (pyuv)[2], (pyuv)[1], (pyuv)[3], prgb, c)
+#define IYUYV2RGB_16(pyuv, prgb, c) IYUYV2RGB_8(pyuv, prgb, c); IYUYV2RGB_8(pyuv + 16, prgb + 24, c);
+#define IYUYV2RGB_8(pyuv, prgb, c) IYUYV2RGB_4(pyuv, prgb, c); IYUYV2RGB_4(pyuv + 8, prgb + 12, c);
+#define IYUYV2RGB_4(pyuv, prgb, c) IYUYV2RGB_2(pyuv, prgb, c); IYUYV2RGB_2(pyuv + 4, prgb + 6, c);
+
+#define IYUYV2BGR_2(pyuv, pbgr, c) \
+  IYUV2BGR_2((pyuv)[0], (pyuv)[2], (pyuv)[1], (pyuv)[3], pbgr, c)
+#define IYUYV2BGR_16(pyuv, pbgr, c) IYUYV2BGR_8(pyuv, pbgr, c); IYUYV2BGR_8(pyuv + 16, pbgr + 24, c);
+#define IYUYV2BGR_8(pyuv, pbgr, c) IYUYV2BGR_4(pyuv, pbgr, c); IYUYV2BGR_4(pyuv + 8, pbgr + 12, c);
+#define IYUYV2BGR_4(pyuv, pbgr, c) IYUYV2BGR_2(pyuv, pbgr, c); IYUYV2BGR_2(pyuv + 4, pbgr + 6, c);
+
+#define IUYVY2RGB_2(pyuv, prgb, c) \
+  IYUV2RGB_2((pyuv)[1], (pyuv)[3], (pyuv)[0], (pyuv)[2], prgb, c)
+#define IUYVY2RGB_16(pyuv, prgb, c) IUYVY2RGB_8(pyuv, prgb, c); IUYVY2RGB_8(pyuv + 16, prgb + 24, c);
+#define IUYVY2RGB_8(pyuv, prgb, c) IUYVY2RGB_4(pyuv, prgb, c); IUYVY2RGB_4(pyuv + 8, prgb + 12, c);
+#define IUYVY2RGB_4(pyuv, prgb, c) IUYVY2RGB_2(pyuv, prgb, c); IUYVY2RGB_2(pyuv + 4, prgb + 6, c);
+
+#define IUYVY2BGR_2(pyuv, pbgr, c) \
+  IYUV2BGR_2((pyuv)[1], (pyuv)[3], (pyuv)[0], (pyuv)[2], pbgr, c)
+#define IUYVY2BGR_16(pyuv, pbgr, c) IUYVY2BGR_8(pyuv, pbgr, c); IUYVY2BGR_8(pyuv + 16, pbgr + 24, c);
+#define IUYVY2BGR_8(pyuv, pbgr, c) IUYVY2BGR_4(pyuv, pbgr, c); IUYVY2BGR_4(pyuv + 8, pbgr + 12, c);
+#define IUYVY2BGR_4(pyuv, pbgr, c) IUYVY2BGR_2(pyuv, pbgr, c); IUYVY2BGR_2(pyuv + 4, pbgr + 6, c);
+
+/** @internal
+ * @brief Convert a packed 4:2:2 frame (YUYV or UYVY) to RGB or BGR
  *
- * @param in YUYV frame
- * @param out RGB frame
+ * Each row is converted with SIMD as far as whole blocks go, and the rest of
+ * it with the scalar macros, so any even width and any input and output
+ * step work.
  */
-uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
+static uvc_error_t _uvc_yuv422_2rgb(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format in_format, enum uvc_frame_format out_format) {
+  const struct uvc_yuv_coefs c = *_uvc_yuv_coefs(in);
+  size_t in_step = in->step ? in->step : in->width * 2;
+  uint32_t width = in->width;
+  enum uvc_yuv_conv conv;
+  uint32_t row;
+
+  /* pixels share their chroma in pairs */
+  if (in->frame_format != in_format || width & 1)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (in->height && in->data_bytes < in_step * (in->height - 1) + width * 2)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
+  if (_uvc_ensure_frame_rows(out, width, in->height, 3) < 0)
     return UVC_ERROR_NO_MEM;
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_RGB;
-  out->step = in->width * 3;
+  out->frame_format = out_format;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *prgb = out->data;
-  uint8_t *prgb_end = prgb + out->data_bytes;
-
-  while (prgb < prgb_end) {
-    IYUYV2RGB_8(pyuv, prgb);
+  if (in_format == UVC_FRAME_FORMAT_YUYV)
+    conv = out_format == UVC_FRAME_FORMAT_RGB ? UVC_YUYV2RGB : UVC_YUYV2BGR;
+  else
+    conv = out_format == UVC_FRAME_FORMAT_RGB ? UVC_UYVY2RGB : UVC_UYVY2BGR;
+
+#define UVC_YUV422_ROW_TAIL(convert_8, convert_2) \
+  for (; x + 8 <= width; x += 8) { \
+    convert_8(pyuv, prgb, c); \
+    pyuv += 2 * 8; \
+    prgb += 3 * 8; \
+  } \
+  for (; x < width; x += 2) { \
+    convert_2(pyuv, prgb, c); \
+    pyuv += 2 * 2; \
+    prgb += 3 * 2; \
+  }
 
-    prgb += 3 * 8;
-    pyuv += 2 * 8;
+  for (row = 0; row < in->height; row++) {
+    uint8_t *pyuv = (uint8_t *) in->data + row * in_step;
+    uint8_t *prgb = (uint8_t *) out->data + row * out->step;
+    size_t x = _uvc_yuv_rgb_simd(conv, &c, pyuv, NULL, prgb, width);
+
+    pyuv += 2 * x;
+    prgb += 3 * x;
+
+    switch (conv) {
+    case UVC_YUYV2RGB:
+      UVC_YUV422_ROW_TAIL(IYUYV2RGB_8, IYUYV2RGB_2)
+      break;
+    case UVC_YUYV2BGR:
+      UVC_YUV422_ROW_TAIL(IYUYV2BGR_8, IYUYV2BGR_2)
+      break;
+    case UVC_UYVY2RGB:
+      UVC_YUV422_ROW_TAIL(IUYVY2RGB_8, IUYVY2RGB_2)
+      break;
+    default:
+      UVC_YUV422_ROW_TAIL(IUYVY2BGR_8, IUYVY2BGR_2)
+      break;
+    }
   }
 
+#undef UVC_YUV422_ROW_TAIL
+
   return UVC_SUCCESS;
 }
 
-#define IYUYV2BGR_2(pyuv, pbgr) { \
-    int r = (22987 * ((pyuv)[3] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[1] - 128) - 11698 * ((pyuv)[3] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[1] - 128)) >> 14; \
-    (pbgr)[0] = sat(*(pyuv) + b); \
-    (pbgr)[1] = sat(*(pyuv) + g); \
-    (pbgr)[2] = sat(*(pyuv) + r); \
-    (pbgr)[3] = sat((pyuv)[2] + b); \
-    (pbgr)[4] = sat((pyuv)[2] + g); \
-    (pbgr)[5] = sat((pyuv)[2] + r); \
-    }
-#define IYUYV2BGR_16(pyuv, pbgr) IYUYV2BGR_8(pyuv, pbgr); IYUYV2BGR_8(pyuv + 16, pbgr + 24);
-#define IYUYV2BGR_8(pyuv, pbgr) IYUYV2BGR_4(pyuv, pbgr); IYUYV2BGR_4(pyuv + 8, pbgr + 12);
-#define IYUYV2BGR_4(pyuv, pbgr) IYUYV2BGR_2(pyuv, pbgr); IYUYV2BGR_2(pyuv + 4, pbgr + 6);
+/** @brief Convert a frame from YUYV to RGB
+ * @ingroup frame
+ *
+ * @param in YUYV frame
+ * @param out RGB frame
+ */
+uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv422_2rgb(in, out, UVC_FRAME_FORMAT_YUYV, UVC_FRAME_FORMAT_RGB);
+}
 
 /** @brief Convert a frame from YUYV to BGR
  * @ingroup frame
@@ -223,39 +377,44 @@ uvc_error_t uvc_yuyv2rgb(uvc_frame_t *in, uvc_frame_t *out) {
  * @param out BGR frame
  */
 uvc_error_t uvc_yuyv2bgr(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv422_2rgb(in, out, UVC_FRAME_FORMAT_YUYV, UVC_FRAME_FORMAT_BGR);
+}
+
+/** @internal
+ * @brief Copy every other byte of a YUYV frame, i.e. its luma or its chroma
+ *
+ * @param offset 0 for luma, 1 for chroma
+ */
+static uvc_error_t _uvc_yuyv_extract(uvc_frame_t *in, uvc_frame_t *out, size_t offset) {
+  size_t in_step = in->step ? in->step : in->width * 2;
+  uint32_t row, x;
+
   if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
+  if (in->height && in->data_bytes < in_step * (in->height - 1) + in->width * 2)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (_uvc_ensure_frame_rows(out, in->width, in->height, 1) < 0)
     return UVC_ERROR_NO_MEM;
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_BGR;
-  out->step = in->width * 3;
+  out->frame_format = UVC_FRAME_FORMAT_GRAY8;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *pbgr = out->data;
-  uint8_t *pbgr_end = pbgr + out->data_bytes;
-
-  while (pbgr < pbgr_end) {
-    IYUYV2BGR_8(pyuv, pbgr);
+  for (row = 0; row < in->height; row++) {
+    const uint8_t *pyuv = (uint8_t *) in->data + row * in_step + offset;
+    uint8_t *py = (uint8_t *) out->data + row * out->step;
 
-    pbgr += 3 * 8;
-    pyuv += 2 * 8;
+    for (x = 0; x < in->width; x++)
+      py[x] = pyuv[2 * x];
   }
 
   return UVC_SUCCESS;
 }
 
-#define IYUYV2Y(pyuv, py) { \
-    (py)[0] = (pyuv[0]); \
-    }
-
 /** @brief Convert a frame from YUYV to Y (GRAY8)
  * @ingroup frame
  *
@@ -263,171 +422,820 @@ uvc_error_t uvc_yuyv2bgr(uvc_frame_t *in, uvc_frame_t *out) {
  * @param out GRAY8 frame
  */
 uvc_error_t uvc_yuyv2y(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
+  return _uvc_yuyv_extract(in, out, 0);
+}
+
+/** @brief Convert a frame from YUYV to UV (GRAY8)
+ * @ingroup frame
+ *
+ * @param in YUYV frame
+ * @param out GRAY8 frame
+ */
+uvc_error_t uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuyv_extract(in, out, 1);
+}
+
+/** @brief Convert a frame from UYVY to RGB
+ * @ingroup frame
+ * @param ini UYVY frame
+ * @param out RGB frame
+ */
+uvc_error_t uvc_uyvy2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv422_2rgb(in, out, UVC_FRAME_FORMAT_UYVY, UVC_FRAME_FORMAT_RGB);
+}
+
+/** @brief Convert a frame from UYVY to BGR
+ * @ingroup frame
+ * @param ini UYVY frame
+ * @param out BGR frame
+ */
+uvc_error_t uvc_uyvy2bgr(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv422_2rgb(in, out, UVC_FRAME_FORMAT_UYVY, UVC_FRAME_FORMAT_BGR);
+}
+
+/** @internal
+ * @brief Check a semi-planar 4:2:0 frame (NV12 or P010) and size an RGB or
+ * BGR frame for it
+ *
+ * @param roi Rectangle to convert, with even x and y, or NULL for the whole
+ * frame
+ */
+uvc_error_t _uvc_yuv420sp2rgb_prepare(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format out_format, const uvc_roi_t *roi) {
+  size_t sample_bytes = in->frame_format == UVC_FRAME_FORMAT_P010 ? 2 : 1;
+  size_t in_step = in->step ? in->step : in->width * sample_bytes;
+  uvc_roi_t full = { 0, 0, in->width, in->height };
+
+  if (!roi)
+    roi = &full;
+
+  /* pixels are converted in pairs sharing a chroma sample */
+  if (roi->width & 1)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height) < 0)
+  if (!in->height || in->data_bytes < in_step * (in->height + (in->height + 1) / 2 - 1)
+      + in->width * sample_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (_uvc_ensure_frame_rows(out, roi->width, roi->height, 3) < 0)
     return UVC_ERROR_NO_MEM;
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_GRAY8;
-  out->step = in->width;
+  out->frame_format = out_format;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *py = out->data;
-  uint8_t *py_end = py + out->data_bytes;
+  return UVC_SUCCESS;
+}
 
-  while (py < py_end) {
-    IYUYV2Y(pyuv, py);
+/** @internal
+ * @brief Convert rows of a semi-planar 4:2:0 frame to RGB or BGR
+ *
+ * The interleaved chroma plane follows height rows of luma, with the same
+ * step; luma row y takes its chroma from chroma row y / 2. P010 samples are
+ * 16-bit little-endian with 10 significant bits at the top; only the top 8
+ * are used. The output comes from _uvc_yuv420sp2rgb_prepare().
+ *
+ * @param roi Rectangle to convert, or NULL for the whole frame
+ * @param first First row of the rectangle to convert
+ * @param rows Number of rows to convert
+ */
+void _uvc_yuv420sp2rgb_rows(uvc_frame_t *in, uvc_frame_t *out, const uvc_roi_t *roi,
+    uint32_t first, uint32_t rows) {
+  size_t sample_bytes = in->frame_format == UVC_FRAME_FORMAT_P010 ? 2 : 1;
+  /* offset of the byte we use within each sample */
+  size_t msb = sample_bytes - 1;
+  size_t in_step = in->step ? in->step : in->width * sample_bytes;
+  enum uvc_frame_format out_format = out->frame_format;
+  enum uvc_yuv_conv conv;
+  const struct uvc_yuv_coefs c = *_uvc_yuv_coefs(in);
+  uvc_roi_t full = { 0, 0, in->width, in->height };
+  uint32_t row;
+
+  if (!roi)
+    roi = &full;
+
+  if (in->frame_format == UVC_FRAME_FORMAT_P010)
+    conv = out_format == UVC_FRAME_FORMAT_RGB ? UVC_P010_2RGB : UVC_P010_2BGR;
+  else
+    conv = out_format == UVC_FRAME_FORMAT_RGB ? UVC_NV12_2RGB : UVC_NV12_2BGR;
+
+  for (row = first; row < first + rows; row++) {
+    uint32_t in_row = roi->y + row;
+    uint8_t *py = (uint8_t *) in->data + in_row * in_step + roi->x * sample_bytes;
+    uint8_t *puv = (uint8_t *) in->data + (in->height + in_row / 2) * in_step
+        + roi->x * sample_bytes;
+    uint8_t *prgb = (uint8_t *) out->data + row * out->step;
+    size_t x = _uvc_yuv_rgb_simd(conv, &c, py, puv, prgb, roi->width);
+
+    py += x * sample_bytes;
+    puv += x * sample_bytes;
+    prgb += 3 * x;
+
+    for (; x + 1 < roi->width; x += 2) {
+      if (out_format == UVC_FRAME_FORMAT_RGB) {
+        IYUV2RGB_2(py[msb], py[sample_bytes + msb], puv[msb], puv[sample_bytes + msb], prgb, c);
+      } else {
+        IYUV2BGR_2(py[msb], py[sample_bytes + msb], puv[msb], puv[sample_bytes + msb], prgb, c);
+      }
 
-    py += 1;
-    pyuv += 2;
+      py += 2 * sample_bytes;
+      puv += 2 * sample_bytes;
+      prgb += 3 * 2;
+    }
   }
+}
 
+/** @internal
+ * @brief Convert a semi-planar 4:2:0 frame (NV12 or P010) to RGB or BGR
+ *
+ * @param roi Rectangle to convert, with even x and y, or NULL for the whole
+ * frame
+ */
+static uvc_error_t _uvc_yuv420sp2rgb(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format in_format, enum uvc_frame_format out_format,
+    const uvc_roi_t *roi) {
+  uvc_error_t ret;
+
+  if (in->frame_format != in_format)
+    return UVC_ERROR_INVALID_PARAM;
+
+  ret = _uvc_yuv420sp2rgb_prepare(in, out, out_format, roi);
+  if (ret != UVC_SUCCESS)
+    return ret;
+
+  _uvc_yuv420sp2rgb_rows(in, out, roi, 0, out->height);
   return UVC_SUCCESS;
 }
 
-#define IYUYV2UV(pyuv, puv) { \
-    (puv)[0] = (pyuv[1]); \
-    }
-
-/** @brief Convert a frame from YUYV to UV (GRAY8)
- * @ingroup frame
+/** @internal
+ * @brief Copy the luma plane of a semi-planar 4:2:0 frame
  *
- * @param in YUYV frame
- * @param out GRAY8 frame
+ * @param roi Rectangle to copy, or NULL for the whole frame
  */
-uvc_error_t uvc_yuyv2uv(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_YUYV)
+static uvc_error_t _uvc_yuv420sp2y(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format in_format, enum uvc_frame_format out_format,
+    const uvc_roi_t *roi) {
+  size_t sample_bytes = in_format == UVC_FRAME_FORMAT_P010 ? 2 : 1;
+  size_t in_step;
+  uvc_roi_t full = { 0, 0, in->width, in->height };
+  uint32_t row;
+
+  if (in->frame_format != in_format)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height) < 0)
+  if (!roi)
+    roi = &full;
+
+  in_step = in->step ? in->step : in->width * sample_bytes;
+  if (!in->height || in->data_bytes < in_step * (in->height - 1) + in->width * sample_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (_uvc_ensure_frame_rows(out, roi->width, roi->height, sample_bytes) < 0)
     return UVC_ERROR_NO_MEM;
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_GRAY8;
-  out->step = in->width;
+  out->frame_format = out_format;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *puv = out->data;
-  uint8_t *puv_end = puv + out->data_bytes;
+  for (row = 0; row < roi->height; row++)
+    memcpy((uint8_t *) out->data + row * out->step,
+           (uint8_t *) in->data + (roi->y + row) * in_step + roi->x * sample_bytes,
+           roi->width * sample_bytes);
+
+  return UVC_SUCCESS;
+}
+
+/** @brief Convert a frame from NV12 to RGB
+ * @ingroup frame
+ *
+ * @param in NV12 frame, of even width
+ * @param out RGB frame
+ */
+uvc_error_t uvc_nv12_2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv420sp2rgb(in, out, UVC_FRAME_FORMAT_NV12, UVC_FRAME_FORMAT_RGB, NULL);
+}
+
+/** @brief Convert a frame from NV12 to BGR
+ * @ingroup frame
+ *
+ * @param in NV12 frame, of even width
+ * @param out BGR frame
+ */
+uvc_error_t uvc_nv12_2bgr(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv420sp2rgb(in, out, UVC_FRAME_FORMAT_NV12, UVC_FRAME_FORMAT_BGR, NULL);
+}
+
+/** @brief Convert a frame from NV12 to Y (GRAY8)
+ * @ingroup frame
+ *
+ * @param in NV12 frame
+ * @param out GRAY8 frame
+ */
+uvc_error_t uvc_nv12_2y(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv420sp2y(in, out, UVC_FRAME_FORMAT_NV12, UVC_FRAME_FORMAT_GRAY8, NULL);
+}
+
+/** @brief Convert a frame from P010 to RGB
+ * @ingroup frame
+ *
+ * Only the top 8 of the 10 bits of each sample are used.
+ *
+ * @param in P010 frame, of even width
+ * @param out RGB frame
+ */
+uvc_error_t uvc_p010_2rgb(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv420sp2rgb(in, out, UVC_FRAME_FORMAT_P010, UVC_FRAME_FORMAT_RGB, NULL);
+}
+
+/** @brief Convert a frame from P010 to BGR
+ * @ingroup frame
+ *
+ * Only the top 8 of the 10 bits of each sample are used.
+ *
+ * @param in P010 frame, of even width
+ * @param out BGR frame
+ */
+uvc_error_t uvc_p010_2bgr(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv420sp2rgb(in, out, UVC_FRAME_FORMAT_P010, UVC_FRAME_FORMAT_BGR, NULL);
+}
+
+/** @brief Convert a frame from P010 to Y (GRAY16)
+ * @ingroup frame
+ *
+ * Samples keep all 10 bits, in the top of each little-endian 16-bit word.
+ *
+ * @param in P010 frame
+ * @param out GRAY16 frame
+ */
+uvc_error_t uvc_p010_2y16(uvc_frame_t *in, uvc_frame_t *out) {
+  return _uvc_yuv420sp2y(in, out, UVC_FRAME_FORMAT_P010, UVC_FRAME_FORMAT_GRAY16, NULL);
+}
+
+/* Raw Bayer demosaicing */
+
+/** @internal
+ * @brief Find where red sits in the 2x2 tile of a Bayer format
+ *
+ * Blue sits diagonally opposite, green on the other two sites. BY8 and BA81
+ * carry no pattern of their own and are taken to be BGGR.
+ *
+ * @return 0, or -1 if the format isn't a Bayer format
+ */
+static int _uvc_bayer_red_pos(enum uvc_frame_format format,
+    unsigned int *red_x, unsigned int *red_y) {
+  switch (format) {
+  case UVC_FRAME_FORMAT_SRGGB8:
+    *red_x = 0;
+    *red_y = 0;
+    return 0;
+  case UVC_FRAME_FORMAT_SGRBG8:
+    *red_x = 1;
+    *red_y = 0;
+    return 0;
+  case UVC_FRAME_FORMAT_SGBRG8:
+    *red_x = 0;
+    *red_y = 1;
+    return 0;
+  case UVC_FRAME_FORMAT_SBGGR8:
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+    *red_x = 1;
+    *red_y = 1;
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/** @internal
+ * @brief Reflect a coordinate that is off the edge of the image back into
+ * it, keeping its position in the Bayer pattern
+ */
+static inline int _uvc_bayer_mirror(int i, int n) {
+  if (i < 0)
+    return -i;
+  if (i >= n)
+    return 2 * n - 2 - i;
+  return i;
+}
+
+static inline int _uvc_clamp8(int i) {
+  return i >= 255 ? 255 : (i < 0 ? 0 : i);
+}
+
+/** @internal
+ * @brief Write one output pixel
+ */
+static inline void _uvc_bayer_put(uint8_t *out, enum uvc_frame_format format,
+    int r, int g, int b) {
+  switch (format) {
+  case UVC_FRAME_FORMAT_RGB:
+    out[0] = r;
+    out[1] = g;
+    out[2] = b;
+    break;
+  case UVC_FRAME_FORMAT_BGR:
+    out[0] = b;
+    out[1] = g;
+    out[2] = r;
+    break;
+  default:
+    out[0] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+    break;
+  }
+}
+
+struct uvc_demosaic {
+  uvc_frame_t *in, *out;
+  size_t in_step;
+  unsigned int red_x, red_y;
+  enum uvc_frame_format format;
+  size_t out_pixel_bytes;
+  enum uvc_demosaic_method method;
+  /* edge-aware: green for every pixel, from the first pass */
+  uint8_t *green;
+};
+
+/** @internal
+ * @brief Bilinear demosaicing of one row
+ *
+ * Each missing colour is the average of the nearest samples of it: the two
+ * horizontal or vertical neighbours, or the four edge or corner neighbours.
+ */
+static void _uvc_demosaic_bilinear_row(struct uvc_demosaic *dm, int y) {
+  int w = dm->in->width, h = dm->in->height;
+  const uint8_t *p1 = (uint8_t *) dm->in->data + y * dm->in_step;
+  const uint8_t *p0 = (uint8_t *) dm->in->data + _uvc_bayer_mirror(y - 1, h) * dm->in_step;
+  const uint8_t *p2 = (uint8_t *) dm->in->data + _uvc_bayer_mirror(y + 1, h) * dm->in_step;
+  uint8_t *out = (uint8_t *) dm->out->data + y * dm->out->step;
+  /* the non-green colour on this row, and the parity of its columns */
+  int red_row = (unsigned int) (y & 1) == dm->red_y;
+  unsigned int color_x = red_row ? dm->red_x : 1 - dm->red_x;
+  int x = 0;
+
+  while (x < w) {
+    int xl = _uvc_bayer_mirror(x - 1, w), xr = _uvc_bayer_mirror(x + 1, w);
+    int own, g, other;
+
+    if ((unsigned int) (x & 1) == color_x) {
+      own = p1[x];
+      g = (p1[xl] + p1[xr] + p0[x] + p2[x] + 2) >> 2;
+      other = (p0[xl] + p0[xr] + p2[xl] + p2[xr] + 2) >> 2;
+    } else {
+      own = (p1[xl] + p1[xr] + 1) >> 1;
+      g = p1[x];
+      other = (p0[x] + p2[x] + 1) >> 1;
+    }
 
-  while (puv < puv_end) {
-    IYUYV2UV(pyuv, puv);
+    _uvc_bayer_put(out + x * dm->out_pixel_bytes, dm->format,
+                   red_row ? own : other, g, red_row ? other : own);
 
-    puv += 1;
-    pyuv += 2;
+    /* the interior goes to the SIMD kernel, if there is one */
+    if (++x == 2)
+      x = _uvc_bayer_bilinear_simd(p0, p1, p2, out, x, w, red_row, color_x, dm->format);
   }
+}
+
+/** @internal
+ * @brief Interpolate green along the smoother direction (Hamilton-Adams)
+ *
+ * @param[out] g Green for each column of row y
+ */
+static void _uvc_demosaic_green_row(struct uvc_demosaic *dm, int y, uint8_t *g) {
+  int w = dm->in->width, h = dm->in->height;
+  const uint8_t *data = dm->in->data;
+  const uint8_t *p = data + y * dm->in_step;
+  const uint8_t *pu = data + _uvc_bayer_mirror(y - 1, h) * dm->in_step;
+  const uint8_t *pd = data + _uvc_bayer_mirror(y + 1, h) * dm->in_step;
+  const uint8_t *puu = data + _uvc_bayer_mirror(y - 2, h) * dm->in_step;
+  const uint8_t *pdd = data + _uvc_bayer_mirror(y + 2, h) * dm->in_step;
+  unsigned int color_x = (unsigned int) (y & 1) == dm->red_y ? dm->red_x : 1 - dm->red_x;
+  int x = 0;
+
+  while (x < w) {
+    if ((unsigned int) (x & 1) == color_x) {
+      int l, r, ll, rr, c, grad_h, grad_v, est_h, est_v, est;
+
+      c = p[x];
+      l = p[_uvc_bayer_mirror(x - 1, w)];
+      r = p[_uvc_bayer_mirror(x + 1, w)];
+      ll = p[_uvc_bayer_mirror(x - 2, w)];
+      rr = p[_uvc_bayer_mirror(x + 2, w)];
+
+      grad_h = abs(l - r) + abs(2 * c - ll - rr);
+      grad_v = abs(pu[x] - pd[x]) + abs(2 * c - puu[x] - pdd[x]);
+      /* four times the estimates: average green plus a curvature correction */
+      est_h = 2 * (l + r) + 2 * c - ll - rr;
+      est_v = 2 * (pu[x] + pd[x]) + 2 * c - puu[x] - pdd[x];
+
+      if (grad_h < grad_v)
+        est = (est_h + 2) >> 2;
+      else if (grad_v < grad_h)
+        est = (est_v + 2) >> 2;
+      else
+        est = (est_h + est_v + 4) >> 3;
+
+      g[x] = _uvc_clamp8(est);
+    } else {
+      g[x] = p[x];
+    }
+
+    /* the interior goes to the SIMD kernel, if there is one */
+    if (++x == 2)
+      x = _uvc_bayer_green_simd(puu, pu, p, pd, pdd, g, x, w, color_x);
+  }
+}
+
+/** @internal
+ * @brief Interpolate green for a band of rows; the first pass of
+ * edge-aware demosaicing, called through _uvc_convert_rows()
+ */
+static uvc_error_t _uvc_demosaic_green_rows(void *arg, uint32_t row, uint32_t rows) {
+  struct uvc_demosaic *dm = arg;
+  uint32_t y;
+
+  for (y = row; y < row + rows; y++)
+    _uvc_demosaic_green_row(dm, y, dm->green + (size_t) y * dm->in->width);
 
   return UVC_SUCCESS;
 }
 
-#define IUYVY2RGB_2(pyuv, prgb) { \
-    int r = (22987 * ((pyuv)[2] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[0] - 128) - 11698 * ((pyuv)[2] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[0] - 128)) >> 14; \
-    (prgb)[0] = sat((pyuv)[1] + r); \
-    (prgb)[1] = sat((pyuv)[1] + g); \
-    (prgb)[2] = sat((pyuv)[1] + b); \
-    (prgb)[3] = sat((pyuv)[3] + r); \
-    (prgb)[4] = sat((pyuv)[3] + g); \
-    (prgb)[5] = sat((pyuv)[3] + b); \
+/** @internal
+ * @brief Edge-aware demosaicing of one row; the second pass
+ *
+ * Green comes from the first pass, _uvc_demosaic_green_rows(). Red and blue
+ * are interpolated as differences from green, which vary much more smoothly
+ * across edges than the colours themselves.
+ */
+static void _uvc_demosaic_edge_aware_row(struct uvc_demosaic *dm, int y) {
+  int w = dm->in->width, h = dm->in->height;
+  const uint8_t *data = dm->in->data;
+  const uint8_t *p1 = data + y * dm->in_step;
+  const uint8_t *p0 = data + _uvc_bayer_mirror(y - 1, h) * dm->in_step;
+  const uint8_t *p2 = data + _uvc_bayer_mirror(y + 1, h) * dm->in_step;
+  const uint8_t *g1 = dm->green + (size_t) y * w;
+  const uint8_t *g0 = dm->green + (size_t) _uvc_bayer_mirror(y - 1, h) * w;
+  const uint8_t *g2 = dm->green + (size_t) _uvc_bayer_mirror(y + 1, h) * w;
+  uint8_t *out = (uint8_t *) dm->out->data + y * dm->out->step;
+  int red_row = (unsigned int) (y & 1) == dm->red_y;
+  unsigned int color_x = red_row ? dm->red_x : 1 - dm->red_x;
+  int x = 0;
+
+  while (x < w) {
+    int xl = _uvc_bayer_mirror(x - 1, w), xr = _uvc_bayer_mirror(x + 1, w);
+    int g = g1[x], own, other;
+
+    if ((unsigned int) (x & 1) == color_x) {
+      own = p1[x];
+      other = g + ((p0[xl] - g0[xl] + p0[xr] - g0[xr]
+                    + p2[xl] - g2[xl] + p2[xr] - g2[xr] + 2) >> 2);
+    } else {
+      own = g + ((p1[xl] - g1[xl] + p1[xr] - g1[xr] + 1) >> 1);
+      other = g + ((p0[x] - g0[x] + p2[x] - g2[x] + 1) >> 1);
     }
-#define IUYVY2RGB_16(pyuv, prgb) IUYVY2RGB_8(pyuv, prgb); IUYVY2RGB_8(pyuv + 16, prgb + 24);
-#define IUYVY2RGB_8(pyuv, prgb) IUYVY2RGB_4(pyuv, prgb); IUYVY2RGB_4(pyuv + 8, prgb + 12);
-#define IUYVY2RGB_4(pyuv, prgb) IUYVY2RGB_2(pyuv, prgb); IUYVY2RGB_2(pyuv + 4, prgb + 6);
 
-/** @brief Convert a frame from UYVY to RGB
+    own = _uvc_clamp8(own);
+    other = _uvc_clamp8(other);
+    _uvc_bayer_put(out + x * dm->out_pixel_bytes, dm->format,
+                   red_row ? own : other, g, red_row ? other : own);
+
+    /* the interior goes to the SIMD kernel, if there is one */
+    if (++x == 2)
+      x = _uvc_bayer_edge_aware_simd(p0, p1, p2, g0, g1, g2, out, x, w, red_row, color_x,
+                                     dm->format);
+  }
+}
+
+/** @internal
+ * @brief Half-resolution demosaicing of a band of output rows
+ *
+ * Each 2x2 tile becomes one pixel, using its red and blue samples and the
+ * average of its two greens.
+ */
+static void _uvc_demosaic_superpixel_rows(struct uvc_demosaic *dm, int row, int rows) {
+  int w = dm->out->width;
+  unsigned int blue_x = 1 - dm->red_x, blue_y = 1 - dm->red_y;
+  int y, x;
+
+  for (y = row; y < row + rows; y++) {
+    const uint8_t *tile[2];
+    uint8_t *out = (uint8_t *) dm->out->data + y * dm->out->step;
+
+    tile[0] = (uint8_t *) dm->in->data + 2 * y * dm->in_step;
+    tile[1] = tile[0] + dm->in_step;
+
+    for (x = 0; x < w; x++, tile[0] += 2, tile[1] += 2) {
+      int r = tile[dm->red_y][dm->red_x];
+      int b = tile[blue_y][blue_x];
+      int g = (tile[dm->red_y][blue_x] + tile[blue_y][dm->red_x] + 1) >> 1;
+
+      _uvc_bayer_put(out + x * dm->out_pixel_bytes, dm->format, r, g, b);
+    }
+  }
+}
+
+/** @internal
+ * @brief Demosaic a band of rows; called through _uvc_convert_rows()
+ */
+static uvc_error_t _uvc_demosaic_rows(void *arg, uint32_t row, uint32_t rows) {
+  struct uvc_demosaic *dm = arg;
+  uint32_t y;
+
+  switch (dm->method) {
+  case UVC_DEMOSAIC_EDGE_AWARE:
+    for (y = row; y < row + rows; y++)
+      _uvc_demosaic_edge_aware_row(dm, y);
+    return UVC_SUCCESS;
+  case UVC_DEMOSAIC_SUPERPIXEL:
+    _uvc_demosaic_superpixel_rows(dm, row, rows);
+    return UVC_SUCCESS;
+  default:
+    for (y = row; y < row + rows; y++)
+      _uvc_demosaic_bilinear_row(dm, y);
+    return UVC_SUCCESS;
+  }
+}
+
+/** @brief Demosaic a raw Bayer frame
  * @ingroup frame
- * @param ini UYVY frame
- * @param out RGB frame
+ *
+ * Accepts the SGRBG8, SGBRG8, SRGGB8 and SBGGR8 formats, plus BY8 and BA81,
+ * which are treated as SBGGR8.
+ *
+ * @param pool Pool to spread the work over, or NULL to demosaic on the
+ * calling thread
+ * @param in Raw Bayer frame
+ * @param out Converted frame
+ * @param format Format to convert to: UVC_FRAME_FORMAT_RGB,
+ * UVC_FRAME_FORMAT_BGR or UVC_FRAME_FORMAT_GRAY8
+ * @param method Demosaicing algorithm. UVC_DEMOSAIC_SUPERPIXEL produces a
+ * frame of half the width and height.
  */
-uvc_error_t uvc_uyvy2rgb(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_UYVY)
+uvc_error_t uvc_demosaic(uvc_convert_pool_t *pool, uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format, enum uvc_demosaic_method method) {
+  struct uvc_demosaic dm;
+
+  memset(&dm, 0, sizeof(dm));
+  dm.in = in;
+  dm.out = out;
+  dm.format = format;
+  dm.method = method;
+
+  if (_uvc_bayer_red_pos(in->frame_format, &dm.red_x, &dm.red_y) < 0)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
-    return UVC_ERROR_NO_MEM;
+  switch (format) {
+  case UVC_FRAME_FORMAT_RGB:
+  case UVC_FRAME_FORMAT_BGR:
+    dm.out_pixel_bytes = 3;
+    break;
+  case UVC_FRAME_FORMAT_GRAY8:
+    dm.out_pixel_bytes = 1;
+    break;
+  default:
+    return UVC_ERROR_NOT_SUPPORTED;
+  }
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_RGB;
-  out->step = in->width *3;
+  /* the filters reach two pixels out */
+  if (in->width < 3 || in->height < 3)
+    return UVC_ERROR_INVALID_PARAM;
+
+  dm.in_step = in->step ? in->step : in->width;
+  if (in->data_bytes < dm.in_step * (in->height - 1) + in->width)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (method == UVC_DEMOSAIC_SUPERPIXEL) {
+    if (_uvc_ensure_frame_rows(out, in->width / 2, in->height / 2, dm.out_pixel_bytes) < 0)
+      return UVC_ERROR_NO_MEM;
+  } else {
+    if (_uvc_ensure_frame_rows(out, in->width, in->height, dm.out_pixel_bytes) < 0)
+      return UVC_ERROR_NO_MEM;
+  }
+
+  out->frame_format = format;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *prgb = out->data;
-  uint8_t *prgb_end = prgb + out->data_bytes;
+  if (method == UVC_DEMOSAIC_EDGE_AWARE) {
+    uvc_error_t ret;
+
+    /* red and blue need the green of the rows either side, so all of it is
+     * interpolated first, into one buffer shared by the bands */
+    dm.green = malloc((size_t) in->width * in->height);
+    if (!dm.green)
+      return UVC_ERROR_NO_MEM;
 
-  while (prgb < prgb_end) {
-    IUYVY2RGB_8(pyuv, prgb);
+    ret = _uvc_convert_rows(pool, in->height, _uvc_demosaic_green_rows, &dm);
+    if (ret == UVC_SUCCESS)
+      ret = _uvc_convert_rows(pool, out->height, _uvc_demosaic_rows, &dm);
 
-    prgb += 3 * 8;
-    pyuv += 2 * 8;
+    free(dm.green);
+    return ret;
   }
 
-  return UVC_SUCCESS;
+  return _uvc_convert_rows(pool, out->height, _uvc_demosaic_rows, &dm);
 }
 
-#define IUYVY2BGR_2(pyuv, pbgr) { \
-    int r = (22987 * ((pyuv)[2] - 128)) >> 14; \
-    int g = (-5636 * ((pyuv)[0] - 128) - 11698 * ((pyuv)[2] - 128)) >> 14; \
-    int b = (29049 * ((pyuv)[0] - 128)) >> 14; \
-    (pbgr)[0] = sat((pyuv)[1] + b); \
-    (pbgr)[1] = sat((pyuv)[1] + g); \
-    (pbgr)[2] = sat((pyuv)[1] + r); \
-    (pbgr)[3] = sat((pyuv)[3] + b); \
-    (pbgr)[4] = sat((pyuv)[3] + g); \
-    (pbgr)[5] = sat((pyuv)[3] + r); \
-    }
-#define IUYVY2BGR_16(pyuv, pbgr) IUYVY2BGR_8(pyuv, pbgr); IUYVY2BGR_8(pyuv + 16, pbgr + 24);
-#define IUYVY2BGR_8(pyuv, pbgr) IUYVY2BGR_4(pyuv, pbgr); IUYVY2BGR_4(pyuv + 8, pbgr + 12);
-#define IUYVY2BGR_4(pyuv, pbgr) IUYVY2BGR_2(pyuv, pbgr); IUYVY2BGR_2(pyuv + 4, pbgr + 6);
+/** @internal
+ * @brief Size of a pixel in a format that stores whole pixels side by side
+ *
+ * For YUYV and UYVY, the size is averaged over a pixel pair.
+ *
+ * @return Bytes per pixel, or 0 for compressed and planar formats
+ */
+size_t _uvc_packed_pixel_bytes(enum uvc_frame_format format) {
+  switch (format) {
+  case UVC_FRAME_FORMAT_RGB:
+  case UVC_FRAME_FORMAT_BGR:
+    return 3;
+  case UVC_FRAME_FORMAT_YUYV:
+  case UVC_FRAME_FORMAT_UYVY:
+  case UVC_FRAME_FORMAT_GRAY16:
+    return 2;
+  case UVC_FRAME_FORMAT_GRAY8:
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+  case UVC_FRAME_FORMAT_SGRBG8:
+  case UVC_FRAME_FORMAT_SGBRG8:
+  case UVC_FRAME_FORMAT_SRGGB8:
+  case UVC_FRAME_FORMAT_SBGGR8:
+    return 1;
+  default:
+    return 0;
+  }
+}
 
-/** @brief Convert a frame from UYVY to BGR
+/** @internal
+ * @brief Size of a 4:2:0 frame with chroma planes (NV12, P010 or I420)
+ *
+ * @param step Step of the luma plane
+ * @return Bytes, or 0 for other formats
+ */
+size_t _uvc_yuv420_frame_bytes(enum uvc_frame_format format, size_t step, uint32_t height) {
+  switch (format) {
+  case UVC_FRAME_FORMAT_NV12:
+  case UVC_FRAME_FORMAT_P010:
+    return step * (height + (height + 1) / 2);
+  case UVC_FRAME_FORMAT_I420:
+    return step * height + 2 * ((step + 1) / 2) * ((height + 1) / 2);
+  default:
+    return 0;
+  }
+}
+
+/** @internal
+ * @brief Make room for a 4:2:0 frame with chroma planes in a conversion's output
+ *
+ * Like _uvc_ensure_frame_rows(), a buffer supplied by the caller keeps its
+ * step if it's wide enough.
+ */
+uvc_error_t _uvc_ensure_frame_yuv420(uvc_frame_t *out, enum uvc_frame_format format,
+    uint32_t width, uint32_t height) {
+  /* an NV12 chroma row holds a pair for every two pixels, rounding up */
+  size_t step = format == UVC_FRAME_FORMAT_NV12 ? (width + 1) & ~1u : width;
+
+  if (!out->library_owns_data && out->step > step)
+    step = out->step;
+
+  if (uvc_ensure_frame_size(out, _uvc_yuv420_frame_bytes(format, step, height)) < 0)
+    return UVC_ERROR_NO_MEM;
+
+  out->width = width;
+  out->height = height;
+  out->step = step;
+  return UVC_SUCCESS;
+}
+
+/** @brief Convert part of a frame
  * @ingroup frame
- * @param ini UYVY frame
- * @param out BGR frame
+ *
+ * Only the pixels inside the rectangle are read and converted, and the
+ * output frame holds just the rectangle. A frame can also be cropped
+ * without conversion by asking for its own format, for any format other
+ * than MJPEG, H.264, NV12 or P010.
+ *
+ * The rectangle must start on an even column for YUYV and UYVY, and on an
+ * even column and row for NV12, P010 and raw Bayer frames, and must have an
+ * even width for YUYV, UYVY, NV12 and P010. Raw Bayer frames are demosaiced
+ * as if the rectangle were the whole frame, so its edge pixels are
+ * interpolated from its own pixels only.
+ *
+ * @param in Frame to convert
+ * @param out Converted frame
+ * @param format Format to convert to: UVC_FRAME_FORMAT_RGB,
+ * UVC_FRAME_FORMAT_BGR, UVC_FRAME_FORMAT_GRAY8 (from YUYV, NV12 or Bayer),
+ * UVC_FRAME_FORMAT_GRAY16 (from P010), or the input format
+ * @param roi Rectangle to convert
  */
-uvc_error_t uvc_uyvy2bgr(uvc_frame_t *in, uvc_frame_t *out) {
-  if (in->frame_format != UVC_FRAME_FORMAT_UYVY)
+uvc_error_t uvc_convert_roi(uvc_frame_t *in, uvc_frame_t *out,
+    enum uvc_frame_format format, const uvc_roi_t *roi) {
+  uvc_error_t (*convert)(uvc_frame_t *in, uvc_frame_t *out) = NULL;
+  size_t in_pixel_bytes = _uvc_packed_pixel_bytes(in->frame_format);
+  size_t out_pixel_bytes = _uvc_packed_pixel_bytes(format);
+  size_t in_step;
+  uvc_frame_t view;
+  uint32_t row;
+  int bayer = 0, align = 1;
+
+  switch (in->frame_format) {
+  case UVC_FRAME_FORMAT_YUYV:
+    if (format == UVC_FRAME_FORMAT_RGB)
+      convert = uvc_yuyv2rgb;
+    else if (format == UVC_FRAME_FORMAT_BGR)
+      convert = uvc_yuyv2bgr;
+    else if (format == UVC_FRAME_FORMAT_GRAY8)
+      convert = uvc_yuyv2y;
+    align = 2;
+    break;
+  case UVC_FRAME_FORMAT_UYVY:
+    if (format == UVC_FRAME_FORMAT_RGB)
+      convert = uvc_uyvy2rgb;
+    else if (format == UVC_FRAME_FORMAT_BGR)
+      convert = uvc_uyvy2bgr;
+    align = 2;
+    break;
+  case UVC_FRAME_FORMAT_NV12:
+  case UVC_FRAME_FORMAT_P010:
+    if (roi->x & 1 || roi->y & 1 || roi->width & 1)
+      return UVC_ERROR_INVALID_PARAM;
+    break;
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+  case UVC_FRAME_FORMAT_SGRBG8:
+  case UVC_FRAME_FORMAT_SGBRG8:
+  case UVC_FRAME_FORMAT_SRGGB8:
+  case UVC_FRAME_FORMAT_SBGGR8:
+    /* keep the colour pattern of the tile at the origin */
+    if (roi->x & 1 || roi->y & 1)
+      return UVC_ERROR_INVALID_PARAM;
+    bayer = format != in->frame_format;
+    break;
+  default:
+    break;
+  }
+
+  if (!roi->width || !roi->height || roi->x > in->width || roi->y > in->height
+      || roi->width > in->width - roi->x || roi->height > in->height - roi->y
+      || roi->x % align || roi->width % align)
+    return UVC_ERROR_INVALID_PARAM;
+
+  switch (in->frame_format) {
+  case UVC_FRAME_FORMAT_NV12:
+    if (format == UVC_FRAME_FORMAT_RGB || format == UVC_FRAME_FORMAT_BGR)
+      return _uvc_yuv420sp2rgb(in, out, in->frame_format, format, roi);
+    if (format == UVC_FRAME_FORMAT_GRAY8)
+      return _uvc_yuv420sp2y(in, out, in->frame_format, format, roi);
+    return UVC_ERROR_NOT_SUPPORTED;
+  case UVC_FRAME_FORMAT_P010:
+    if (format == UVC_FRAME_FORMAT_RGB || format == UVC_FRAME_FORMAT_BGR)
+      return _uvc_yuv420sp2rgb(in, out, in->frame_format, format, roi);
+    if (format == UVC_FRAME_FORMAT_GRAY16)
+      return _uvc_yuv420sp2y(in, out, in->frame_format, format, roi);
+    return UVC_ERROR_NOT_SUPPORTED;
+  default:
+    break;
+  }
+
+  if (!in_pixel_bytes || !out_pixel_bytes || (!convert && !bayer && format != in->frame_format))
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  in_step = in->step ? in->step : in->width * in_pixel_bytes;
+  if (in->data_bytes < (roi->y + roi->height - 1) * in_step + (roi->x + roi->width) * in_pixel_bytes)
     return UVC_ERROR_INVALID_PARAM;
 
-  if (uvc_ensure_frame_size(out, in->width * in->height * 3) < 0)
+  /* a view of the rectangle, sharing the input's rows */
+  view = *in;
+  view.data = (uint8_t *) in->data + roi->y * in_step + roi->x * in_pixel_bytes;
+  view.data_bytes = (roi->height - 1) * in_step + roi->width * in_pixel_bytes;
+  view.width = roi->width;
+  view.height = roi->height;
+  view.step = in_step;
+  view.library_owns_data = 0;
+
+  if (bayer)
+    return uvc_demosaic(NULL, &view, out, format, UVC_DEMOSAIC_BILINEAR);
+
+  if (convert)
+    return convert(&view, out);
+
+  if (_uvc_ensure_frame_rows(out, roi->width, roi->height, out_pixel_bytes) < 0)
     return UVC_ERROR_NO_MEM;
 
-  out->width = in->width;
-  out->height = in->height;
-  out->frame_format = UVC_FRAME_FORMAT_BGR;
-  out->step = in->width *3;
+  out->frame_format = format;
   out->sequence = in->sequence;
   out->capture_time = in->capture_time;
   out->capture_time_finished = in->capture_time_finished;
   out->source = in->source;
 
-  uint8_t *pyuv = in->data;
-  uint8_t *pbgr = out->data;
-  uint8_t *pbgr_end = pbgr + out->data_bytes;
-
-  while (pbgr < pbgr_end) {
-    IUYVY2BGR_8(pyuv, pbgr);
-
-    pbgr += 3 * 8;
-    pyuv += 2 * 8;
-  }
+  for (row = 0; row < roi->height; row++)
+    memcpy((uint8_t *) out->data + row * out->step, (uint8_t *) view.data + row * in_step,
+           roi->width * out_pixel_bytes);
 
   return UVC_SUCCESS;
 }
@@ -448,6 +1256,17 @@ uvc_error_t uvc_any2rgb(uvc_frame_t *in, uvc_frame_t *out) {
       return uvc_yuyv2rgb(in, out);
     case UVC_FRAME_FORMAT_UYVY:
       return uvc_uyvy2rgb(in, out);
+    case UVC_FRAME_FORMAT_NV12:
+      return uvc_nv12_2rgb(in, out);
+    case UVC_FRAME_FORMAT_P010:
+      return uvc_p010_2rgb(in, out);
+    case UVC_FRAME_FORMAT_BY8:
+    case UVC_FRAME_FORMAT_BA81:
+    case UVC_FRAME_FORMAT_SGRBG8:
+    case UVC_FRAME_FORMAT_SGBRG8:
+    case UVC_FRAME_FORMAT_SRGGB8:
+    case UVC_FRAME_FORMAT_SBGGR8:
+      return uvc_demosaic(NULL, in, out, UVC_FRAME_FORMAT_RGB, UVC_DEMOSAIC_BILINEAR);
     case UVC_FRAME_FORMAT_RGB:
       return uvc_duplicate_frame(in, out);
     default:
@@ -467,6 +1286,17 @@ uvc_error_t uvc_any2bgr(uvc_frame_t *in, uvc_frame_t *out) {
       return uvc_yuyv2bgr(in, out);
     case UVC_FRAME_FORMAT_UYVY:
       return uvc_uyvy2bgr(in, out);
+    case UVC_FRAME_FORMAT_NV12:
+      return uvc_nv12_2bgr(in, out);
+    case UVC_FRAME_FORMAT_P010:
+      return uvc_p010_2bgr(in, out);
+    case UVC_FRAME_FORMAT_BY8:
+    case UVC_FRAME_FORMAT_BA81:
+    case UVC_FRAME_FORMAT_SGRBG8:
+    case UVC_FRAME_FORMAT_SGBRG8:
+    case UVC_FRAME_FORMAT_SRGGB8:
+    case UVC_FRAME_FORMAT_SBGGR8:
+      return uvc_demosaic(NULL, in, out, UVC_FRAME_FORMAT_BGR, UVC_DEMOSAIC_BILINEAR);
     case UVC_FRAME_FORMAT_BGR:
       return uvc_duplicate_frame(in, out);
     default:
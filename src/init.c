@@ -75,6 +75,13 @@ YUV stream from a UVC device such as a standard webcam.
  * @defgroup init Library initialization/deinitialization
  * @brief Setup routines used to construct UVC access contexts
  */
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setaffinity_np, pthread_setname_np */
+#endif
+#include <sched.h>
+#endif
+
 #include "libuvc/libuvc.h"
 #include "libuvc/libuvc_internal.h"
 
@@ -86,6 +93,8 @@ YUV stream from a UVC device such as a standard webcam.
 void *_uvc_handle_events(void *arg) {
   uvc_context_t *ctx = (uvc_context_t *) arg;
 
+  _uvc_apply_thread_opts(&ctx->event_thread_opts, "uvc_events");
+
   while (!ctx->kill_handler_thread)
     libusb_handle_events_completed(ctx->usb_ctx, &ctx->kill_handler_thread);
   return NULL;
@@ -133,6 +142,10 @@ uvc_error_t uvc_init(uvc_context_t **pctx, struct libusb_context *usb_ctx) {
  * If no USB context was provided to #uvc_init, the UVC-specific USB
  * context will be destroyed.
  *
+ * The calling thread's MJPEG decoder, used when uvc_mjpeg_decode() is
+ * given no decoder, is freed as well. Other threads' decoders are freed
+ * when those threads exit.
+ *
  * @param ctx UVC context to shut down
  */
 void uvc_exit(uvc_context_t *ctx) {
@@ -145,6 +158,10 @@ void uvc_exit(uvc_context_t *ctx) {
   if (ctx->own_usb_ctx)
     libusb_exit(ctx->usb_ctx);
 
+#ifdef LIBUVC_HAS_JPEG
+  _uvc_mjpeg_release_thread_decoder();
+#endif
+
   free(ctx);
 }
 
@@ -157,7 +174,239 @@ void uvc_exit(uvc_context_t *ctx) {
  * are already open (and being handled).
  */
 void uvc_start_handler_thread(uvc_context_t *ctx) {
-  if (ctx->own_usb_ctx)
+  if (ctx->own_usb_ctx && !ctx->external_events)
     pthread_create(&ctx->handler_thread, NULL, _uvc_handle_events, (void*) ctx);
 }
 
+/** @internal
+ * @brief Copy thread options, keeping a private copy of the name
+ */
+void _uvc_copy_thread_opts(uvc_thread_opts_t *dst, char name_buf[16],
+    const uvc_thread_opts_t *src) {
+  if (!src) {
+    memset(dst, 0, sizeof(*dst));
+    return;
+  }
+
+  *dst = *src;
+  if (src->name) {
+    strncpy(name_buf, src->name, 15);
+    name_buf[15] = '\0';
+    dst->name = name_buf;
+  }
+}
+
+/** @internal
+ * @brief Apply scheduling options to the calling thread
+ *
+ * Each setting is attempted independently. Failures, usually for lack of
+ * privileges (SCHED_FIFO needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance),
+ * are logged with UVC_DEBUG and otherwise ignored so that streaming still
+ * works with default scheduling.
+ *
+ * @param opts Options to apply
+ * @param default_name Name to give the thread if opts doesn't name it
+ */
+void _uvc_apply_thread_opts(const uvc_thread_opts_t *opts, const char *default_name) {
+  const char *name = opts->name ? opts->name : default_name;
+  int ret;
+
+#if defined(__linux__)
+  ret = pthread_setname_np(pthread_self(), name);
+  if (ret) {
+    UVC_DEBUG("unable to name thread %s: %d", name, ret);
+  }
+
+  if (opts->cpu_mask) {
+    cpu_set_t cpus;
+    int cpu;
+
+    CPU_ZERO(&cpus);
+    for (cpu = 0; cpu < 64; cpu++) {
+      if (opts->cpu_mask & ((uint64_t) 1 << cpu))
+        CPU_SET(cpu, &cpus);
+    }
+
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (ret) {
+      UVC_DEBUG("unable to set affinity of thread %s: %d", name, ret);
+    }
+  }
+#elif defined(__APPLE__)
+  ret = pthread_setname_np(name);
+  if (ret) {
+    UVC_DEBUG("unable to name thread %s: %d", name, ret);
+  }
+
+  if (opts->cpu_mask) {
+    UVC_DEBUG("CPU affinity is not supported on this platform");
+  }
+#else
+  (void) name;
+  (void) ret;
+#endif
+
+  if (opts->rt_priority > 0) {
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = opts->rt_priority;
+
+    ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (ret) {
+      UVC_DEBUG("unable to make thread %s SCHED_FIFO: %d", name, ret);
+    }
+  }
+}
+
+/** @brief Set scheduling options for the USB event handler thread
+ * @ingroup init
+ *
+ * Pinning the event thread to a core and giving it real-time priority keeps
+ * scheduling delays from causing missed transfers, which in turn allows
+ * streams to run with far fewer transfers in flight (see
+ * uvc_stream_start_opts()). The options take effect the next time the
+ * handler thread starts, i.e. when the first device is opened. Settings
+ * that need privileges the process doesn't have are skipped.
+ *
+ * @param ctx UVC context
+ * @param opts Thread options, or NULL to restore the defaults
+ */
+void uvc_set_event_thread_opts(uvc_context_t *ctx, const uvc_thread_opts_t *opts) {
+  _uvc_copy_thread_opts(&ctx->event_thread_opts, ctx->event_thread_name, opts);
+}
+
+/** @brief Drive USB events from the application's event loop
+ * @ingroup init
+ *
+ * By default, a context that owns its USB context spawns a thread that
+ * handles USB events while devices are open. Once external events are
+ * enabled, no such thread is started and the application must instead watch
+ * the file descriptors from uvc_get_pollfds() (see also
+ * uvc_set_pollfd_notifiers()), honour uvc_get_next_timeout() and call
+ * uvc_handle_events() when either fires. Frames are then best consumed
+ * from the same loop with uvc_stream_get_frame() and a timeout of -1.
+ *
+ * This must be called before any device is opened.
+ *
+ * @param ctx UVC context
+ * @param enable Nonzero to handle events externally
+ */
+uvc_error_t uvc_set_external_events(uvc_context_t *ctx, uint8_t enable) {
+  if (ctx->open_devices)
+    return UVC_ERROR_BUSY;
+
+  ctx->external_events = enable ? 1 : 0;
+  return UVC_SUCCESS;
+}
+
+/** @brief Get the file descriptors to watch for USB events
+ * @ingroup init
+ *
+ * The list may change as devices are opened and closed; use
+ * uvc_set_pollfd_notifiers() to track it.
+ *
+ * @param ctx UVC context
+ * @param[out] pollfds Array of descriptors, to be freed with uvc_free_pollfds()
+ * @param[out] num_pollfds Number of entries in pollfds
+ * @return UVC_ERROR_NOT_SUPPORTED if the platform has no pollable descriptors
+ */
+uvc_error_t uvc_get_pollfds(uvc_context_t *ctx, uvc_pollfd_t **pollfds, int *num_pollfds) {
+  const struct libusb_pollfd **usb_pollfds;
+  int i, count;
+
+  usb_pollfds = libusb_get_pollfds(ctx->usb_ctx);
+  if (!usb_pollfds)
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  for (count = 0; usb_pollfds[count]; count++)
+    ;
+
+  *pollfds = calloc(count > 0 ? count : 1, sizeof(**pollfds));
+  if (!*pollfds) {
+    free(usb_pollfds);
+    return UVC_ERROR_NO_MEM;
+  }
+
+  for (i = 0; i < count; i++) {
+    (*pollfds)[i].fd = usb_pollfds[i]->fd;
+    (*pollfds)[i].events = usb_pollfds[i]->events;
+  }
+  *num_pollfds = count;
+
+#if LIBUSB_API_VERSION >= 0x01000104
+  libusb_free_pollfds(usb_pollfds);
+#else
+  free((void *) usb_pollfds);
+#endif
+
+  return UVC_SUCCESS;
+}
+
+/** @brief Free a list of descriptors from uvc_get_pollfds()
+ * @ingroup init
+ */
+void uvc_free_pollfds(uvc_pollfd_t *pollfds) {
+  free(pollfds);
+}
+
+static void LIBUSB_CALL _uvc_pollfd_added(int fd, short events, void *user_data) {
+  uvc_context_t *ctx = (uvc_context_t *) user_data;
+
+  ctx->pollfd_added(fd, events, ctx->pollfd_user_ptr);
+}
+
+static void LIBUSB_CALL _uvc_pollfd_removed(int fd, void *user_data) {
+  uvc_context_t *ctx = (uvc_context_t *) user_data;
+
+  ctx->pollfd_removed(fd, ctx->pollfd_user_ptr);
+}
+
+/** @brief Get notified when the descriptors to watch for USB events change
+ * @ingroup init
+ *
+ * @param ctx UVC context
+ * @param added_cb Called with each descriptor that should be watched, or NULL
+ * @param removed_cb Called with each descriptor that should no longer be watched, or NULL
+ * @param user_ptr Passed to the callbacks
+ */
+void uvc_set_pollfd_notifiers(uvc_context_t *ctx,
+    uvc_pollfd_added_callback_t *added_cb,
+    uvc_pollfd_removed_callback_t *removed_cb,
+    void *user_ptr) {
+  ctx->pollfd_added = added_cb;
+  ctx->pollfd_removed = removed_cb;
+  ctx->pollfd_user_ptr = user_ptr;
+
+  libusb_set_pollfd_notifiers(ctx->usb_ctx,
+                              added_cb ? _uvc_pollfd_added : NULL,
+                              removed_cb ? _uvc_pollfd_removed : NULL,
+                              ctx);
+}
+
+/** @brief Get how long the event loop may sleep before calling uvc_handle_events()
+ * @ingroup init
+ *
+ * @param ctx UVC context
+ * @param[out] tv Time until the next USB timeout expires
+ * @return 1 if tv was set, 0 if there is no pending timeout, or a negative
+ * uvc_error_t
+ */
+int uvc_get_next_timeout(uvc_context_t *ctx, struct timeval *tv) {
+  return libusb_get_next_timeout(ctx->usb_ctx, tv);
+}
+
+/** @brief Process pending USB events without blocking
+ * @ingroup init
+ *
+ * Completes any finished transfers, which assembles frames and queues them
+ * for the stream's consumers.
+ *
+ * @param ctx UVC context
+ */
+uvc_error_t uvc_handle_events(uvc_context_t *ctx) {
+  struct timeval tv = { 0, 0 };
+
+  return libusb_handle_events_timeout_completed(ctx->usb_ctx, &tv, NULL);
+}
+
@@ -0,0 +1,388 @@
+/*********************************************************************
+* Software License Agreement (BSD License)
+*
+*  Copyright (C) 2010-2012 Ken Tossell
+*  All rights reserved.
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*   * Redistributions of source code must retain the above copyright
+*     notice, this list of conditions and the following disclaimer.
+*   * Redistributions in binary form must reproduce the above
+*     copyright notice, this list of conditions and the following
+*     disclaimer in the documentation and/or other materials provided
+*     with the distribution.
+*   * Neither the name of the author nor other contributors may be
+*     used to endorse or promote products derived from this software
+*     without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+*  FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+*  COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+*  INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+*  BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+*  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+*  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+*  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+*  ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+*  POSSIBILITY OF SUCH DAMAGE.
+*********************************************************************/
+/**
+ * @file
+ * @brief Decoding MJPEG streams on several threads
+ *
+ * MJPEG frames don't depend on each other, so a stream that is too fast for
+ * one core to decode can be spread over several. The pipeline copies each
+ * frame it's given into a ring of slots; decoder threads, each with its own
+ * uvc_mjpeg_decoder_t, take slots in order, and whichever thread finds the
+ * oldest slot decoded hands it and any decoded slots behind it to the
+ * callback, so frames come out in the order they went in.
+ */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+
+/* A frame making its way through the pipeline */
+struct uvc_mjpeg_slot {
+  uvc_frame_t *in, *out;
+  uvc_error_t ret;
+  uint8_t decoded;
+};
+
+struct uvc_mjpeg_worker {
+  uvc_mjpeg_pipeline_t *pipe;
+  pthread_t thread;
+  uvc_mjpeg_decoder_t *decoder;
+};
+
+struct uvc_mjpeg_pipeline {
+  /* serializes pushes */
+  pthread_mutex_t push_mutex;
+  /* protects everything below but the callback and the workers */
+  pthread_mutex_t mutex;
+  /* signals a frame to decode, or shutdown */
+  pthread_cond_t work_cond;
+  /* signals that a slot was freed */
+  pthread_cond_t space_cond;
+  /* Frame n lives in slots[n % num_slots]. Frames from head to next_decode
+   * are being decoded or waiting to be delivered, and from next_decode to
+   * tail are waiting for a thread. */
+  struct uvc_mjpeg_slot *slots;
+  unsigned int num_slots;
+  uint64_t head, next_decode, tail;
+  /* set while a thread is calling the callback, which keeps deliveries in
+   * order */
+  uint8_t delivering;
+  uint8_t shutdown;
+  enum uvc_queue_policy policy;
+  enum uvc_frame_format format;
+  uvc_frame_callback_t *cb;
+  void *user_ptr;
+  struct uvc_mjpeg_worker *workers;
+  unsigned int num_workers;
+  uvc_thread_opts_t thread_opts;
+  char thread_name[16];
+  uvc_mjpeg_pipeline_stats_t stats;
+};
+
+/** @internal
+ * @brief Deliver decoded frames at the head of the ring
+ *
+ * Called with the mutex held. Only one thread delivers at a time; frames
+ * decoded meanwhile by other threads are picked up by this one's loop.
+ */
+static void _uvc_mjpeg_pipeline_deliver(uvc_mjpeg_pipeline_t *pipe) {
+  if (pipe->delivering)
+    return;
+
+  pipe->delivering = 1;
+
+  while (pipe->head < pipe->next_decode) {
+    struct uvc_mjpeg_slot *slot = &pipe->slots[pipe->head % pipe->num_slots];
+
+    if (!slot->decoded)
+      break;
+
+    if (slot->ret == UVC_SUCCESS) {
+      pipe->stats.frames_decoded++;
+      pthread_mutex_unlock(&pipe->mutex);
+      pipe->cb(slot->out, pipe->user_ptr);
+      pthread_mutex_lock(&pipe->mutex);
+    } else {
+      pipe->stats.frames_failed++;
+    }
+
+    slot->decoded = 0;
+    pipe->head++;
+    pthread_cond_broadcast(&pipe->space_cond);
+  }
+
+  pipe->delivering = 0;
+}
+
+/** @internal
+ * @brief Decoder thread
+ */
+static void *_uvc_mjpeg_pipeline_worker(void *arg) {
+  struct uvc_mjpeg_worker *worker = arg;
+  uvc_mjpeg_pipeline_t *pipe = worker->pipe;
+
+  _uvc_apply_thread_opts(&pipe->thread_opts, "uvc_mjpeg");
+
+  pthread_mutex_lock(&pipe->mutex);
+
+  for (;;) {
+    struct uvc_mjpeg_slot *slot;
+
+    while (!pipe->shutdown && pipe->next_decode == pipe->tail)
+      pthread_cond_wait(&pipe->work_cond, &pipe->mutex);
+
+    if (pipe->next_decode == pipe->tail)
+      break;
+
+    slot = &pipe->slots[pipe->next_decode++ % pipe->num_slots];
+    pthread_mutex_unlock(&pipe->mutex);
+
+    slot->ret = uvc_mjpeg_decode(worker->decoder, slot->in, slot->out, pipe->format);
+
+    pthread_mutex_lock(&pipe->mutex);
+    slot->decoded = 1;
+    _uvc_mjpeg_pipeline_deliver(pipe);
+  }
+
+  pthread_mutex_unlock(&pipe->mutex);
+
+  return NULL;
+}
+
+/** @brief Create a pipeline that decodes MJPEG frames on several threads
+ * @ingroup streaming
+ *
+ * Frames handed to uvc_mjpeg_pipeline_push() are decoded by num_threads
+ * threads and passed to the callback in the order they were pushed, which
+ * for frames straight from a stream is their sequence order. The callback
+ * is called from the decoder threads, one call at a time, and the decoded
+ * frame is only valid until it returns.
+ *
+ * To decode a stream, start it with uvc_mjpeg_pipeline_callback() as the
+ * frame callback and the pipeline as its user pointer.
+ *
+ * @param[out] ppipe New pipeline
+ * @param num_threads Number of decoder threads
+ * @param max_in_flight Number of frames that may be copied into the
+ *        pipeline and not yet delivered; at least num_threads
+ * @param policy What to do with a pushed frame when max_in_flight frames are
+ *        already in the pipeline. UVC_QUEUE_DROP_OLDEST discards the oldest
+ *        frame not yet being decoded, UVC_QUEUE_DROP_NEWEST discards the
+ *        pushed frame and UVC_QUEUE_BLOCK waits for room.
+ * @param format Format to decode to, as for uvc_mjpeg_decode()
+ * @param cb Callback that receives decoded frames
+ * @param user_ptr User pointer passed to the callback
+ * @param opts Scheduling options for the decoder threads, or NULL for the
+ *        defaults. The name, if any, is copied.
+ */
+uvc_error_t uvc_mjpeg_pipeline_create(uvc_mjpeg_pipeline_t **ppipe, unsigned int num_threads,
+    unsigned int max_in_flight, enum uvc_queue_policy policy, enum uvc_frame_format format,
+    uvc_frame_callback_t *cb, void *user_ptr, const uvc_thread_opts_t *opts) {
+  uvc_mjpeg_pipeline_t *pipe;
+  uvc_error_t ret;
+
+  if (!num_threads || max_in_flight < num_threads || !cb)
+    return UVC_ERROR_INVALID_PARAM;
+
+  pipe = calloc(1, sizeof(*pipe));
+  if (!pipe)
+    return UVC_ERROR_NO_MEM;
+
+  pthread_mutex_init(&pipe->push_mutex, NULL);
+  pthread_mutex_init(&pipe->mutex, NULL);
+  pthread_cond_init(&pipe->work_cond, NULL);
+  pthread_cond_init(&pipe->space_cond, NULL);
+  pipe->policy = policy;
+  pipe->format = format;
+  pipe->cb = cb;
+  pipe->user_ptr = user_ptr;
+  _uvc_copy_thread_opts(&pipe->thread_opts, pipe->thread_name, opts);
+
+  pipe->slots = calloc(max_in_flight, sizeof(*pipe->slots));
+  pipe->workers = calloc(num_threads, sizeof(*pipe->workers));
+  if (!pipe->slots || !pipe->workers) {
+    ret = UVC_ERROR_NO_MEM;
+    goto fail;
+  }
+
+  for (; pipe->num_slots < max_in_flight; pipe->num_slots++) {
+    struct uvc_mjpeg_slot *slot = &pipe->slots[pipe->num_slots];
+
+    slot->in = uvc_allocate_frame(0);
+    slot->out = uvc_allocate_frame(0);
+    if (!slot->in || !slot->out) {
+      pipe->num_slots++;
+      ret = UVC_ERROR_NO_MEM;
+      goto fail;
+    }
+  }
+
+  for (; pipe->num_workers < num_threads; pipe->num_workers++) {
+    struct uvc_mjpeg_worker *worker = &pipe->workers[pipe->num_workers];
+
+    worker->pipe = pipe;
+    ret = uvc_mjpeg_decoder_create(&worker->decoder);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
+    if (pthread_create(&worker->thread, NULL, _uvc_mjpeg_pipeline_worker, worker) != 0) {
+      UVC_DEBUG("unable to start decoder thread %u", pipe->num_workers);
+      uvc_mjpeg_decoder_destroy(worker->decoder);
+      ret = UVC_ERROR_OTHER;
+      goto fail;
+    }
+  }
+
+  *ppipe = pipe;
+  return UVC_SUCCESS;
+
+fail:
+  uvc_mjpeg_pipeline_destroy(pipe);
+  return ret;
+}
+
+/** @brief Stop a pipeline's threads and free it
+ * @ingroup streaming
+ *
+ * Frames already pushed are decoded and delivered first. Stop the stream
+ * feeding the pipeline before calling this.
+ *
+ * @param pipe Pipeline to free
+ */
+void uvc_mjpeg_pipeline_destroy(uvc_mjpeg_pipeline_t *pipe) {
+  unsigned int i;
+
+  pthread_mutex_lock(&pipe->mutex);
+  pipe->shutdown = 1;
+  pthread_cond_broadcast(&pipe->work_cond);
+  pthread_cond_broadcast(&pipe->space_cond);
+  pthread_mutex_unlock(&pipe->mutex);
+
+  for (i = 0; i < pipe->num_workers; i++) {
+    pthread_join(pipe->workers[i].thread, NULL);
+    uvc_mjpeg_decoder_destroy(pipe->workers[i].decoder);
+  }
+
+  for (i = 0; i < pipe->num_slots; i++) {
+    if (pipe->slots[i].in)
+      uvc_free_frame(pipe->slots[i].in);
+    if (pipe->slots[i].out)
+      uvc_free_frame(pipe->slots[i].out);
+  }
+
+  pthread_cond_destroy(&pipe->space_cond);
+  pthread_cond_destroy(&pipe->work_cond);
+  pthread_mutex_destroy(&pipe->mutex);
+  pthread_mutex_destroy(&pipe->push_mutex);
+  free(pipe->workers);
+  free(pipe->slots);
+  free(pipe);
+}
+
+/** @brief Hand an MJPEG frame to a pipeline
+ * @ingroup streaming
+ *
+ * The frame is copied, so the caller may reuse it as soon as this returns.
+ *
+ * @param pipe Pipeline
+ * @param frame MJPEG frame
+ * @return UVC_SUCCESS if the frame was queued or discarded under the
+ *         pipeline's policy; UVC_ERROR_BUSY if the pipeline is shutting down
+ */
+uvc_error_t uvc_mjpeg_pipeline_push(uvc_mjpeg_pipeline_t *pipe, uvc_frame_t *frame) {
+  struct uvc_mjpeg_slot *slot;
+  uvc_error_t ret;
+
+  if (frame->frame_format != UVC_FRAME_FORMAT_MJPEG)
+    return UVC_ERROR_INVALID_PARAM;
+
+  pthread_mutex_lock(&pipe->push_mutex);
+  pthread_mutex_lock(&pipe->mutex);
+
+  if (pipe->tail - pipe->head == pipe->num_slots) {
+    if (pipe->policy == UVC_QUEUE_BLOCK) {
+      pipe->stats.queue_blocks++;
+      while (!pipe->shutdown && pipe->tail - pipe->head == pipe->num_slots)
+        pthread_cond_wait(&pipe->space_cond, &pipe->mutex);
+    } else if (pipe->policy == UVC_QUEUE_DROP_OLDEST && pipe->next_decode < pipe->tail) {
+      /* Move the frames behind the oldest waiting one up a slot, and reuse
+       * its buffers for the new frame at the back */
+      struct uvc_mjpeg_slot dropped = pipe->slots[pipe->next_decode % pipe->num_slots];
+      uint64_t n;
+
+      for (n = pipe->next_decode; n + 1 < pipe->tail; n++)
+        pipe->slots[n % pipe->num_slots] = pipe->slots[(n + 1) % pipe->num_slots];
+
+      pipe->tail--;
+      pipe->slots[pipe->tail % pipe->num_slots] = dropped;
+      pipe->stats.frames_dropped_oldest++;
+    } else {
+      /* every frame is being decoded, so there's none older to drop */
+      pipe->stats.frames_dropped_newest++;
+      pthread_mutex_unlock(&pipe->mutex);
+      pthread_mutex_unlock(&pipe->push_mutex);
+      return UVC_SUCCESS;
+    }
+  }
+
+  if (pipe->shutdown) {
+    pthread_mutex_unlock(&pipe->mutex);
+    pthread_mutex_unlock(&pipe->push_mutex);
+    return UVC_ERROR_BUSY;
+  }
+
+  /* The slot at the tail belongs to no thread, so it can be filled without
+   * the mutex; the workers only see it once the tail moves past it */
+  slot = &pipe->slots[pipe->tail % pipe->num_slots];
+  pthread_mutex_unlock(&pipe->mutex);
+
+  ret = uvc_duplicate_frame(frame, slot->in);
+
+  pthread_mutex_lock(&pipe->mutex);
+  if (ret == UVC_SUCCESS) {
+    pipe->tail++;
+    pthread_cond_signal(&pipe->work_cond);
+  }
+  pthread_mutex_unlock(&pipe->mutex);
+  pthread_mutex_unlock(&pipe->push_mutex);
+
+  return ret;
+}
+
+/** @brief Frame callback that hands a stream's frames to a pipeline
+ * @ingroup streaming
+ *
+ * Pass this to uvc_stream_start() or uvc_start_streaming() with the
+ * pipeline as the user pointer.
+ *
+ * @param frame MJPEG frame
+ * @param pipe Pipeline from uvc_mjpeg_pipeline_create()
+ */
+void uvc_mjpeg_pipeline_callback(uvc_frame_t *frame, void *pipe) {
+  uvc_error_t ret = uvc_mjpeg_pipeline_push(pipe, frame);
+
+  if (ret != UVC_SUCCESS) {
+    UVC_DEBUG("dropped frame %u: %s", frame->sequence, uvc_strerror(ret));
+  }
+}
+
+/** @brief Read a pipeline's counters
+ * @ingroup streaming
+ *
+ * @param pipe Pipeline
+ * @param[out] stats Counters since the pipeline was created
+ */
+void uvc_mjpeg_pipeline_get_stats(uvc_mjpeg_pipeline_t *pipe, uvc_mjpeg_pipeline_stats_t *stats) {
+  pthread_mutex_lock(&pipe->mutex);
+  *stats = pipe->stats;
+  pthread_mutex_unlock(&pipe->mutex);
+}
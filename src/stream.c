@@ -39,6 +39,12 @@
 #include "libuvc/libuvc.h"
 #include "libuvc/libuvc_internal.h"
 #include "errno.h"
+#ifdef __linux__
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #ifdef _MSC_VER
 
@@ -66,12 +72,130 @@ int gettimeofday(struct timeval *tv, struct timezone *tz)
     return 0;
 }
 #endif // _MSC_VER
+
+/** Bump one of a stream's statistics counters; safe from any thread */
+#define UVC_STAT_ADD(strmh, counter, n) \
+  __atomic_add_fetch(&(strmh)->stats.counter, (n), __ATOMIC_RELAXED)
+#define UVC_STAT_INC(strmh, counter) UVC_STAT_ADD(strmh, counter, 1)
+
+/** @internal
+ * @brief Initialize a wait word
+ */
+static void _uvc_wait_word_init(struct uvc_wait_word *w) {
+  w->val = 0;
+  w->waiters = 0;
+#ifndef __linux__
+  pthread_mutex_init(&w->mutex, NULL);
+  pthread_cond_init(&w->cond, NULL);
+#endif
+}
+
+/** @internal
+ * @brief Destroy a wait word
+ */
+static void _uvc_wait_word_destroy(struct uvc_wait_word *w) {
+#ifndef __linux__
+  pthread_cond_destroy(&w->cond);
+  pthread_mutex_destroy(&w->mutex);
+#else
+  (void) w;
+#endif
+}
+
+/** @internal
+ * @brief Get the current value of a wait word, to pass to _uvc_wait_word_wait()
+ */
+static uint32_t _uvc_wait_word_load(struct uvc_wait_word *w) {
+  return __atomic_load_n(&w->val, __ATOMIC_SEQ_CST);
+}
+
+/** @internal
+ * @brief Sleep until a wait word no longer holds the value seen
+ *
+ * May return early; callers re-check their condition and wait again.
+ *
+ * @param deadline CLOCK_MONOTONIC time to give up at, or NULL to wait indefinitely
+ * @return 0, or ETIMEDOUT if the deadline passed
+ */
+static int _uvc_wait_word_wait(struct uvc_wait_word *w, uint32_t seen,
+    const struct timespec *deadline) {
+  int ret = 0;
+
+  __atomic_add_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&w->val, __ATOMIC_SEQ_CST) == seen) {
+#ifdef __linux__
+    /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline */
+    if (syscall(SYS_futex, &w->val, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+                seen, deadline, NULL, FUTEX_BITSET_MATCH_ANY) < 0
+        && errno == ETIMEDOUT)
+      ret = ETIMEDOUT;
+#else
+    struct timespec ts;
+
+    if (deadline) {
+      /* pthread_cond_timedwait() measures against CLOCK_REALTIME */
+      struct timespec now;
+      long long remaining_ns;
+
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      remaining_ns = (deadline->tv_sec - now.tv_sec) * 1000000000LL
+        + (deadline->tv_nsec - now.tv_nsec);
+      if (remaining_ns < 0)
+        remaining_ns = 0;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      remaining_ns += ts.tv_nsec;
+      ts.tv_sec += remaining_ns / 1000000000;
+      ts.tv_nsec = remaining_ns % 1000000000;
+    }
+
+    pthread_mutex_lock(&w->mutex);
+    while (ret == 0 && __atomic_load_n(&w->val, __ATOMIC_SEQ_CST) == seen) {
+      if (deadline)
+        ret = pthread_cond_timedwait(&w->cond, &w->mutex, &ts);
+      else
+        pthread_cond_wait(&w->cond, &w->mutex);
+    }
+    pthread_mutex_unlock(&w->mutex);
+#endif
+  }
+
+  __atomic_sub_fetch(&w->waiters, 1, __ATOMIC_SEQ_CST);
+
+  return ret;
+}
+
+/** @internal
+ * @brief Bump a wait word, waking any threads sleeping on it
+ *
+ * Costs a system call only if someone is sleeping.
+ */
+static void _uvc_wait_word_wake(struct uvc_wait_word *w) {
+  __atomic_add_fetch(&w->val, 1, __ATOMIC_SEQ_CST);
+
+  if (__atomic_load_n(&w->waiters, __ATOMIC_SEQ_CST) == 0)
+    return;
+
+#ifdef __linux__
+  syscall(SYS_futex, &w->val, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&w->mutex);
+  pthread_cond_broadcast(&w->cond);
+  pthread_mutex_unlock(&w->mutex);
+#endif
+}
+
 uvc_frame_desc_t *uvc_find_frame_desc_stream(uvc_stream_handle_t *strmh,
     uint16_t format_id, uint16_t frame_id);
 uvc_frame_desc_t *uvc_find_frame_desc(uvc_device_handle_t *devh,
     uint16_t format_id, uint16_t frame_id);
 void *_uvc_user_caller(void *arg);
-void _uvc_populate_frame(uvc_stream_handle_t *strmh);
+void _uvc_populate_frame(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *fb);
+static uvc_frame_t *_uvc_lease_frame(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *fb);
+static void _uvc_stream_free_transfer_arrays(uvc_stream_handle_t *strmh);
+static void _uvc_free_transfer(uvc_stream_handle_t *strmh, unsigned int transfer_id);
+static void _uvc_stream_free_frame_bufs(uvc_stream_handle_t *strmh);
 
 static uvc_streaming_interface_t *_uvc_get_stream_if(uvc_device_handle_t *devh, int interface_idx);
 static uvc_stream_handle_t *_uvc_get_stream_by_interface(uvc_device_handle_t *devh, int interface_idx);
@@ -103,10 +227,10 @@ struct format_table_entry *_get_format_entry(enum uvc_frame_format format) {
     ABS_FMT(UVC_FRAME_FORMAT_ANY, 2,
       {UVC_FRAME_FORMAT_UNCOMPRESSED, UVC_FRAME_FORMAT_COMPRESSED})
 
-    ABS_FMT(UVC_FRAME_FORMAT_UNCOMPRESSED, 8,
+    ABS_FMT(UVC_FRAME_FORMAT_UNCOMPRESSED, 9,
       {UVC_FRAME_FORMAT_YUYV, UVC_FRAME_FORMAT_UYVY, UVC_FRAME_FORMAT_GRAY8,
        UVC_FRAME_FORMAT_GRAY16, UVC_FRAME_FORMAT_NV12, UVC_FRAME_FORMAT_P010,
-       UVC_FRAME_FORMAT_BGR, UVC_FRAME_FORMAT_RGB})
+       UVC_FRAME_FORMAT_I420, UVC_FRAME_FORMAT_BGR, UVC_FRAME_FORMAT_RGB})
     FMT(UVC_FRAME_FORMAT_YUYV,
       {'Y',  'U',  'Y',  '2', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
     FMT(UVC_FRAME_FORMAT_UYVY,
@@ -119,6 +243,8 @@ struct format_table_entry *_get_format_entry(enum uvc_frame_format format) {
       {'N',  'V',  '1',  '2', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
     FMT(UVC_FRAME_FORMAT_P010,
       {'P',  '0',  '1',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
+    FMT(UVC_FRAME_FORMAT_I420,
+      {'I',  '4',  '2',  '0', 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71})
     FMT(UVC_FRAME_FORMAT_BGR,
       {0x7d, 0xeb, 0x36, 0xe4, 0x4f, 0x52, 0xce, 0x11, 0x9f, 0x53, 0x00, 0x20, 0xaf, 0x0b, 0xa7, 0x70})
     FMT(UVC_FRAME_FORMAT_RGB,
@@ -652,65 +778,333 @@ uvc_error_t uvc_probe_still_ctrl(
 }
 
 /** @internal
- * @brief Swap the working buffer with the presented buffer and notify consumers
+ * @brief Allocate the pool of frame buffers used for assembling frames
+ *
+ * One buffer is needed for the assembler and one for each slot in the frame
+ * queue, plus one for each frame the user is allowed to lease. Direct bulk
+ * transfers receive into buffers from the pool too, so they need one each.
  */
-void _uvc_swap_buffers(uvc_stream_handle_t *strmh) {
-  uint8_t *tmp_buf;
+static uvc_error_t _uvc_stream_alloc_frame_bufs(uvc_stream_handle_t *strmh) {
+  unsigned int num_bufs = strmh->queue_depth + strmh->max_leases + 1;
+  size_t buf_bytes = strmh->cur_ctrl.dwMaxVideoFrameSize;
+  size_t conv_bytes = strmh->conv_func ? strmh->conv_out_step * strmh->conv_height : 0;
+  unsigned int i;
+
+  if (strmh->direct_bulk) {
+    num_bufs += strmh->num_transfers;
+    buf_bytes = strmh->bulk_transfer_size;
+  }
 
-  pthread_mutex_lock(&strmh->cb_mutex);
+  for (i = 0; i < strmh->num_frame_bufs; i++) {
+    if (strmh->frame_bufs[i].refs > 0)
+      return UVC_ERROR_BUSY; /* a frame from the last run is still leased */
+  }
 
-  (void)clock_gettime(CLOCK_MONOTONIC, &strmh->capture_time_finished);
+  if (strmh->frame_bufs && strmh->num_frame_bufs == num_bufs
+      && strmh->frame_buf_bytes == buf_bytes && strmh->conv_buf_bytes == conv_bytes)
+    goto reset;
+
+  _uvc_stream_free_frame_bufs(strmh);
+
+  strmh->frame_bufs = calloc(num_bufs, sizeof(*strmh->frame_bufs));
+  /* round the ring up to a power of two so the free-running indices can wrap */
+  for (strmh->queue_mask = 1; strmh->queue_mask < strmh->queue_depth; strmh->queue_mask <<= 1)
+    ;
+  strmh->frame_queue = calloc(strmh->queue_mask, sizeof(*strmh->frame_queue));
+  strmh->queue_mask--;
+  if (!strmh->frame_bufs || !strmh->frame_queue) {
+    _uvc_stream_free_frame_bufs(strmh);
+    return UVC_ERROR_NO_MEM;
+  }
 
-  /* swap the buffers */
-  tmp_buf = strmh->holdbuf;
-  strmh->hold_bytes = strmh->got_bytes;
-  strmh->holdbuf = strmh->outbuf;
-  strmh->outbuf = tmp_buf;
-  strmh->hold_last_scr = strmh->last_scr;
-  strmh->hold_pts = strmh->pts;
-  strmh->hold_seq = strmh->seq;
-  
-  /* swap metadata buffer */
-  tmp_buf = strmh->meta_holdbuf;
-  strmh->meta_holdbuf = strmh->meta_outbuf;
-  strmh->meta_outbuf = tmp_buf;
-  strmh->meta_hold_bytes = strmh->meta_got_bytes;
+  strmh->num_frame_bufs = num_bufs;
+  strmh->frame_buf_bytes = buf_bytes;
+  strmh->conv_buf_bytes = conv_bytes;
 
-  pthread_cond_broadcast(&strmh->cb_cond);
-  pthread_mutex_unlock(&strmh->cb_mutex);
+  for (i = 0; i < num_bufs; i++) {
+    struct uvc_frame_buffer *fb = &strmh->frame_bufs[i];
+
+    fb->strmh = strmh;
+    fb->data = malloc(buf_bytes);
+    fb->meta = malloc(LIBUVC_XFER_META_BUF_SIZE);
+    if (conv_bytes)
+      fb->conv_data = malloc(conv_bytes);
+
+    if (!fb->data || !fb->meta || (conv_bytes && !fb->conv_data)) {
+      _uvc_stream_free_frame_bufs(strmh);
+      return UVC_ERROR_NO_MEM;
+    }
+  }
+
+reset:
+  for (i = 0; i < num_bufs; i++) {
+    strmh->frame_bufs[i].queued = 0;
+    strmh->frame_bufs[i].in_transfer = 0;
+  }
+
+  strmh->queue_head = 0;
+  strmh->queue_tail = 0;
+
+  strmh->out_fb = &strmh->frame_bufs[0];
+  strmh->outbuf = strmh->out_fb->data;
+  strmh->meta_outbuf = strmh->out_fb->meta;
+  strmh->got_bytes = 0;
+  strmh->roi_got_bytes = 0;
+  strmh->conv_rows = 0;
+  strmh->meta_got_bytes = 0;
+
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Free the frame buffer pool
+ */
+static void _uvc_stream_free_frame_bufs(uvc_stream_handle_t *strmh) {
+  unsigned int i;
+
+  for (i = 0; i < strmh->num_frame_bufs; i++) {
+    free(strmh->frame_bufs[i].data);
+    free(strmh->frame_bufs[i].meta);
+    free(strmh->frame_bufs[i].conv_data);
+  }
+
+  free(strmh->frame_bufs);
+  free(strmh->frame_queue);
+  strmh->frame_bufs = NULL;
+  strmh->frame_queue = NULL;
+  strmh->num_frame_bufs = 0;
+  strmh->queue_head = 0;
+  strmh->queue_tail = 0;
+  strmh->out_fb = NULL;
+  strmh->outbuf = NULL;
+  strmh->meta_outbuf = NULL;
+}
+
+/** @internal
+ * @brief Find a buffer that is not being assembled, queued, leased or
+ * received into
+ *
+ * Only called by the assembler.
+ */
+static struct uvc_frame_buffer *_uvc_find_free_buffer(uvc_stream_handle_t *strmh) {
+  unsigned int i;
+
+  for (i = 0; i < strmh->num_frame_bufs; i++) {
+    struct uvc_frame_buffer *fb = &strmh->frame_bufs[i];
+
+    if (fb != strmh->out_fb && !fb->in_transfer
+        && !__atomic_load_n(&fb->queued, __ATOMIC_ACQUIRE)
+        && __atomic_load_n(&fb->refs, __ATOMIC_ACQUIRE) == 0)
+      return fb;
+  }
+
+  return NULL;
+}
+
+/** @internal
+ * @brief Whether the frame queue holds queue_depth frames
+ *
+ * Only called by the assembler.
+ */
+static int _uvc_queue_full(uvc_stream_handle_t *strmh) {
+  return strmh->queue_tail - __atomic_load_n(&strmh->queue_head, __ATOMIC_ACQUIRE)
+    >= strmh->queue_depth;
+}
+
+/** @internal
+ * @brief Remove the oldest frame from the frame queue
+ *
+ * Safe to call from any thread. The caller owns the returned buffer until it
+ * passes it to _uvc_return_buffer().
+ */
+static struct uvc_frame_buffer *_uvc_dequeue_frame(uvc_stream_handle_t *strmh) {
+  uint32_t head = __atomic_load_n(&strmh->queue_head, __ATOMIC_ACQUIRE);
+  struct uvc_frame_buffer *fb;
+
+  do {
+    if (head == __atomic_load_n(&strmh->queue_tail, __ATOMIC_ACQUIRE))
+      return NULL;
+
+    /* the slot can't be reused until head moves past it */
+    fb = strmh->frame_queue[head & strmh->queue_mask];
+  } while (!__atomic_compare_exchange_n(&strmh->queue_head, &head, head + 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  return fb;
+}
+
+/** @internal
+ * @brief Hand a dequeued buffer back to the assembler
+ *
+ * The buffer becomes free once its leases, if any, are released.
+ */
+static void _uvc_return_buffer(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *fb) {
+  __atomic_store_n(&fb->queued, 0, __ATOMIC_RELEASE);
+  _uvc_wait_word_wake(&strmh->buf_freed);
+}
+
+/** @internal
+ * @brief Wait for a free buffer to become available (UVC_QUEUE_BLOCK)
+ *
+ * @return The free buffer, or NULL if the stream was stopped while waiting
+ */
+static struct uvc_frame_buffer *_uvc_wait_free_buffer(uvc_stream_handle_t *strmh) {
+  struct uvc_frame_buffer *fb;
+  uint32_t seen;
+
+  UVC_STAT_INC(strmh, queue_blocks);
+
+  for (;;) {
+    seen = _uvc_wait_word_load(&strmh->buf_freed);
+
+    if (!__atomic_load_n(&strmh->running, __ATOMIC_ACQUIRE))
+      return NULL;
+
+    if (!_uvc_queue_full(strmh) && (fb = _uvc_find_free_buffer(strmh)))
+      return fb;
+
+    _uvc_wait_word_wait(&strmh->buf_freed, seen, NULL);
+  }
+}
+
+/** @internal
+ * @brief Queue a completed frame buffer for consumers
+ *
+ * Never takes a lock; it only sleeps under UVC_QUEUE_BLOCK.
+ *
+ * @param fb Buffer holding the frame: either the one being assembled, or one
+ * that a direct bulk transfer received into
+ * @param offset Offset of the image data within the buffer
+ * @param bytes Length of the image data
+ * @return A free buffer that takes over fb's role, or NULL if the frame was
+ * dropped and fb should be reused
+ */
+static struct uvc_frame_buffer *_uvc_queue_frame(uvc_stream_handle_t *strmh,
+    struct uvc_frame_buffer *fb, size_t offset, size_t bytes) {
+  struct uvc_frame_buffer *next_fb = NULL;
+  int64_t capture_ns;
+
+  UVC_STAT_INC(strmh, frames_completed);
+
+  if (_uvc_queue_full(strmh)) {
+    struct uvc_frame_buffer *old_fb;
+
+    switch (strmh->queue_policy) {
+    case UVC_QUEUE_DROP_OLDEST:
+      /* a consumer may beat us to it, which makes room just the same */
+      old_fb = _uvc_dequeue_frame(strmh);
+      if (old_fb) {
+        _uvc_return_buffer(strmh, old_fb);
+        UVC_STAT_INC(strmh, frames_dropped_oldest);
+      }
+      break;
+    case UVC_QUEUE_DROP_NEWEST:
+      break;
+    case UVC_QUEUE_BLOCK:
+      next_fb = _uvc_wait_free_buffer(strmh);
+      if (!next_fb)
+        return NULL;
+      break;
+    }
+  }
 
+  if (!next_fb && !_uvc_queue_full(strmh))
+    next_fb = _uvc_find_free_buffer(strmh);
+
+  if (!next_fb && strmh->queue_policy == UVC_QUEUE_BLOCK)
+    next_fb = _uvc_wait_free_buffer(strmh);
+
+  if (!next_fb) {
+    /* Either the queue is full or every other buffer is leased out, so there
+     * is nowhere to assemble the next frame. Drop this one and reuse its
+     * buffer. */
+    UVC_DEBUG("no free frame buffer, dropping frame %u", strmh->seq);
+    if (strmh->running)
+      UVC_STAT_INC(strmh, frames_dropped_newest);
+    return NULL;
+  }
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &fb->capture_time_finished);
+
+  fb->offset = offset;
+  fb->bytes = bytes;
+  fb->meta_bytes = strmh->meta_got_bytes;
+  fb->seq = strmh->seq;
+  fb->pts = strmh->pts;
+  fb->last_scr = strmh->last_scr;
+  if (!strmh->pts || uvc_clock_pts_to_host(&strmh->clock, strmh->pts, &capture_ns) < 0
+      || capture_ns < 0)
+    capture_ns = 0;
+  fb->capture_time.tv_sec = capture_ns / 1000000000;
+  fb->capture_time.tv_usec = (capture_ns % 1000000000) / 1000;
+  __atomic_store_n(&fb->queued, 1, __ATOMIC_RELAXED);
+
+  next_fb->in_transfer = fb->in_transfer;
+  fb->in_transfer = 0;
+
+  /* publish the buffer contents along with the new tail */
+  strmh->frame_queue[strmh->queue_tail & strmh->queue_mask] = fb;
+  __atomic_store_n(&strmh->queue_tail, strmh->queue_tail + 1, __ATOMIC_RELEASE);
+
+  _uvc_wait_word_wake(&strmh->frame_ready);
+
+  return next_fb;
+}
+
+/** @internal
+ * @brief Reset the assembly state for the next frame
+ */
+static void _uvc_next_frame(uvc_stream_handle_t *strmh) {
   strmh->seq++;
   strmh->got_bytes = 0;
+  strmh->roi_got_bytes = 0;
+  strmh->conv_rows = 0;
   strmh->meta_got_bytes = 0;
   strmh->last_scr = 0;
   strmh->pts = 0;
 }
 
 /** @internal
- * @brief Process a payload transfer
- * 
- * Processes stream, places frames into buffer, signals listeners
- * (such as user callback thread and any polling thread) on new frame
- *
- * @param payload Contents of the payload transfer, either a packet (isochronous) or a full
- * transfer (bulk mode)
- * @param payload_len Length of the payload transfer
+ * @brief Queue the working buffer for consumers and start over in a free one
  */
-void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t payload_len) {
-  size_t header_len;
-  uint8_t header_info;
-  size_t data_len;
+void _uvc_swap_buffers(uvc_stream_handle_t *strmh) {
+  struct uvc_frame_buffer *next_fb;
+
+  strmh->out_fb->conv_bytes = strmh->conv_rows * strmh->conv_out_step;
+  next_fb = _uvc_queue_frame(strmh, strmh->out_fb, 0,
+                            strmh->roi_in_step ? strmh->roi_got_bytes : strmh->got_bytes);
+
+  if (next_fb) {
+    strmh->out_fb = next_fb;
+    strmh->outbuf = next_fb->data;
+    strmh->meta_outbuf = next_fb->meta;
+  }
+
+  _uvc_next_frame(strmh);
+}
 
+/** @internal
+ * @brief Parse the header at the start of a payload transfer
+ *
+ * Updates the stream's FID, PTS and SCR state and collects any metadata
+ * attached to the header.
+ *
+ * @param payload Start of the payload transfer
+ * @param payload_len Bytes available at payload
+ * @param[out] header_len Length of the header
+ * @param[out] data_len Length of the image data that follows the header
+ * @param[out] header_info bmHeaderInfo field of the header
+ * @return 0 on success, -1 if the payload should be discarded
+ */
+static int _uvc_parse_payload_header(uvc_stream_handle_t *strmh,
+    uint8_t *payload, size_t payload_len,
+    size_t *header_len, size_t *data_len, uint8_t *header_info) {
   /* magic numbers for identifying header packets from some iSight cameras */
   static uint8_t isight_tag[] = {
     0x11, 0x22, 0x33, 0x44,
     0xde, 0xad, 0xbe, 0xef, 0xde, 0xad, 0xfa, 0xce
   };
 
-  /* ignore empty payload transfers */
-  if (payload_len == 0)
-    return;
-
   /* Certain iSight cameras have strange behavior: They send header
    * information in a packet with no image data, and then the following
    * packets have only image data, with no more headers until the next frame.
@@ -723,58 +1117,63 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
       (payload_len < 14 || memcmp(isight_tag, payload + 2, sizeof(isight_tag))) &&
       (payload_len < 15 || memcmp(isight_tag, payload + 3, sizeof(isight_tag)))) {
     /* The payload transfer doesn't have any iSight magic, so it's all image data */
-    header_len = 0;
-    data_len = payload_len;
+    *header_len = 0;
+    *data_len = payload_len;
   } else {
-    header_len = payload[0];
+    *header_len = payload[0];
 
-    if (header_len > payload_len) {
-      UVC_DEBUG("bogus packet: actual_len=%zd, header_len=%zd\n", payload_len, header_len);
-      return;
+    if (*header_len > payload_len) {
+      UVC_DEBUG("bogus packet: actual_len=%zd, header_len=%zd\n", payload_len, *header_len);
+      UVC_STAT_INC(strmh, payloads_bogus_header);
+      return -1;
     }
 
     if (strmh->devh->is_isight)
-      data_len = 0;
+      *data_len = 0;
     else
-      data_len = payload_len - header_len;
+      *data_len = payload_len - *header_len;
   }
 
-  if (header_len < 2) {
-    header_info = 0;
+  if (*header_len < 2) {
+    *header_info = 0;
   } else {
     /** @todo we should be checking the end-of-header bit */
     size_t variable_offset = 2;
 
-    header_info = payload[1];
+    *header_info = payload[1];
 
-    if (header_info & 0x40) {
+    if (*header_info & 0x40) {
       UVC_DEBUG("bad packet: error bit set");
-      return;
+      UVC_STAT_INC(strmh, payloads_error_bit);
+      return -1;
     }
 
-    if (strmh->fid != (header_info & 1) && strmh->got_bytes != 0) {
+    if (strmh->fid != (*header_info & 1) && strmh->got_bytes != 0) {
       /* The frame ID bit was flipped, but we have image data sitting
          around from prior transfers. This means the camera didn't send
          an EOF for the last transfer of the previous frame. */
+      UVC_STAT_INC(strmh, frames_fid_resync);
       _uvc_swap_buffers(strmh);
     }
 
-    strmh->fid = header_info & 1;
+    strmh->fid = *header_info & 1;
 
-    if (header_info & (1 << 2)) {
+    if (*header_info & (1 << 2)) {
       strmh->pts = DW_TO_INT(payload + variable_offset);
       variable_offset += 4;
     }
 
-    if (header_info & (1 << 3)) {
-      /** @todo read the SOF token counter */
+    if (*header_info & (1 << 3)) {
       strmh->last_scr = DW_TO_INT(payload + variable_offset);
+      uvc_clock_add_sample(&strmh->clock, strmh->last_scr,
+                           SW_TO_SHORT(payload + variable_offset + 4) & 0x7ff,
+                           strmh->payload_host_ns);
       variable_offset += 6;
     }
 
-    if (header_len > variable_offset) {
+    if (*header_len > variable_offset) {
         // Metadata is attached to header
-        size_t meta_len = header_len - variable_offset;
+        size_t meta_len = *header_len - variable_offset;
         if (strmh->meta_got_bytes + meta_len > LIBUVC_XFER_META_BUF_SIZE)
           meta_len = LIBUVC_XFER_META_BUF_SIZE - strmh->meta_got_bytes; /* Avoid overflow. */
         memcpy(strmh->meta_outbuf + strmh->meta_got_bytes, payload + variable_offset, meta_len);
@@ -782,133 +1181,378 @@ void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t p
     }
   }
 
-  if (data_len > 0) {
-    if (strmh->got_bytes + data_len > strmh->cur_ctrl.dwMaxVideoFrameSize)
-      data_len = strmh->cur_ctrl.dwMaxVideoFrameSize - strmh->got_bytes; /* Avoid overflow. */
-    memcpy(strmh->outbuf + strmh->got_bytes, payload + header_len, data_len);
-    strmh->got_bytes += data_len;
-    if (header_info & (1 << 1) || strmh->got_bytes == strmh->cur_ctrl.dwMaxVideoFrameSize) {
-      /* The EOF bit is set, so publish the complete frame */
-      _uvc_swap_buffers(strmh);
-    }
-  }
+  return 0;
 }
 
 /** @internal
- * @brief Stream transfer callback
- *
- * Processes stream, places frames into buffer, signals listeners
- * (such as user callback thread and any polling thread) on new frame
+ * @brief Append the parts of a payload that fall inside the ROI
  *
- * @param transfer Active transfer
+ * The payload is cut at row boundaries of the incoming frame, and only the
+ * bytes within the ROI's columns of the ROI's rows are copied.
  */
-void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
-  uvc_stream_handle_t *strmh = transfer->user_data;
-
-  int resubmit = 1;
+static void _uvc_append_roi_data(uvc_stream_handle_t *strmh, uint8_t *data, size_t data_len) {
+  const uvc_roi_t *roi = &strmh->roi;
+  size_t roi_end = strmh->roi_start + strmh->roi_out_step;
+
+  while (data_len > 0) {
+    size_t row = strmh->got_bytes / strmh->roi_in_step;
+    size_t col = strmh->got_bytes % strmh->roi_in_step;
+    size_t len = strmh->roi_in_step - col;
+
+    if (row >= roi->y + roi->height) {
+      /* the rest of the frame is below the ROI */
+      strmh->got_bytes += data_len;
+      break;
+    }
 
-  switch (transfer->status) {
-  case LIBUSB_TRANSFER_COMPLETED:
-    if (transfer->num_iso_packets == 0) {
-      /* This is a bulk mode transfer, so it just has one payload transfer */
-      _uvc_process_payload(strmh, transfer->buffer, transfer->actual_length);
-    } else {
-      /* This is an isochronous mode transfer, so each packet has a payload transfer */
-      int packet_id;
+    if (len > data_len)
+      len = data_len;
 
-      for (packet_id = 0; packet_id < transfer->num_iso_packets; ++packet_id) {
-        uint8_t *pktbuf;
-        struct libusb_iso_packet_descriptor *pkt;
+    if (row >= roi->y) {
+      size_t start = col > strmh->roi_start ? col : strmh->roi_start;
+      size_t end = col + len < roi_end ? col + len : roi_end;
 
-        pkt = transfer->iso_packet_desc + packet_id;
+      if (start < end) {
+        size_t offset = (row - roi->y) * strmh->roi_out_step + start - strmh->roi_start;
 
-        if (pkt->status != 0) {
-          UVC_DEBUG("bad packet (isochronous transfer); status: %d", pkt->status);
-          continue;
-        }
+        memcpy(strmh->outbuf + offset, data + start - col, end - start);
+        strmh->roi_got_bytes = offset + end - start;
+      }
+    }
 
-        pktbuf = libusb_get_iso_packet_buffer_simple(transfer, packet_id);
+    data += len;
+    data_len -= len;
+    strmh->got_bytes += len;
+  }
+}
 
-        _uvc_process_payload(strmh, pktbuf, pkt->actual_length);
+/** @internal
+ * @brief Convert the rows of the frame being assembled that have arrived
+ * since the last call
+ */
+static void _uvc_convert_ready_rows(uvc_stream_handle_t *strmh) {
+  size_t bytes = strmh->roi_in_step ? strmh->roi_got_bytes : strmh->got_bytes;
+  uint32_t rows = bytes / strmh->conv_in_step;
+  uvc_frame_t in, out;
 
-      }
-    }
-    break;
-  case LIBUSB_TRANSFER_CANCELLED: 
-  case LIBUSB_TRANSFER_ERROR:
-  case LIBUSB_TRANSFER_NO_DEVICE: {
-    int i;
-    UVC_DEBUG("not retrying transfer, status = %d", transfer->status);
-    pthread_mutex_lock(&strmh->cb_mutex);
+  if (rows > strmh->conv_height)
+    rows = strmh->conv_height;
 
-    /* Mark transfer as deleted. */
-    for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
-      if(strmh->transfers[i] == transfer) {
-        UVC_DEBUG("Freeing transfer %d (%p)", i, transfer);
-        free(transfer->buffer);
-        libusb_free_transfer(transfer);
-        strmh->transfers[i] = NULL;
-        break;
-      }
-    }
-    if(i == LIBUVC_NUM_TRANSFER_BUFS ) {
-      UVC_DEBUG("transfer %p not found; not freeing!", transfer);
-    }
+  if (rows <= strmh->conv_rows)
+    return;
 
-    resubmit = 0;
+  memset(&in, 0, sizeof(in));
+  in.frame_format = strmh->frame_format;
+  in.width = strmh->conv_width;
+  in.height = rows - strmh->conv_rows;
+  in.step = strmh->conv_in_step;
+  in.data = strmh->outbuf + strmh->conv_rows * strmh->conv_in_step;
+  in.data_bytes = in.height * in.step;
+  in.color_matrix = strmh->color_matrix;
+  in.color_range = strmh->color_range;
+
+  memset(&out, 0, sizeof(out));
+  out.data = strmh->out_fb->conv_data + strmh->conv_rows * strmh->conv_out_step;
+  out.data_bytes = in.height * strmh->conv_out_step;
+
+  strmh->conv_func(&in, &out);
+  strmh->conv_rows = rows;
+}
 
-    pthread_cond_broadcast(&strmh->cb_cond);
-    pthread_mutex_unlock(&strmh->cb_mutex);
+/** @internal
+ * @brief Append image data from a payload to the frame being assembled
+ */
+static void _uvc_append_payload_data(uvc_stream_handle_t *strmh, uint8_t *data, size_t data_len) {
+  if (strmh->got_bytes + data_len > strmh->cur_ctrl.dwMaxVideoFrameSize)
+    data_len = strmh->cur_ctrl.dwMaxVideoFrameSize - strmh->got_bytes; /* Avoid overflow. */
 
-    break;
-  }
-  case LIBUSB_TRANSFER_TIMED_OUT:
-  case LIBUSB_TRANSFER_STALL:
-  case LIBUSB_TRANSFER_OVERFLOW:
-    UVC_DEBUG("retrying transfer, status = %d", transfer->status);
-    break;
+  if (strmh->roi_in_step) {
+    _uvc_append_roi_data(strmh, data, data_len);
+  } else {
+    memcpy(strmh->outbuf + strmh->got_bytes, data, data_len);
+    strmh->got_bytes += data_len;
   }
-  
-  if ( resubmit ) {
-    if ( strmh->running ) {
-      int libusbRet = libusb_submit_transfer(transfer);
-      if (libusbRet < 0)
-      {
-        int i;
-        pthread_mutex_lock(&strmh->cb_mutex);
 
-        /* Mark transfer as deleted. */
-        for (i = 0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
-          if (strmh->transfers[i] == transfer) {
-            UVC_DEBUG("Freeing failed transfer %d (%p)", i, transfer);
-            free(transfer->buffer);
-            libusb_free_transfer(transfer);
-            strmh->transfers[i] = NULL;
-            break;
-          }
-        }
-        if (i == LIBUVC_NUM_TRANSFER_BUFS) {
-          UVC_DEBUG("failed transfer %p not found; not freeing!", transfer);
-        }
+  if (strmh->conv_func)
+    _uvc_convert_ready_rows(strmh);
+}
+
+/** @internal
+ * @brief Process a payload transfer
+ * 
+ * Processes stream, places frames into buffer, signals listeners
+ * (such as user callback thread and any polling thread) on new frame
+ *
+ * @param payload Contents of the payload transfer, either a packet (isochronous) or a full
+ * transfer (bulk mode)
+ * @param payload_len Length of the payload transfer
+ */
+void _uvc_process_payload(uvc_stream_handle_t *strmh, uint8_t *payload, size_t payload_len) {
+  size_t header_len;
+  uint8_t header_info;
+  size_t data_len;
+
+  /* ignore empty payload transfers */
+  if (payload_len == 0)
+    return;
+
+  if (_uvc_parse_payload_header(strmh, payload, payload_len,
+                                &header_len, &data_len, &header_info) < 0)
+    return;
+
+  if (data_len > 0) {
+    _uvc_append_payload_data(strmh, payload + header_len, data_len);
+    if (header_info & (1 << 1) || strmh->got_bytes == strmh->cur_ctrl.dwMaxVideoFrameSize) {
+      /* The EOF bit is set, so publish the complete frame */
+      _uvc_swap_buffers(strmh);
+    }
+  }
+}
+
+/** @internal
+ * @brief Process a bulk transfer that holds part of a payload
+ *
+ * Used when bulk transfers are smaller than dwMaxPayloadTransferSize. Only the
+ * first transfer of a payload starts with a header; the payload ends with a
+ * short transfer or once dwMaxPayloadTransferSize bytes have arrived.
+ */
+static void _uvc_process_bulk_transfer(uvc_stream_handle_t *strmh, struct libusb_transfer *transfer) {
+  uint8_t *buf = transfer->buffer;
+  size_t len = transfer->actual_length;
+  size_t header_len = 0;
+  size_t data_len = len;
+
+  if (strmh->bulk_payload_bytes == 0) {
+    /* ignore empty payload transfers */
+    if (len == 0)
+      return;
+
+    if (_uvc_parse_payload_header(strmh, buf, len,
+                                  &header_len, &data_len, &strmh->bulk_header_info) < 0) {
+      /* discard the rest of the payload as well */
+      strmh->bulk_header_info = 0x40;
+    }
+  }
+
+  if (strmh->bulk_header_info & 0x40)
+    data_len = 0;
+
+  if (data_len > 0)
+    _uvc_append_payload_data(strmh, buf + header_len, data_len);
+
+  strmh->bulk_payload_bytes += len;
+
+  if (len < (size_t) transfer->length
+      || strmh->bulk_payload_bytes >= strmh->cur_ctrl.dwMaxPayloadTransferSize) {
+    /* end of payload */
+    if (!(strmh->bulk_header_info & 0x40) && strmh->got_bytes > 0
+        && (strmh->bulk_header_info & (1 << 1)
+            || strmh->got_bytes == strmh->cur_ctrl.dwMaxVideoFrameSize)) {
+      /* The EOF bit is set, so publish the complete frame */
+      _uvc_swap_buffers(strmh);
+    }
+
+    strmh->bulk_payload_bytes = 0;
+  }
+}
+
+/** @internal
+ * @brief Queue a bulk transfer that holds a whole frame without copying it
+ *
+ * With direct bulk transfers, each transfer receives straight into a frame
+ * buffer. When a transfer turns out to contain a complete frame in a single
+ * payload, that buffer is queued as is, with the payload header skipped, and
+ * the transfer is resubmitted with a free buffer in its place.
+ *
+ * @return 1 if the transfer was consumed, 0 if it has to go through
+ * _uvc_process_payload() instead
+ */
+static int _uvc_process_direct_transfer(uvc_stream_handle_t *strmh, struct libusb_transfer *transfer) {
+  uint8_t *payload = transfer->buffer;
+  size_t payload_len = transfer->actual_length;
+  size_t header_len, data_len;
+  uint8_t header_info;
+  struct uvc_frame_buffer *fb = NULL, *next_fb;
+  unsigned int i;
+
+  /* Only a payload that carries a whole frame can be handed over as is, and
+   * only if it doesn't need cropping or converting */
+  if (strmh->got_bytes != 0 || strmh->roi_in_step || strmh->conv_func || payload_len < 2 || payload[0] < 2
+      || payload[0] >= payload_len || !(payload[1] & (1 << 1)) || payload[1] & 0x40)
+    return 0;
+
+  for (i = 0; i < strmh->num_frame_bufs; i++) {
+    if (strmh->frame_bufs[i].data == payload) {
+      fb = &strmh->frame_bufs[i];
+      break;
+    }
+  }
+
+  if (!fb)
+    return 0;
+
+  if (_uvc_parse_payload_header(strmh, payload, payload_len,
+                                &header_len, &data_len, &header_info) < 0)
+    return 1;
+
+  if (data_len > strmh->cur_ctrl.dwMaxVideoFrameSize)
+    data_len = strmh->cur_ctrl.dwMaxVideoFrameSize;
+
+  /* Header metadata was collected into the assembly buffer */
+  memcpy(fb->meta, strmh->meta_outbuf, strmh->meta_got_bytes);
+
+  next_fb = _uvc_queue_frame(strmh, fb, header_len, data_len);
+  if (next_fb)
+    transfer->buffer = next_fb->data;
+
+  _uvc_next_frame(strmh);
+
+  return 1;
+}
+
+/** @internal
+ * @brief Stream transfer callback
+ *
+ * Processes stream, places frames into buffer, signals listeners
+ * (such as user callback thread and any polling thread) on new frame
+ *
+ * @param transfer Active transfer
+ */
+void LIBUSB_CALL _uvc_stream_callback(struct libusb_transfer *transfer) {
+  uvc_stream_handle_t *strmh = transfer->user_data;
+
+  int resubmit = 1;
+
+  switch (transfer->status) {
+  case LIBUSB_TRANSFER_COMPLETED: {
+    struct timespec now;
+    int64_t now_ns;
+
+    UVC_STAT_INC(strmh, transfers_completed);
+
+    /* Arrival time of the payloads, for clock recovery */
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    now_ns = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    if (transfer->num_iso_packets == 0) {
+      UVC_STAT_ADD(strmh, bytes_received, transfer->actual_length);
+      strmh->payload_host_ns = now_ns;
+
+      if (strmh->bulk_transfer_size < strmh->cur_ctrl.dwMaxPayloadTransferSize) {
+        /* This is a bulk mode transfer that holds part of a payload */
+        _uvc_process_bulk_transfer(strmh, transfer);
+      } else if (!strmh->direct_bulk || !_uvc_process_direct_transfer(strmh, transfer)) {
+        /* This is a bulk mode transfer, so it just has one payload transfer */
+        _uvc_process_payload(strmh, transfer->buffer, transfer->actual_length);
+      }
+    } else {
+      /* This is an isochronous mode transfer, so each packet has a payload transfer */
+      int packet_id;
+
+      for (packet_id = 0; packet_id < transfer->num_iso_packets; ++packet_id) {
+        uint8_t *pktbuf;
+        struct libusb_iso_packet_descriptor *pkt;
+
+        pkt = transfer->iso_packet_desc + packet_id;
+
+        if (pkt->status != 0) {
+          UVC_DEBUG("bad packet (isochronous transfer); status: %d", pkt->status);
+          UVC_STAT_INC(strmh, packets_bad);
+          continue;
+        }
+
+        UVC_STAT_ADD(strmh, bytes_received, pkt->actual_length);
+
+        pktbuf = libusb_get_iso_packet_buffer_simple(transfer, packet_id);
+
+        /* Packets arrived one service interval apart, ending now */
+        strmh->payload_host_ns = now_ns - (int64_t) (transfer->num_iso_packets - 1 - packet_id)
+                                          * strmh->iso_interval_us * 1000;
+
+        _uvc_process_payload(strmh, pktbuf, pkt->actual_length);
+
+      }
+    }
+    break;
+  }
+  case LIBUSB_TRANSFER_CANCELLED: 
+  case LIBUSB_TRANSFER_ERROR:
+  case LIBUSB_TRANSFER_NO_DEVICE: {
+    unsigned int i;
+    UVC_DEBUG("not retrying transfer, status = %d", transfer->status);
+    if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+      UVC_STAT_INC(strmh, transfers_failed);
+    pthread_mutex_lock(&strmh->cb_mutex);
+
+    /* Mark transfer as deleted. */
+    for(i=0; i < strmh->num_transfers; i++) {
+      if(strmh->transfers[i] == transfer) {
+        UVC_DEBUG("Freeing transfer %d (%p)", i, transfer);
+        _uvc_free_transfer(strmh, i);
+        break;
+      }
+    }
+    if(i == strmh->num_transfers ) {
+      UVC_DEBUG("transfer %p not found; not freeing!", transfer);
+    }
+
+    resubmit = 0;
+
+    pthread_cond_broadcast(&strmh->cb_cond);
+    pthread_mutex_unlock(&strmh->cb_mutex);
+
+    break;
+  }
+  case LIBUSB_TRANSFER_TIMED_OUT:
+  case LIBUSB_TRANSFER_STALL:
+  case LIBUSB_TRANSFER_OVERFLOW:
+    UVC_DEBUG("retrying transfer, status = %d", transfer->status);
+    if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT)
+      UVC_STAT_INC(strmh, transfers_timed_out);
+    else if (transfer->status == LIBUSB_TRANSFER_STALL)
+      UVC_STAT_INC(strmh, transfers_stalled);
+    else
+      UVC_STAT_INC(strmh, transfers_overflowed);
+    break;
+  }
+  
+  if ( resubmit ) {
+    if ( strmh->running ) {
+      int libusbRet = libusb_submit_transfer(transfer);
+      if (libusbRet < 0)
+      {
+        unsigned int i;
+        UVC_STAT_INC(strmh, transfers_failed);
+        pthread_mutex_lock(&strmh->cb_mutex);
+
+        /* Mark transfer as deleted. */
+        for (i = 0; i < strmh->num_transfers; i++) {
+          if (strmh->transfers[i] == transfer) {
+            UVC_DEBUG("Freeing failed transfer %d (%p)", i, transfer);
+            _uvc_free_transfer(strmh, i);
+            break;
+          }
+        }
+        if (i == strmh->num_transfers) {
+          UVC_DEBUG("failed transfer %p not found; not freeing!", transfer);
+        }
 
         pthread_cond_broadcast(&strmh->cb_cond);
         pthread_mutex_unlock(&strmh->cb_mutex);
       }
     } else {
-      int i;
+      unsigned int i;
       pthread_mutex_lock(&strmh->cb_mutex);
 
       /* Mark transfer as deleted. */
-      for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+      for(i=0; i < strmh->num_transfers; i++) {
         if(strmh->transfers[i] == transfer) {
           UVC_DEBUG("Freeing orphan transfer %d (%p)", i, transfer);
-          free(transfer->buffer);
-          libusb_free_transfer(transfer);
-          strmh->transfers[i] = NULL;
+          _uvc_free_transfer(strmh, i);
           break;
         }
       }
-      if(i == LIBUVC_NUM_TRANSFER_BUFS ) {
+      if(i == strmh->num_transfers ) {
         UVC_DEBUG("orphan transfer %p not found; not freeing!", transfer);
       }
 
@@ -1029,6 +1673,8 @@ uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t
   strmh->devh = devh;
   strmh->stream_if = stream_if;
   strmh->frame.library_owns_data = 1;
+  strmh->queue_depth = 1;
+  strmh->queue_policy = UVC_QUEUE_DROP_OLDEST;
 
   ret = uvc_claim_if(strmh->devh, strmh->stream_if->bInterfaceNumber);
   if (ret != UVC_SUCCESS)
@@ -1038,17 +1684,13 @@ uvc_error_t uvc_stream_open_ctrl(uvc_device_handle_t *devh, uvc_stream_handle_t
   if (ret != UVC_SUCCESS)
     goto fail;
 
-  // Set up the streaming status and data space
+  // Set up the streaming status; frame buffers are allocated on start
   strmh->running = 0;
 
-  strmh->outbuf = malloc( ctrl->dwMaxVideoFrameSize );
-  strmh->holdbuf = malloc( ctrl->dwMaxVideoFrameSize );
-
-  strmh->meta_outbuf = malloc( LIBUVC_XFER_META_BUF_SIZE );
-  strmh->meta_holdbuf = malloc( LIBUVC_XFER_META_BUF_SIZE );
-   
   pthread_mutex_init(&strmh->cb_mutex, NULL);
   pthread_cond_init(&strmh->cb_cond, NULL);
+  _uvc_wait_word_init(&strmh->frame_ready);
+  _uvc_wait_word_init(&strmh->buf_freed);
 
   DL_APPEND(devh->streams, strmh);
 
@@ -1064,6 +1706,225 @@ fail:
   return ret;
 }
 
+/** @internal
+ * @brief Allocate the arrays that track a stream's transfers
+ */
+static uvc_error_t _uvc_stream_alloc_transfer_arrays(uvc_stream_handle_t *strmh,
+    unsigned int num_transfers) {
+  strmh->transfers = calloc(num_transfers, sizeof(*strmh->transfers));
+  strmh->transfer_bufs = calloc(num_transfers, sizeof(*strmh->transfer_bufs));
+  strmh->transfer_dev_mem = calloc(num_transfers, sizeof(*strmh->transfer_dev_mem));
+
+  if (!strmh->transfers || !strmh->transfer_bufs || !strmh->transfer_dev_mem) {
+    _uvc_stream_free_transfer_arrays(strmh);
+    return UVC_ERROR_NO_MEM;
+  }
+
+  strmh->num_transfers = num_transfers;
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Free the arrays that track a stream's transfers
+ *
+ * The transfers themselves must already have been freed.
+ */
+static void _uvc_stream_free_transfer_arrays(uvc_stream_handle_t *strmh) {
+  free(strmh->transfers);
+  free(strmh->transfer_bufs);
+  free(strmh->transfer_dev_mem);
+  strmh->transfers = NULL;
+  strmh->transfer_bufs = NULL;
+  strmh->transfer_dev_mem = NULL;
+  strmh->num_transfers = 0;
+}
+
+/** @internal
+ * @brief Allocate the buffer for a transfer
+ *
+ * If requested, the buffer is allocated with libusb_dev_mem_alloc() so that
+ * the kernel can DMA straight into it instead of copying every packet. That
+ * isn't available everywhere, so fall back to malloc() when it fails.
+ */
+static uint8_t *_uvc_alloc_transfer_buf(uvc_stream_handle_t *strmh,
+    unsigned int transfer_id, size_t size, const uvc_stream_opts_t *opts) {
+  uint8_t *buf = NULL;
+
+#if LIBUSB_API_VERSION >= 0x01000105
+  if (opts && opts->use_dev_mem)
+    buf = libusb_dev_mem_alloc(strmh->devh->usb_devh, size);
+#endif
+
+  if (buf) {
+    strmh->transfer_dev_mem[transfer_id] = 1;
+    UVC_STAT_INC(strmh, transfer_bufs_dev_mem);
+  } else {
+    buf = malloc(size);
+    strmh->transfer_dev_mem[transfer_id] = 0;
+    UVC_STAT_INC(strmh, transfer_bufs_malloc);
+  }
+
+  return buf;
+}
+
+/** @internal
+ * @brief Free a transfer and its buffer
+ */
+static void _uvc_free_transfer(uvc_stream_handle_t *strmh, unsigned int transfer_id) {
+  struct libusb_transfer *transfer = strmh->transfers[transfer_id];
+
+  /* with direct_bulk, the buffer belongs to the frame buffer pool */
+  if (!strmh->direct_bulk) {
+#if LIBUSB_API_VERSION >= 0x01000105
+    if (strmh->transfer_dev_mem[transfer_id])
+      libusb_dev_mem_free(strmh->devh->usb_devh, transfer->buffer, transfer->length);
+    else
+#endif
+      free(transfer->buffer);
+  }
+
+  libusb_free_transfer(transfer);
+  strmh->transfers[transfer_id] = NULL;
+  strmh->transfer_bufs[transfer_id] = NULL;
+}
+
+/** @internal
+ * @brief Service interval of an isochronous endpoint in microseconds
+ */
+static unsigned int _uvc_iso_interval_us(uvc_stream_handle_t *strmh,
+    const struct libusb_endpoint_descriptor *endpoint) {
+  int speed = libusb_get_device_speed(libusb_get_device(strmh->devh->usb_devh));
+  unsigned int exponent = endpoint->bInterval > 0 ? endpoint->bInterval - 1 : 0;
+
+  if (exponent > 15)
+    exponent = 15;
+
+  /* bInterval counts 125 us microframes at high speed and above, 1 ms frames below */
+  return (speed >= LIBUSB_SPEED_HIGH ? 125 : 1000) << exponent;
+}
+
+/** @internal
+ * @brief Pick the number of transfers to keep in flight
+ *
+ * @param transfer_us Time it takes the device to fill one transfer, or zero if unknown
+ */
+static unsigned int _uvc_stream_num_transfers(uvc_stream_handle_t *strmh,
+    const uvc_stream_opts_t *opts, uint64_t transfer_us) {
+  uint64_t frame_us = strmh->cur_ctrl.dwFrameInterval / 10;
+  uint64_t num_transfers;
+
+  if (opts && opts->num_transfers)
+    return opts->num_transfers;
+
+  if (!opts || !opts->target_latency_us || !transfer_us || !frame_us)
+    return LIBUVC_NUM_TRANSFER_BUFS;
+
+  /* Keep about two frames' worth of transfers queued so that scheduling
+   * delays on the host don't cause missed transfers */
+  num_transfers = (2 * frame_us + transfer_us - 1) / transfer_us;
+
+  if (num_transfers < LIBUVC_MIN_TRANSFER_BUFS)
+    num_transfers = LIBUVC_MIN_TRANSFER_BUFS;
+  if (num_transfers > LIBUVC_NUM_TRANSFER_BUFS)
+    num_transfers = LIBUVC_NUM_TRANSFER_BUFS;
+
+  return (unsigned int) num_transfers;
+}
+
+/** @internal
+ * @brief Work out which bytes of each incoming frame fall inside the ROI
+ */
+static uvc_error_t _uvc_stream_setup_roi(uvc_stream_handle_t *strmh,
+    const uvc_frame_desc_t *frame_desc) {
+  const uvc_roi_t *roi = &strmh->roi;
+  size_t pixel_bytes = _uvc_packed_pixel_bytes(strmh->frame_format);
+
+  strmh->roi_in_step = 0;
+
+  if (!roi->width)
+    return UVC_SUCCESS;
+
+  if (!pixel_bytes)
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  if (roi->x > frame_desc->wWidth || roi->width > frame_desc->wWidth - roi->x
+      || roi->y > frame_desc->wHeight || roi->height > frame_desc->wHeight - roi->y)
+    return UVC_ERROR_INVALID_PARAM;
+
+  switch (strmh->frame_format) {
+  case UVC_FRAME_FORMAT_YUYV:
+  case UVC_FRAME_FORMAT_UYVY:
+    /* keep whole pixel pairs */
+    if (roi->x & 1 || roi->width & 1)
+      return UVC_ERROR_INVALID_PARAM;
+    break;
+  case UVC_FRAME_FORMAT_BY8:
+  case UVC_FRAME_FORMAT_BA81:
+  case UVC_FRAME_FORMAT_SGRBG8:
+  case UVC_FRAME_FORMAT_SGBRG8:
+  case UVC_FRAME_FORMAT_SRGGB8:
+  case UVC_FRAME_FORMAT_SBGGR8:
+    /* keep the colour pattern */
+    if (roi->x & 1 || roi->y & 1)
+      return UVC_ERROR_INVALID_PARAM;
+    break;
+  default:
+    break;
+  }
+
+  strmh->roi_in_step = frame_desc->wWidth * pixel_bytes;
+  strmh->roi_start = roi->x * pixel_bytes;
+  strmh->roi_out_step = roi->width * pixel_bytes;
+
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Pick the converter for the stream's conversion format
+ */
+static uvc_error_t _uvc_stream_setup_convert(uvc_stream_handle_t *strmh,
+    const uvc_frame_desc_t *frame_desc) {
+  strmh->conv_func = NULL;
+
+  if (strmh->conv_format == UVC_FRAME_FORMAT_ANY)
+    return UVC_SUCCESS;
+
+  switch (strmh->frame_format) {
+  case UVC_FRAME_FORMAT_YUYV:
+    if (strmh->conv_format == UVC_FRAME_FORMAT_RGB)
+      strmh->conv_func = uvc_yuyv2rgb;
+    else if (strmh->conv_format == UVC_FRAME_FORMAT_BGR)
+      strmh->conv_func = uvc_yuyv2bgr;
+    else if (strmh->conv_format == UVC_FRAME_FORMAT_GRAY8)
+      strmh->conv_func = uvc_yuyv2y;
+    break;
+  case UVC_FRAME_FORMAT_UYVY:
+    if (strmh->conv_format == UVC_FRAME_FORMAT_RGB)
+      strmh->conv_func = uvc_uyvy2rgb;
+    else if (strmh->conv_format == UVC_FRAME_FORMAT_BGR)
+      strmh->conv_func = uvc_uyvy2bgr;
+    break;
+  default:
+    break;
+  }
+
+  if (!strmh->conv_func)
+    return UVC_ERROR_NOT_SUPPORTED;
+
+  if (strmh->roi_in_step) {
+    strmh->conv_width = strmh->roi.width;
+    strmh->conv_height = strmh->roi.height;
+  } else {
+    strmh->conv_width = frame_desc->wWidth;
+    strmh->conv_height = frame_desc->wHeight;
+  }
+
+  strmh->conv_in_step = strmh->conv_width * 2;
+  strmh->conv_out_step = strmh->conv_width * _uvc_packed_pixel_bytes(strmh->conv_format);
+
+  return UVC_SUCCESS;
+}
+
 /** Begin streaming video from the stream into the callback function.
  * @ingroup streaming
  *
@@ -1078,7 +1939,34 @@ uvc_error_t uvc_stream_start(
     void *user_ptr,
     uint8_t flags
 ) {
-  /* USB interface we'll be using */
+  return uvc_stream_start_opts(strmh, cb, user_ptr, flags, NULL);
+}
+
+/** Begin streaming video from the stream into the callback function, with
+ * control over the USB transfers used.
+ * @ingroup streaming
+ *
+ * By default a stream keeps LIBUVC_NUM_TRANSFER_BUFS transfers in flight,
+ * with isochronous transfers of up to 32 packets and bulk transfers of
+ * dwMaxPayloadTransferSize bytes. That is generous for a single camera but
+ * uses a lot of memory when many are open. Setting opts->target_latency_us
+ * sizes each transfer to complete within that time at the negotiated frame
+ * size and rate, and keeps about two frame intervals of transfers in flight.
+ * Any nonzero field of opts overrides the derived value.
+ *
+ * @param strmh UVC stream
+ * @param cb   User callback function. See {uvc_frame_callback_t} for restrictions.
+ * @param flags Stream setup flags, currently undefined. Set this to zero. The lower bit
+ * is reserved for backward compatibility.
+ * @param opts Transfer options, or NULL for the defaults
+ */
+uvc_error_t uvc_stream_start_opts(
+    uvc_stream_handle_t *strmh,
+    uvc_frame_callback_t *cb,
+    void *user_ptr,
+    uint8_t flags,
+    const uvc_stream_opts_t *opts
+) {  /* USB interface we'll be using */
   const struct libusb_interface *interface;
   int interface_id;
   char isochronous;
@@ -1089,7 +1977,7 @@ uvc_error_t uvc_stream_start(
   /* Total amount of data per transfer */
   size_t total_transfer_size = 0;
   struct libusb_transfer *transfer;
-  int transfer_id;
+  unsigned int transfer_id;
 
   ctrl = &strmh->cur_ctrl;
 
@@ -1105,6 +1993,12 @@ uvc_error_t uvc_stream_start(
   strmh->fid = 0;
   strmh->pts = 0;
   strmh->last_scr = 0;
+  strmh->bulk_payload_bytes = 0;
+  strmh->iso_interval_us = 0;
+  /* these two describe the buffers of this start only */
+  __atomic_store_n(&strmh->stats.transfer_bufs_dev_mem, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&strmh->stats.transfer_bufs_malloc, 0, __ATOMIC_RELAXED);
+  uvc_clock_reset(&strmh->clock, ctrl->dwClockFrequency);
 
   frame_desc = uvc_find_frame_desc_stream(strmh, ctrl->bFormatIndex, ctrl->bFrameIndex);
   if (!frame_desc) {
@@ -1119,6 +2013,30 @@ uvc_error_t uvc_stream_start(
     goto fail;
   }
 
+  if (!strmh->color_override) {
+    /* UVC doesn't signal the quantization range; assume full range, as the
+     * conversions always have */
+    switch (format_desc->bMatrixCoefficients) {
+    case 1: /* BT.709 */
+    case 5: /* SMPTE 240M, close enough to BT.709 */
+      strmh->color_matrix = UVC_COLOR_MATRIX_BT709;
+      break;
+    default:
+      /* BT.601 is also what the spec says to assume without a descriptor */
+      strmh->color_matrix = UVC_COLOR_MATRIX_BT601;
+      break;
+    }
+    strmh->color_range = UVC_COLOR_RANGE_FULL;
+  }
+
+  ret = _uvc_stream_setup_roi(strmh, frame_desc);
+  if (ret != UVC_SUCCESS)
+    goto fail;
+
+  ret = _uvc_stream_setup_convert(strmh, frame_desc);
+  if (ret != UVC_SUCCESS)
+    goto fail;
+
   // Get the interface that provides the chosen format and frame configuration
   interface_id = strmh->stream_if->bInterfaceNumber;
   interface = &strmh->devh->info->config->interface[interface_id];
@@ -1139,6 +2057,8 @@ uvc_error_t uvc_stream_start(
     size_t packets_per_transfer = 0;
     /* Size of packet transferable from the chosen endpoint */
     size_t endpoint_bytes_per_packet = 0;
+    /* Service interval of the chosen endpoint */
+    unsigned int interval_us = 0;
     /* Index of the altsetting */
     int alt_idx, ep_idx;
     
@@ -1178,12 +2098,27 @@ uvc_error_t uvc_stream_start(
       if (endpoint_bytes_per_packet >= config_bytes_per_packet) {
         /* Transfers will be at most one frame long: Divide the maximum frame size
          * by the size of the endpoint and round up */
-        packets_per_transfer = (ctrl->dwMaxVideoFrameSize +
+        size_t frame_packets = (ctrl->dwMaxVideoFrameSize +
                                 endpoint_bytes_per_packet - 1) / endpoint_bytes_per_packet;
 
-        /* But keep a reasonable limit: Otherwise we start dropping data */
-        if (packets_per_transfer > 32)
-          packets_per_transfer = 32;
+        interval_us = _uvc_iso_interval_us(strmh, endpoint);
+        strmh->iso_interval_us = interval_us;
+
+        if (opts && opts->packets_per_transfer) {
+          packets_per_transfer = opts->packets_per_transfer;
+        } else if (opts && opts->target_latency_us) {
+          /* One packet per service interval */
+          packets_per_transfer = opts->target_latency_us / interval_us;
+          if (packets_per_transfer < 1)
+            packets_per_transfer = 1;
+          if (packets_per_transfer > frame_packets)
+            packets_per_transfer = frame_packets;
+        } else {
+          /* But keep a reasonable limit: Otherwise we start dropping data */
+          packets_per_transfer = frame_packets;
+          if (packets_per_transfer > 32)
+            packets_per_transfer = 32;
+        }
         
         total_transfer_size = packets_per_transfer * endpoint_bytes_per_packet;
         break;
@@ -1205,36 +2140,108 @@ uvc_error_t uvc_stream_start(
       goto fail;
     }
 
+    ret = _uvc_stream_alloc_transfer_arrays(strmh,
+        _uvc_stream_num_transfers(strmh, opts, packets_per_transfer * interval_us));
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
+    ret = _uvc_stream_alloc_frame_bufs(strmh);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
     /* Set up the transfers */
-    for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS; ++transfer_id) {
+    for (transfer_id = 0; transfer_id < strmh->num_transfers; ++transfer_id) {
       transfer = libusb_alloc_transfer(packets_per_transfer);
       strmh->transfers[transfer_id] = transfer;      
-      strmh->transfer_bufs[transfer_id] = malloc(total_transfer_size);
+      strmh->transfer_bufs[transfer_id] = _uvc_alloc_transfer_buf(strmh, transfer_id,
+          total_transfer_size, opts);
 
       libusb_fill_iso_transfer(
         transfer, strmh->devh->usb_devh, format_desc->parent->bEndpointAddress,
         strmh->transfer_bufs[transfer_id],
         total_transfer_size, packets_per_transfer, _uvc_stream_callback, (void*) strmh, 5000);
 
-      libusb_set_iso_packet_lengths(transfer, endpoint_bytes_per_packet);
-    }
-  } else {
-    for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS;
+      libusb_set_iso_packet_lengths(transfer, endpoint_bytes_per_packet);
+    }
+  } else {
+    /* Bulk payloads may be split across transfers, which then have to be a
+     * multiple of the endpoint's packet size for short transfers to mark the
+     * end of a payload */
+    size_t max_payload = ctrl->dwMaxPayloadTransferSize;
+    size_t endpoint_bytes_per_packet = 0;
+    /* Device throughput in bytes per microsecond */
+    double bytes_per_us = 0;
+    int ep_idx;
+
+    for (ep_idx = 0; ep_idx < interface->altsetting[0].bNumEndpoints; ep_idx++) {
+      const struct libusb_endpoint_descriptor *endpoint =
+        interface->altsetting[0].endpoint + ep_idx;
+
+      if (endpoint->bEndpointAddress == format_desc->parent->bEndpointAddress) {
+        endpoint_bytes_per_packet = endpoint->wMaxPacketSize & 0x07ff;
+        break;
+      }
+    }
+    if (endpoint_bytes_per_packet == 0)
+      endpoint_bytes_per_packet = 512;
+
+    if (ctrl->dwFrameInterval)
+      bytes_per_us = ctrl->dwMaxVideoFrameSize * 10.0 / ctrl->dwFrameInterval;
+
+    strmh->bulk_transfer_size = max_payload;
+    if (opts && opts->bulk_transfer_size)
+      strmh->bulk_transfer_size = opts->bulk_transfer_size;
+    else if (opts && opts->target_latency_us && bytes_per_us > 0)
+      strmh->bulk_transfer_size = (size_t) (bytes_per_us * opts->target_latency_us);
+
+    if (strmh->bulk_transfer_size < max_payload) {
+      strmh->bulk_transfer_size = (strmh->bulk_transfer_size + endpoint_bytes_per_packet - 1)
+        / endpoint_bytes_per_packet * endpoint_bytes_per_packet;
+    }
+    if (strmh->bulk_transfer_size > max_payload)
+      strmh->bulk_transfer_size = max_payload;
+
+    ret = _uvc_stream_alloc_transfer_arrays(strmh,
+        _uvc_stream_num_transfers(strmh, opts,
+          bytes_per_us > 0 ? (uint64_t) (strmh->bulk_transfer_size / bytes_per_us) + 1 : 0));
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
+    /* If a whole frame fits in one payload, receive straight into the frame
+     * buffers; each transfer then needs a buffer of its own from the pool */
+    strmh->direct_bulk = opts && opts->direct_bulk
+      && strmh->bulk_transfer_size == max_payload
+      && max_payload > ctrl->dwMaxVideoFrameSize;
+
+    ret = _uvc_stream_alloc_frame_bufs(strmh);
+    if (ret != UVC_SUCCESS)
+      goto fail;
+
+    for (transfer_id = 0; transfer_id < strmh->num_transfers;
         ++transfer_id) {
       transfer = libusb_alloc_transfer(0);
       strmh->transfers[transfer_id] = transfer;
-      strmh->transfer_bufs[transfer_id] = malloc (
-          strmh->cur_ctrl.dwMaxPayloadTransferSize );
+      if (strmh->direct_bulk) {
+        struct uvc_frame_buffer *fb = &strmh->frame_bufs[strmh->num_frame_bufs - 1 - transfer_id];
+
+        fb->in_transfer = 1;
+        strmh->transfer_bufs[transfer_id] = fb->data;
+      } else {
+        strmh->transfer_bufs[transfer_id] = _uvc_alloc_transfer_buf(strmh, transfer_id,
+            strmh->bulk_transfer_size, opts);
+      }
       libusb_fill_bulk_transfer ( transfer, strmh->devh->usb_devh,
           format_desc->parent->bEndpointAddress,
           strmh->transfer_bufs[transfer_id],
-          strmh->cur_ctrl.dwMaxPayloadTransferSize, _uvc_stream_callback,
+          strmh->bulk_transfer_size, _uvc_stream_callback,
           ( void* ) strmh, 5000 );
     }
   }
 
   strmh->user_cb = cb;
   strmh->user_ptr = user_ptr;
+  _uvc_copy_thread_opts(&strmh->cb_thread_opts, strmh->cb_thread_name,
+                        opts ? &opts->callback_thread : NULL);
 
   /* If the user wants it, set up a thread that calls the user's function
    * with the contents of each frame.
@@ -1243,7 +2250,7 @@ uvc_error_t uvc_stream_start(
     pthread_create(&strmh->cb_thread, NULL, _uvc_user_caller, (void*) strmh);
   }
 
-  for (transfer_id = 0; transfer_id < LIBUVC_NUM_TRANSFER_BUFS;
+  for (transfer_id = 0; transfer_id < strmh->num_transfers;
       transfer_id++) {
     ret = libusb_submit_transfer(strmh->transfers[transfer_id]);
     if (ret != UVC_SUCCESS) {
@@ -1252,11 +2259,9 @@ uvc_error_t uvc_stream_start(
     }
   }
 
-  if ( ret != UVC_SUCCESS && transfer_id >= 0 ) {
-    for ( ; transfer_id < LIBUVC_NUM_TRANSFER_BUFS; transfer_id++) {
-      free ( strmh->transfers[transfer_id]->buffer );
-      libusb_free_transfer ( strmh->transfers[transfer_id]);
-      strmh->transfers[transfer_id] = 0;
+  if ( ret != UVC_SUCCESS ) {
+    for ( ; transfer_id < strmh->num_transfers; transfer_id++) {
+      _uvc_free_transfer(strmh, transfer_id);
     }
     ret = UVC_SUCCESS;
   }
@@ -1265,6 +2270,7 @@ uvc_error_t uvc_stream_start(
   return ret;
 fail:
   strmh->running = 0;
+  _uvc_stream_free_transfer_arrays(strmh);
   UVC_EXIT(ret);
   return ret;
 }
@@ -1295,38 +2301,46 @@ uvc_error_t uvc_stream_start_iso(
  */
 void *_uvc_user_caller(void *arg) {
   uvc_stream_handle_t *strmh = (uvc_stream_handle_t *) arg;
+  struct uvc_frame_buffer *fb;
+  uvc_frame_t *frame;
+  uint32_t seen;
 
-  uint32_t last_seq = 0;
+  _uvc_apply_thread_opts(&strmh->cb_thread_opts, "uvc_callback");
 
   do {
-    pthread_mutex_lock(&strmh->cb_mutex);
+    seen = _uvc_wait_word_load(&strmh->frame_ready);
 
-    while (strmh->running && last_seq == strmh->hold_seq) {
-      pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
+    if (!__atomic_load_n(&strmh->running, __ATOMIC_ACQUIRE))
+      break;
+
+    fb = _uvc_dequeue_frame(strmh);
+    if (!fb) {
+      _uvc_wait_word_wait(&strmh->frame_ready, seen, NULL);
+      continue;
     }
 
-    if (!strmh->running) {
-      pthread_mutex_unlock(&strmh->cb_mutex);
-      break;
+    if (strmh->max_leases) {
+      frame = _uvc_lease_frame(strmh, fb);
+    } else {
+      _uvc_populate_frame(strmh, fb);
+      _uvc_return_buffer(strmh, fb);
+      frame = &strmh->frame;
     }
     
-    last_seq = strmh->hold_seq;
-    _uvc_populate_frame(strmh);
-    
-    pthread_mutex_unlock(&strmh->cb_mutex);
-    
-    strmh->user_cb(&strmh->frame, strmh->user_ptr);
+    strmh->user_cb(frame, strmh->user_ptr);
+
+    if (strmh->max_leases)
+      uvc_release_frame(frame);
   } while(1);
 
   return NULL; // return value ignored
 }
 
 /** @internal
- * @brief Populate the fields of a frame to be handed to user code
- * must be called with stream cb lock held!
+ * @brief Populate the format and timing fields of a frame from a dequeued buffer
  */
-void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
-  uvc_frame_t *frame = &strmh->frame;
+static void _uvc_populate_frame_info(uvc_stream_handle_t *strmh,
+    struct uvc_frame_buffer *fb, uvc_frame_t *frame) {
   uvc_frame_desc_t *frame_desc;
 
   /** @todo this stuff that hits the main config cache should really happen
@@ -1338,52 +2352,123 @@ void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
 				   strmh->cur_ctrl.bFrameIndex);
 
   frame->frame_format = strmh->frame_format;
+  frame->color_matrix = strmh->color_matrix;
+  frame->color_range = strmh->color_range;
   
-  frame->width = frame_desc->wWidth;
-  frame->height = frame_desc->wHeight;
+  if (strmh->roi_in_step) {
+    frame->width = strmh->roi.width;
+    frame->height = strmh->roi.height;
+  } else {
+    frame->width = frame_desc->wWidth;
+    frame->height = frame_desc->wHeight;
+  }
   
   switch (frame->frame_format) {
-  case UVC_FRAME_FORMAT_BGR:
-    frame->step = frame->width * 3;
-    break;
-  case UVC_FRAME_FORMAT_YUYV:
-    frame->step = frame->width * 2;
-    break;
   case UVC_FRAME_FORMAT_NV12:
+  case UVC_FRAME_FORMAT_I420:
     frame->step = frame->width;
     break;
   case UVC_FRAME_FORMAT_P010:
     frame->step = frame->width * 2;
         break;
-  case UVC_FRAME_FORMAT_MJPEG:
-    frame->step = 0;
-    break;
-  case UVC_FRAME_FORMAT_H264:
-    frame->step = 0;
-    break;
   default:
-    frame->step = 0;
+    /* zero for compressed formats */
+    frame->step = frame->width * _uvc_packed_pixel_bytes(frame->frame_format);
     break;
   }
 
-  frame->sequence = strmh->hold_seq;
-  frame->capture_time_finished = strmh->capture_time_finished;
-
-  /* copy the image data from the hold buffer to the frame (unnecessary extra buf?) */
-  if (frame->data_bytes < strmh->hold_bytes) {
-    frame->data = realloc(frame->data, strmh->hold_bytes);
+  if (strmh->conv_func) {
+    frame->frame_format = strmh->conv_format;
+    frame->step = strmh->conv_out_step;
   }
-  frame->data_bytes = strmh->hold_bytes;
-  memcpy(frame->data, strmh->holdbuf, frame->data_bytes);
 
-  if (strmh->meta_hold_bytes > 0)
+  frame->sequence = fb->seq;
+  frame->capture_time = fb->capture_time;
+  frame->capture_time_finished = fb->capture_time_finished;
+}
+
+/** @internal
+ * @brief Copy a dequeued buffer into the frame handed to user code
+ */
+void _uvc_populate_frame(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *fb) {
+  uvc_frame_t *frame = &strmh->frame;
+
+  uint8_t *data = strmh->conv_func ? fb->conv_data : fb->data + fb->offset;
+  size_t bytes = strmh->conv_func ? fb->conv_bytes : fb->bytes;
+
+  _uvc_populate_frame_info(strmh, fb, frame);
+
+  /* copy the image data from the frame buffer to the frame */
+  if (uvc_ensure_frame_size(frame, bytes) == UVC_SUCCESS)
+    memcpy(frame->data, data, bytes);
+  else
+    frame->data_bytes = 0;
+
+  if (fb->meta_bytes > 0)
   {
-      if (frame->metadata_bytes < strmh->meta_hold_bytes)
+      if (frame->metadata_bytes < fb->meta_bytes)
       {
-          frame->metadata = realloc(frame->metadata, strmh->meta_hold_bytes);
+          frame->metadata = realloc(frame->metadata, fb->meta_bytes);
       }
-      frame->metadata_bytes = strmh->meta_hold_bytes;
-      memcpy(frame->metadata, strmh->meta_holdbuf, frame->metadata_bytes);
+      frame->metadata_bytes = fb->meta_bytes;
+      memcpy(frame->metadata, fb->meta, frame->metadata_bytes);
+  }
+}
+
+/** @internal
+ * @brief Lease a dequeued frame buffer to user code without copying it
+ */
+static uvc_frame_t *_uvc_lease_frame(uvc_stream_handle_t *strmh, struct uvc_frame_buffer *fb) {
+  uvc_frame_t *frame = &fb->frame;
+
+  /* take the lease before handing the buffer back, so it stays in use */
+  __atomic_store_n(&fb->refs, 1, __ATOMIC_RELAXED);
+  _uvc_return_buffer(strmh, fb);
+
+  _uvc_populate_frame_info(strmh, fb, frame);
+
+  frame->library_owns_data = 0;
+  if (strmh->conv_func) {
+    frame->data = fb->conv_data;
+    frame->data_bytes = fb->conv_bytes;
+  } else {
+    frame->data = fb->data + fb->offset;
+    frame->data_bytes = fb->bytes;
+  }
+  frame->metadata = fb->meta_bytes > 0 ? fb->meta : NULL;
+  frame->metadata_bytes = fb->meta_bytes;
+
+  return frame;
+}
+
+/** @internal
+ * @brief Wait until the frame queue is not empty or the stream stops
+ *
+ * @param timeout_us >0: Wait at most N microseconds; 0: Wait indefinitely; -1: return immediately
+ */
+static uvc_error_t _uvc_wait_for_frame(uvc_stream_handle_t *strmh, int32_t timeout_us) {
+  struct timespec deadline;
+  uint32_t seen;
+
+  if (timeout_us > 0) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_us / 1000000;
+    deadline.tv_nsec += (timeout_us % 1000000) * 1000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec = deadline.tv_nsec % 1000000000;
+  }
+
+  for (;;) {
+    seen = _uvc_wait_word_load(&strmh->frame_ready);
+
+    if (timeout_us == -1 || !__atomic_load_n(&strmh->running, __ATOMIC_ACQUIRE)
+        || __atomic_load_n(&strmh->queue_head, __ATOMIC_ACQUIRE)
+           != __atomic_load_n(&strmh->queue_tail, __ATOMIC_ACQUIRE))
+      return UVC_SUCCESS;
+
+    if (_uvc_wait_word_wait(&strmh->frame_ready, seen,
+                            timeout_us > 0 ? &deadline : NULL) == ETIMEDOUT)
+      return UVC_ERROR_TIMEOUT;
   }
 }
 
@@ -1397,9 +2482,8 @@ void _uvc_populate_frame(uvc_stream_handle_t *strmh) {
 uvc_error_t uvc_stream_get_frame(uvc_stream_handle_t *strmh,
 			  uvc_frame_t **frame,
 			  int32_t timeout_us) {
-  time_t add_secs;
-  time_t add_nsecs;
-  struct timespec ts;
+  struct uvc_frame_buffer *fb;
+  uvc_error_t ret;
 
   if (!strmh->running)
     return UVC_ERROR_INVALID_PARAM;
@@ -1407,64 +2491,282 @@ uvc_error_t uvc_stream_get_frame(uvc_stream_handle_t *strmh,
   if (strmh->user_cb)
     return UVC_ERROR_CALLBACK_EXISTS;
 
-  pthread_mutex_lock(&strmh->cb_mutex);
+  ret = _uvc_wait_for_frame(strmh, timeout_us);
 
-  if (strmh->last_polled_seq < strmh->hold_seq) {
-    _uvc_populate_frame(strmh);
+  if (ret == UVC_SUCCESS && (fb = _uvc_dequeue_frame(strmh))) {
+    _uvc_populate_frame(strmh, fb);
+    _uvc_return_buffer(strmh, fb);
     *frame = &strmh->frame;
-    strmh->last_polled_seq = strmh->hold_seq;
-  } else if (timeout_us != -1) {
-    if (timeout_us == 0) {
-      pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
-    } else {
-      add_secs = timeout_us / 1000000;
-      add_nsecs = (timeout_us % 1000000) * 1000;
-      ts.tv_sec = 0;
-      ts.tv_nsec = 0;
+  } else {
+    *frame = NULL;
+  }
 
-#if _POSIX_TIMERS > 0
-      clock_gettime(CLOCK_REALTIME, &ts);
-#else
-      struct timeval tv;
-      gettimeofday(&tv, NULL);
-      ts.tv_sec = tv.tv_sec;
-      ts.tv_nsec = tv.tv_usec * 1000;
-#endif
+  return ret;
+}
 
-      ts.tv_sec += add_secs;
-      ts.tv_nsec += add_nsecs;
+/** @brief Limit the number of frames the user may lease from a stream
+ * @ingroup streaming
+ *
+ * By default each frame is copied out of the stream's assembly buffer before
+ * it is handed to the user. Once leasing is enabled, frames are instead
+ * delivered straight from a pool of assembly buffers: the callback receives a
+ * lease that is returned when the callback exits, unless the callback takes
+ * another reference with uvc_acquire_frame(). Polling users get leases from
+ * uvc_stream_acquire_frame() and must give them back with uvc_release_frame().
+ *
+ * The stream allocates max_leases frame buffers on top of the ones used by
+ * its frame queue. If the user holds on to more than max_leases frames, new
+ * frames are dropped (or, with UVC_QUEUE_BLOCK, assembly stalls) until one
+ * is released.
+ *
+ * This must be called while the stream is stopped. All leases must be
+ * released before the stream is restarted or closed.
+ *
+ * @param strmh UVC stream
+ * @param max_leases Number of frames the user may hold at once, or zero to
+ *        disable leasing and copy every frame
+ */
+uvc_error_t uvc_stream_set_frame_leases(uvc_stream_handle_t *strmh, unsigned int max_leases) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
 
-      /* pthread_cond_timedwait FAILS with EINVAL if ts.tv_nsec > 1000000000 (1 billion)
-       * Since we are just adding values to the timespec, we have to increment the seconds if nanoseconds is greater than 1 billion,
-       * and then re-adjust the nanoseconds in the correct range.
-       * */
-      ts.tv_sec += ts.tv_nsec / 1000000000;
-      ts.tv_nsec = ts.tv_nsec % 1000000000;
+  strmh->max_leases = max_leases;
+  return UVC_SUCCESS;
+}
 
-      int err = pthread_cond_timedwait(&strmh->cb_cond, &strmh->cb_mutex, &ts);
+/** @brief Convert frames while they arrive
+ * @ingroup streaming
+ *
+ * Normally a frame can only be converted once it is complete. With a
+ * conversion format set, the stream converts each row of the frame as soon
+ * as its data has arrived, while the rest of the frame is still coming in,
+ * and hands the converted frame to the user. The conversion is done by the
+ * thread handling USB events, and is finished almost as soon as the last
+ * payload of the frame is received, so this cuts latency rather than CPU
+ * time.
+ *
+ * YUYV frames can be converted to UVC_FRAME_FORMAT_RGB, UVC_FRAME_FORMAT_BGR
+ * or UVC_FRAME_FORMAT_GRAY8, and UYVY frames to UVC_FRAME_FORMAT_RGB or
+ * UVC_FRAME_FORMAT_BGR; starting the stream fails with
+ * UVC_ERROR_NOT_SUPPORTED for any other combination. This can be combined
+ * with uvc_stream_set_roi(), in which case only the rectangle is converted.
+ *
+ * This must be called while the stream is stopped.
+ *
+ * @param strmh UVC stream
+ * @param format Format to convert to, or UVC_FRAME_FORMAT_ANY to deliver
+ *        frames as they are received
+ */
+uvc_error_t uvc_stream_set_convert(uvc_stream_handle_t *strmh, enum uvc_frame_format format) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
 
-      //TODO: How should we handle EINVAL?
-      if (err) {
-        *frame = NULL;
-        pthread_mutex_unlock(&strmh->cb_mutex);
-        return err == ETIMEDOUT ? UVC_ERROR_TIMEOUT : UVC_ERROR_OTHER;
-      }
-    }
-    
-    if (strmh->last_polled_seq < strmh->hold_seq) {
-      _uvc_populate_frame(strmh);
-      *frame = &strmh->frame;
-      strmh->last_polled_seq = strmh->hold_seq;
-    } else {
-      *frame = NULL;
-    }
+  strmh->conv_format = format;
+  return UVC_SUCCESS;
+}
+
+/** @brief Keep only part of each frame
+ * @ingroup streaming
+ *
+ * Frames are cropped while they are assembled: only the bytes inside the
+ * rectangle are copied out of the incoming payloads, and the frames handed
+ * to the user are the size of the rectangle. This works for uncompressed
+ * formats that store whole pixels side by side (YUYV, UYVY, RGB, BGR, gray
+ * and raw Bayer); starting the stream fails with UVC_ERROR_NOT_SUPPORTED
+ * for any other format. For YUYV and UYVY the rectangle must start on an
+ * even column and have an even width; for raw Bayer formats it must start
+ * on an even column and row.
+ *
+ * Frames that arrive whole in a single bulk transfer are normally handed
+ * over without copying; with a ROI they are copied like any other.
+ *
+ * This must be called while the stream is stopped.
+ *
+ * @param strmh UVC stream
+ * @param roi Rectangle to keep, or NULL to keep whole frames
+ */
+uvc_error_t uvc_stream_set_roi(uvc_stream_handle_t *strmh, const uvc_roi_t *roi) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if (!roi) {
+    memset(&strmh->roi, 0, sizeof(strmh->roi));
+    return UVC_SUCCESS;
+  }
+
+  if (!roi->width || !roi->height)
+    return UVC_ERROR_INVALID_PARAM;
+
+  strmh->roi = *roi;
+  return UVC_SUCCESS;
+}
+
+/** @brief Override the colorimetry of the stream's frames
+ * @ingroup streaming
+ *
+ * By default, frames are tagged with the matrix from the format's color
+ * matching descriptor (BT.601 if there is none) and with full range, since
+ * UVC has no way to signal the range. Cameras that produce limited-range
+ * ("studio swing") video look washed out when converted as full range; call
+ * this to convert their frames with the right range and matrix.
+ *
+ * The values are stored in each frame's color_matrix and color_range and
+ * used by the YUV to RGB conversions. This must be called while the stream
+ * is stopped.
+ *
+ * @param strmh UVC stream
+ * @param matrix Matrix coefficients of the video
+ * @param range Quantization range of the video
+ */
+uvc_error_t uvc_stream_set_colorimetry(uvc_stream_handle_t *strmh,
+    enum uvc_color_matrix matrix, enum uvc_color_range range) {
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  if ((unsigned) matrix > UVC_COLOR_MATRIX_BT2020 || (unsigned) range > UVC_COLOR_RANGE_LIMITED)
+    return UVC_ERROR_INVALID_PARAM;
+
+  strmh->color_matrix = matrix;
+  strmh->color_range = range;
+  strmh->color_override = 1;
+  return UVC_SUCCESS;
+}
+
+/** @brief Configure the queue of completed frames
+ * @ingroup streaming
+ *
+ * Completed frames wait in a queue of up to depth frames until the callback
+ * thread or a polling call picks them up, so that a consumer that falls
+ * behind for a moment doesn't lose frames. The policy decides what happens
+ * when a frame completes while the queue is full; uvc_stream_get_stats()
+ * reports how often that happened.
+ *
+ * The default is a depth of 1 with UVC_QUEUE_DROP_OLDEST, i.e. consumers
+ * always see the most recent frame. Note that UVC_QUEUE_BLOCK stalls the USB
+ * event thread while the queue is full, which may cause transfers to be lost
+ * instead.
+ *
+ * This must be called while the stream is stopped.
+ *
+ * @param strmh UVC stream
+ * @param depth Number of completed frames to hold, at least 1
+ * @param policy What to do with a new frame when the queue is full
+ */
+uvc_error_t uvc_stream_set_frame_queue(uvc_stream_handle_t *strmh,
+    unsigned int depth,
+    enum uvc_queue_policy policy) {
+  if (depth < 1)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (strmh->running)
+    return UVC_ERROR_BUSY;
+
+  /* the queue array is sized along with the frame buffers */
+  if (depth != strmh->queue_depth)
+    strmh->frame_buf_bytes = 0;
+
+  strmh->queue_depth = depth;
+  strmh->queue_policy = policy;
+  return UVC_SUCCESS;
+}
+
+/** @brief Get counters describing the health of a stream
+ * @ingroup streaming
+ *
+ * The counters are updated atomically by the USB event thread and the frame
+ * consumers, so they can be polled at any time, e.g. to tell a starved USB
+ * bus (bad packets, failed transfers, FID resyncs) apart from a slow
+ * consumer (dropped frames, queue blocks). Divide the growth of
+ * bytes_received or frames_completed by the polling interval for throughput.
+ *
+ * @param strmh UVC stream
+ * @param[out] stats Location to store the counters
+ */
+uvc_error_t uvc_stream_get_stats(uvc_stream_handle_t *strmh, uvc_stream_stats_t *stats) {
+#define UVC_STAT_LOAD(counter) \
+  stats->counter = __atomic_load_n(&strmh->stats.counter, __ATOMIC_RELAXED)
+  UVC_STAT_LOAD(frames_completed);
+  UVC_STAT_LOAD(frames_fid_resync);
+  UVC_STAT_LOAD(frames_dropped_oldest);
+  UVC_STAT_LOAD(frames_dropped_newest);
+  UVC_STAT_LOAD(queue_blocks);
+  UVC_STAT_LOAD(bytes_received);
+  UVC_STAT_LOAD(transfers_completed);
+  UVC_STAT_LOAD(transfers_timed_out);
+  UVC_STAT_LOAD(transfers_stalled);
+  UVC_STAT_LOAD(transfers_overflowed);
+  UVC_STAT_LOAD(transfers_failed);
+  UVC_STAT_LOAD(packets_bad);
+  UVC_STAT_LOAD(payloads_error_bit);
+  UVC_STAT_LOAD(payloads_bogus_header);
+  UVC_STAT_LOAD(transfer_bufs_dev_mem);
+  UVC_STAT_LOAD(transfer_bufs_malloc);
+#undef UVC_STAT_LOAD
+
+  return UVC_SUCCESS;
+}
+
+/** Poll for a frame and lease it without copying
+ * @ingroup streaming
+ *
+ * The frame stays valid until it is passed to uvc_release_frame(). Leasing
+ * must have been enabled with uvc_stream_set_frame_leases().
+ *
+ * @param strmh UVC stream
+ * @param[out] frame Location to store pointer to leased frame (NULL on error)
+ * @param timeout_us >0: Wait at most N microseconds; 0: Wait indefinitely; -1: return immediately
+ */
+uvc_error_t uvc_stream_acquire_frame(uvc_stream_handle_t *strmh,
+    uvc_frame_t **frame,
+    int32_t timeout_us) {
+  struct uvc_frame_buffer *fb;
+  uvc_error_t ret;
+
+  if (!strmh->running)
+    return UVC_ERROR_INVALID_PARAM;
+
+  if (strmh->user_cb)
+    return UVC_ERROR_CALLBACK_EXISTS;
+
+  if (!strmh->max_leases)
+    return UVC_ERROR_INVALID_MODE;
+
+  ret = _uvc_wait_for_frame(strmh, timeout_us);
+
+  if (ret == UVC_SUCCESS && (fb = _uvc_dequeue_frame(strmh))) {
+    *frame = _uvc_lease_frame(strmh, fb);
   } else {
     *frame = NULL;
   }
 
-  pthread_mutex_unlock(&strmh->cb_mutex);
+  return ret;
+}
 
-  return UVC_SUCCESS;
+/** @brief Take another reference on a leased frame
+ * @ingroup streaming
+ *
+ * Lets a frame callback keep the frame it was given after it returns. Each
+ * call must be balanced by a call to uvc_release_frame().
+ *
+ * @param frame Frame leased from a stream
+ */
+void uvc_acquire_frame(uvc_frame_t *frame) {
+  struct uvc_frame_buffer *fb = (struct uvc_frame_buffer *) frame;
+
+  __atomic_add_fetch(&fb->refs, 1, __ATOMIC_RELAXED);
+}
+
+/** @brief Return a leased frame to its stream
+ * @ingroup streaming
+ *
+ * @param frame Frame leased from a stream
+ */
+void uvc_release_frame(uvc_frame_t *frame) {
+  struct uvc_frame_buffer *fb = (struct uvc_frame_buffer *) frame;
+
+  /* wake an assembler waiting for a free buffer */
+  if (__atomic_sub_fetch(&fb->refs, 1, __ATOMIC_RELEASE) == 0)
+    _uvc_wait_word_wake(&fb->strmh->buf_freed);
 }
 
 /** @brief Stop streaming video
@@ -1490,35 +2792,49 @@ void uvc_stop_streaming(uvc_device_handle_t *devh) {
  * @param devh UVC device
  */
 uvc_error_t uvc_stream_stop(uvc_stream_handle_t *strmh) {
-  int i;
+  unsigned int i;
 
   if (!strmh->running)
     return UVC_ERROR_INVALID_PARAM;
 
-  strmh->running = 0;
+  __atomic_store_n(&strmh->running, 0, __ATOMIC_SEQ_CST);
+
+  /* Kick the user thread awake, along with an assembler blocked waiting for
+   * room in the frame queue */
+  _uvc_wait_word_wake(&strmh->frame_ready);
+  _uvc_wait_word_wake(&strmh->buf_freed);
 
   pthread_mutex_lock(&strmh->cb_mutex);
 
   /* Attempt to cancel any running transfers, we can't free them just yet because they aren't
    *   necessarily completed but they will be free'd in _uvc_stream_callback().
    */
-  for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+  for(i=0; i < strmh->num_transfers; i++) {
     if(strmh->transfers[i] != NULL)
       libusb_cancel_transfer(strmh->transfers[i]);
   }
 
   /* Wait for transfers to complete/cancel */
   do {
-    for(i=0; i < LIBUVC_NUM_TRANSFER_BUFS; i++) {
+    for(i=0; i < strmh->num_transfers; i++) {
       if(strmh->transfers[i] != NULL)
         break;
     }
-    if(i == LIBUVC_NUM_TRANSFER_BUFS )
+    if(i == strmh->num_transfers )
       break;
-    pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
+    if (strmh->devh->dev->ctx->external_events) {
+      /* Nobody else is handling events, so the cancellations have to be
+       * processed here */
+      struct timeval tv = { 0, 100000 };
+
+      pthread_mutex_unlock(&strmh->cb_mutex);
+      libusb_handle_events_timeout_completed(strmh->devh->dev->ctx->usb_ctx, &tv, NULL);
+      pthread_mutex_lock(&strmh->cb_mutex);
+    } else {
+      pthread_cond_wait(&strmh->cb_cond, &strmh->cb_mutex);
+    }
   } while(1);
-  // Kick the user thread awake
-  pthread_cond_broadcast(&strmh->cb_cond);
+  _uvc_stream_free_transfer_arrays(strmh);
   pthread_mutex_unlock(&strmh->cb_mutex);
 
   /** @todo stop the actual stream, camera side? */
@@ -1548,15 +2864,125 @@ void uvc_stream_close(uvc_stream_handle_t *strmh) {
   if (strmh->frame.data)
     free(strmh->frame.data);
 
-  free(strmh->outbuf);
-  free(strmh->holdbuf);
-
-  free(strmh->meta_outbuf);
-  free(strmh->meta_holdbuf);
+  _uvc_stream_free_frame_bufs(strmh);
 
+  _uvc_wait_word_destroy(&strmh->buf_freed);
+  _uvc_wait_word_destroy(&strmh->frame_ready);
   pthread_cond_destroy(&strmh->cb_cond);
   pthread_mutex_destroy(&strmh->cb_mutex);
 
   DL_DELETE(strmh->devh->streams, strmh);
   free(strmh);
 }
+
+#ifdef LIBUVC_LOOPBACK
+/* A stream with no device behind it, for bench_handoff. Only its own copy
+ * of this file is built with LIBUVC_LOOPBACK; the library never is. */
+
+/** @internal
+ * @brief Open a stream with no device behind it
+ *
+ * Frames are fed in with _uvc_loopback_push() and taken out with
+ * _uvc_loopback_pop(), which go through the same frame queue and wakeups as
+ * a real stream. For measuring the handoff without a camera.
+ *
+ * @param frame_bytes Largest frame that will be pushed
+ */
+uvc_error_t _uvc_loopback_open(uvc_stream_handle_t **strmhp, size_t frame_bytes,
+    unsigned int queue_depth, enum uvc_queue_policy policy) {
+  uvc_stream_handle_t *strmh;
+  uvc_error_t ret;
+
+  if (!queue_depth || !frame_bytes)
+    return UVC_ERROR_INVALID_PARAM;
+
+  strmh = calloc(1, sizeof(*strmh));
+  if (!strmh)
+    return UVC_ERROR_NO_MEM;
+
+  strmh->frame.library_owns_data = 1;
+  strmh->queue_depth = queue_depth;
+  strmh->queue_policy = policy;
+  strmh->cur_ctrl.dwMaxVideoFrameSize = frame_bytes;
+
+  pthread_mutex_init(&strmh->cb_mutex, NULL);
+  pthread_cond_init(&strmh->cb_cond, NULL);
+  _uvc_wait_word_init(&strmh->frame_ready);
+  _uvc_wait_word_init(&strmh->buf_freed);
+
+  ret = _uvc_stream_alloc_frame_bufs(strmh);
+  if (ret != UVC_SUCCESS) {
+    _uvc_loopback_close(strmh);
+    return ret;
+  }
+
+  strmh->seq = 1;
+  strmh->running = 1;
+
+  *strmhp = strmh;
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Complete a frame on a loopback stream, as the assembler would
+ */
+void _uvc_loopback_push(uvc_stream_handle_t *strmh, const void *data, size_t bytes) {
+  if (bytes > strmh->frame_buf_bytes)
+    bytes = strmh->frame_buf_bytes;
+
+  memcpy(strmh->outbuf, data, bytes);
+  strmh->got_bytes = bytes;
+  _uvc_swap_buffers(strmh);
+}
+
+/** @internal
+ * @brief Take the oldest frame from a loopback stream
+ *
+ * @param timeout_us As for uvc_stream_get_frame()
+ * @param data Where to copy the start of the frame
+ * @param bytes Number of bytes to copy
+ * @return UVC_ERROR_TIMEOUT if no frame arrived in time or the stream was
+ * stopped
+ */
+uvc_error_t _uvc_loopback_pop(uvc_stream_handle_t *strmh, int32_t timeout_us,
+    void *data, size_t bytes) {
+  struct uvc_frame_buffer *fb;
+  uvc_error_t ret;
+
+  ret = _uvc_wait_for_frame(strmh, timeout_us);
+  if (ret != UVC_SUCCESS)
+    return ret;
+
+  fb = _uvc_dequeue_frame(strmh);
+  if (!fb)
+    return UVC_ERROR_TIMEOUT;
+
+  memcpy(data, fb->data + fb->offset, bytes < fb->bytes ? bytes : fb->bytes);
+  _uvc_return_buffer(strmh, fb);
+
+  return UVC_SUCCESS;
+}
+
+/** @internal
+ * @brief Stop a loopback stream, waking any waiting thread
+ */
+void _uvc_loopback_stop(uvc_stream_handle_t *strmh) {
+  __atomic_store_n(&strmh->running, 0, __ATOMIC_SEQ_CST);
+  _uvc_wait_word_wake(&strmh->frame_ready);
+  _uvc_wait_word_wake(&strmh->buf_freed);
+}
+
+/** @internal
+ * @brief Free a loopback stream; no thread may be using it
+ */
+void _uvc_loopback_close(uvc_stream_handle_t *strmh) {
+  _uvc_stream_free_frame_bufs(strmh);
+  free(strmh->frame.data);
+
+  _uvc_wait_word_destroy(&strmh->buf_freed);
+  _uvc_wait_word_destroy(&strmh->frame_ready);
+  pthread_cond_destroy(&strmh->cb_cond);
+  pthread_mutex_destroy(&strmh->cb_mutex);
+  free(strmh);
+}
+#endif /* LIBUVC_LOOPBACK */
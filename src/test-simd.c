@@ -0,0 +1,220 @@
+/* Checks the SIMD YUYV/UYVY/NV12/P010 to RGB/BGR kernels and the SIMD
+ * demosaicing kernels against the scalar code. Every kernel set the CPU can
+ * run is forced in turn and its output compared byte for byte with the
+ * scalar output, for random and saturating input, widths that leave a
+ * scalar tail after the SIMD blocks, an odd number of rows, every
+ * colorimetry and every Bayer pattern. Needs no camera; exits non-zero on a
+ * mismatch. */
+#include "libuvc/libuvc.h"
+#include "libuvc/libuvc_internal.h"
+#include <stdio.h>
+
+/* odd, so the last row of a 4:2:0 frame has a chroma row to itself */
+#define HEIGHT 3
+/* odd, and enough rows for the edge-aware filter to reach two rows out
+ * without reflecting */
+#define BAYER_HEIGHT 5
+#define MAX_WIDTH 1920
+
+static const char *isas[] = { "sse2", "ssse3", "avx2", "neon" };
+
+static const struct {
+  const char *name;
+  enum uvc_frame_format in_format;
+  uvc_error_t (*convert)(uvc_frame_t *in, uvc_frame_t *out);
+  /* bytes per pixel of the first plane */
+  unsigned int pixel_bytes;
+  /* 4:2:0 with a chroma plane after the luma rows */
+  int semi_planar;
+} conversions[] = {
+  { "uvc_yuyv2rgb", UVC_FRAME_FORMAT_YUYV, uvc_yuyv2rgb, 2, 0 },
+  { "uvc_yuyv2bgr", UVC_FRAME_FORMAT_YUYV, uvc_yuyv2bgr, 2, 0 },
+  { "uvc_uyvy2rgb", UVC_FRAME_FORMAT_UYVY, uvc_uyvy2rgb, 2, 0 },
+  { "uvc_uyvy2bgr", UVC_FRAME_FORMAT_UYVY, uvc_uyvy2bgr, 2, 0 },
+  { "uvc_nv12_2rgb", UVC_FRAME_FORMAT_NV12, uvc_nv12_2rgb, 1, 1 },
+  { "uvc_nv12_2bgr", UVC_FRAME_FORMAT_NV12, uvc_nv12_2bgr, 1, 1 },
+  { "uvc_p010_2rgb", UVC_FRAME_FORMAT_P010, uvc_p010_2rgb, 2, 1 },
+  { "uvc_p010_2bgr", UVC_FRAME_FORMAT_P010, uvc_p010_2bgr, 2, 1 },
+};
+
+static const enum uvc_frame_format bayer_formats[] = {
+  UVC_FRAME_FORMAT_SRGGB8, UVC_FRAME_FORMAT_SGRBG8,
+  UVC_FRAME_FORMAT_SGBRG8, UVC_FRAME_FORMAT_SBGGR8,
+};
+
+static const struct {
+  const char *name;
+  enum uvc_demosaic_method method;
+} demosaic_methods[] = {
+  { "bilinear", UVC_DEMOSAIC_BILINEAR },
+  { "edge-aware", UVC_DEMOSAIC_EDGE_AWARE },
+};
+
+static const struct {
+  enum uvc_frame_format format;
+  unsigned int pixel_bytes;
+} demosaic_outputs[] = {
+  { UVC_FRAME_FORMAT_RGB, 3 },
+  { UVC_FRAME_FORMAT_BGR, 3 },
+  { UVC_FRAME_FORMAT_GRAY8, 1 },
+};
+
+/* Mostly the extremes, which push every channel into saturation */
+static uint8_t saturating_byte(void) {
+  static const uint8_t values[] = { 0, 1, 16, 128, 235, 240, 254, 255 };
+  return values[rand() % (sizeof(values) / sizeof(values[0]))];
+}
+
+static void fill(uvc_frame_t *in, int saturating) {
+  size_t i;
+
+  for (i = 0; i < in->data_bytes; i++)
+    ((uint8_t *) in->data)[i] = saturating ? saturating_byte() : (uint8_t) rand();
+}
+
+static int convert(int conv, uvc_frame_t *in, uvc_frame_t *out) {
+  uvc_error_t ret = conversions[conv].convert(in, out);
+
+  if (ret != UVC_SUCCESS) {
+    uvc_perror(ret, conversions[conv].name);
+    return -1;
+  }
+  return 0;
+}
+
+static int demosaic(uvc_frame_t *in, uvc_frame_t *out, unsigned int method,
+    unsigned int output) {
+  uvc_error_t ret = uvc_demosaic(NULL, in, out, demosaic_outputs[output].format,
+                                 demosaic_methods[method].method);
+
+  if (ret != UVC_SUCCESS) {
+    uvc_perror(ret, "uvc_demosaic");
+    return -1;
+  }
+  return 0;
+}
+
+/* Compares one kernel set's demosaicing with the scalar code; returns the
+ * number of mismatches, or -1 on error */
+static int check_demosaic(const char *isa, uvc_frame_t *in, uvc_frame_t *expected,
+    uvc_frame_t *out, unsigned int *checked) {
+  unsigned int pattern, method, output, width, trial;
+  int failures = 0;
+
+  for (pattern = 0; pattern < sizeof(bayer_formats) / sizeof(bayer_formats[0]); pattern++) {
+    for (method = 0; method < sizeof(demosaic_methods) / sizeof(demosaic_methods[0]); method++) {
+      for (output = 0; output < sizeof(demosaic_outputs) / sizeof(demosaic_outputs[0]);
+           output++) {
+        /* both parities and every remainder after the 8 pixel blocks */
+        for (width = 3; width <= MAX_WIDTH; width = width == 40 ? MAX_WIDTH : width + 1) {
+          for (trial = 0; trial < 2; trial++) {
+            size_t row_bytes = width * demosaic_outputs[output].pixel_bytes;
+            uint32_t y;
+
+            in->data_bytes = width * BAYER_HEIGHT;
+            in->width = width;
+            in->height = BAYER_HEIGHT;
+            in->step = width;
+            in->frame_format = bayer_formats[pattern];
+            fill(in, trial);
+
+            _uvc_simd_use_kernels("scalar");
+            if (demosaic(in, expected, method, output) < 0)
+              return -1;
+            _uvc_simd_use_kernels(isa);
+            if (demosaic(in, out, method, output) < 0)
+              return -1;
+
+            for (y = 0; y < BAYER_HEIGHT; y++) {
+              if (memcmp((uint8_t *) expected->data + y * expected->step,
+                         (uint8_t *) out->data + y * out->step, row_bytes)) {
+                printf("%-5s uvc_demosaic %s: mismatch for pattern %u to format %d"
+                       " at width %u, row %u (%s input)\n", isa,
+                       demosaic_methods[method].name, pattern,
+                       demosaic_outputs[output].format, width, y,
+                       trial ? "saturating" : "random");
+                failures++;
+                break;
+              }
+            }
+            (*checked)++;
+          }
+        }
+      }
+    }
+  }
+
+  return failures;
+}
+
+int main(void) {
+  uvc_frame_t *in = uvc_allocate_frame(MAX_WIDTH * 2 * (HEIGHT + (HEIGHT + 1) / 2));
+  uvc_frame_t *expected = uvc_allocate_frame(0);
+  uvc_frame_t *out = uvc_allocate_frame(0);
+  unsigned int i, conv, width, trial, failures = 0, checked = 0;
+  int ret;
+
+  srand(1);
+
+  for (i = 0; i < sizeof(isas) / sizeof(isas[0]); i++) {
+    if (_uvc_simd_use_kernels(isas[i]) != UVC_SUCCESS) {
+      printf("%-5s skipped\n", isas[i]);
+      continue;
+    }
+
+    for (conv = 0; conv < sizeof(conversions) / sizeof(conversions[0]); conv++) {
+      /* every remainder after 8 and 16 pixel blocks, plus a full HD row */
+      for (width = 2; width <= MAX_WIDTH; width = width == 72 ? MAX_WIDTH : width + 2) {
+        for (trial = 0; trial < 2 * 6; trial++) {
+          size_t row_bytes = width * 3;
+          uint32_t y;
+
+          in->step = width * conversions[conv].pixel_bytes;
+          in->data_bytes = in->step * HEIGHT;
+          if (conversions[conv].semi_planar)
+            in->data_bytes += in->step * ((HEIGHT + 1) / 2);
+          in->width = width;
+          in->height = HEIGHT;
+          in->frame_format = conversions[conv].in_format;
+          in->color_matrix = (enum uvc_color_matrix) (trial / 2 % 3);
+          in->color_range = (enum uvc_color_range) (trial / 6);
+          fill(in, trial % 2);
+
+          _uvc_simd_use_kernels("scalar");
+          if (convert(conv, in, expected) < 0)
+            return 1;
+          _uvc_simd_use_kernels(isas[i]);
+          if (convert(conv, in, out) < 0)
+            return 1;
+
+          for (y = 0; y < HEIGHT; y++) {
+            if (memcmp((uint8_t *) expected->data + y * expected->step,
+                       (uint8_t *) out->data + y * out->step, row_bytes)) {
+              printf("%-5s %s: mismatch at width %u, row %u (%s input)\n",
+                     isas[i], conversions[conv].name, width, y,
+                     trial % 2 ? "saturating" : "random");
+              failures++;
+              break;
+            }
+          }
+          checked++;
+        }
+      }
+    }
+
+    ret = check_demosaic(isas[i], in, expected, out, &checked);
+    if (ret < 0)
+      return 1;
+    failures += ret;
+
+    printf("%-5s checked\n", isas[i]);
+  }
+
+  printf("%u conversions compared, %u mismatches\n", checked, failures);
+
+  uvc_free_frame(in);
+  uvc_free_frame(expected);
+  uvc_free_frame(out);
+
+  return failures ? 1 : 0;
+}